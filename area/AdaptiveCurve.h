@@ -0,0 +1,111 @@
+/*
+Adaptively sampled curve
+
+Starting from a coarse uniform grid, each interval is split at its midpoint
+while the midpoint's departure from the straight line through its ends (half
+the second difference) is above a tolerance and above the noise of the
+evaluations.  Flat plateaus stop after one midpoint while edges are refined
+down to a minimum step, so the samples end up irregular and concentrated where
+the curve bends.  Linear interpolation between them is then good to about the
+tolerance everywhere.
+
+The coarse grid must be fine enough that every feature of the curve shows up
+in at least one coarse interval.
+*/
+
+#ifndef ADAPTIVECURVE_H
+#define ADAPTIVECURVE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+class AdaptiveCurve
+{
+public:
+	// f(x, sigma) returns the curve at x and sets sigma to its uncertainty (zero when exact)
+	typedef std::function<double(double, double &)> Function;
+
+	AdaptiveCurve(Function f, double xmin, double xmax, size_t coarse, double tolerance, double minStep)
+		: _f(f)
+	{
+		this->_tolerance = tolerance;
+		this->_minStep = minStep;
+		if(coarse < 1) coarse = 1;
+
+		double s0, s1;
+		double x0 = xmin;
+		double f0 = this->_f(x0, s0);
+		push(x0, f0);
+		for (size_t i = 1; i <= coarse; ++i)
+		{
+			double x1 = xmin + (xmax - xmin)*i/coarse;
+			double f1 = this->_f(x1, s1);
+			refine(x0, f0, s0, x1, f1, s1);
+			push(x1, f1);
+			x0 = x1;
+			f0 = f1;
+			s0 = s1;
+		}
+	}
+
+	size_t size() const
+	{
+		return this->_x.size();
+	}
+
+	double getX(size_t i) const
+	{
+		return this->_x[i];
+	}
+
+	double getF(size_t i) const
+	{
+		return this->_y[i];
+	}
+
+	// Linear interpolation, clamped to the end values outside the sampled range
+	double operator()(double x) const
+	{
+		if(x <= this->_x.front()) return this->_y.front();
+		if(x >= this->_x.back()) return this->_y.back();
+		size_t j = std::upper_bound(this->_x.begin(), this->_x.end(), x) - this->_x.begin();
+		double f = (x - this->_x[j - 1])/(this->_x[j] - this->_x[j - 1]);
+		return (1 - f)*this->_y[j - 1] + f*this->_y[j];
+	}
+
+private:
+	void push(double x, double f)
+	{
+		this->_x.push_back(x);
+		this->_y.push_back(f);
+	}
+
+	// Adds the samples strictly inside (x0, x1) in order
+	void refine(double x0, double f0, double s0, double x1, double f1, double s1)
+	{
+		if(x1 - x0 <= this->_minStep) return;
+		double sm;
+		double xm = 0.5*(x0 + x1);
+		double fm = this->_f(xm, sm);
+		double bend = std::fabs(fm - 0.5*(f0 + f1));
+		double noise = 3*std::sqrt(sm*sm + 0.25*(s0*s0 + s1*s1));
+		if(bend > this->_tolerance && bend > noise) {
+			refine(x0, f0, s0, xm, fm, sm);
+			push(xm, fm);
+			refine(xm, fm, sm, x1, f1, s1);
+		} else {
+			push(xm, fm);
+		}
+	}
+
+	Function _f;
+	double _tolerance;
+	double _minStep;
+	std::vector<double> _x;
+	std::vector<double> _y;
+};
+
+#endif
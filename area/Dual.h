@@ -0,0 +1,144 @@
+/*
+Forward mode dual numbers
+
+A Dual<N> carries a value and its derivatives with respect to N independent
+parameters.  Evaluating a function templated on its scalar type with Dual<N>
+arguments gives exact derivatives in the same pass as the value.  Comparisons
+only look at the value, so branches follow the double precision path.
+*/
+
+#ifndef DUAL_H
+#define DUAL_H
+
+#include <cmath>
+
+template<int N>
+class Dual
+{
+public:
+	Dual()
+	{
+		this->v = 0;
+		for (int i = 0; i < N; ++i) this->d[i] = 0;
+	}
+
+	Dual(double value)
+	{
+		this->v = value;
+		for (int i = 0; i < N; ++i) this->d[i] = 0;
+	}
+
+	// An independent parameter: derivative one with respect to itself
+	Dual(double value, int index)
+	{
+		this->v = value;
+		for (int i = 0; i < N; ++i) this->d[i] = 0;
+		this->d[index] = 1;
+	}
+
+	Dual &operator+=(const Dual &b)
+	{
+		this->v += b.v;
+		for (int i = 0; i < N; ++i) this->d[i] += b.d[i];
+		return *this;
+	}
+
+	Dual &operator-=(const Dual &b)
+	{
+		this->v -= b.v;
+		for (int i = 0; i < N; ++i) this->d[i] -= b.d[i];
+		return *this;
+	}
+
+	double v;
+	double d[N];
+};
+
+// Applies the chain rule for f(a) with f'(a) = df
+template<int N>
+inline Dual<N> chain(double value, double df, const Dual<N> &a)
+{
+	Dual<N> r(value);
+	for (int i = 0; i < N; ++i) r.d[i] = df*a.d[i];
+	return r;
+}
+
+template<int N>
+inline Dual<N> operator+(Dual<N> a, const Dual<N> &b) { return a += b; }
+template<int N>
+inline Dual<N> operator-(Dual<N> a, const Dual<N> &b) { return a -= b; }
+template<int N>
+inline Dual<N> operator-(const Dual<N> &a) { return chain(-a.v, -1, a); }
+
+template<int N>
+inline Dual<N> operator*(const Dual<N> &a, const Dual<N> &b)
+{
+	Dual<N> r(a.v*b.v);
+	for (int i = 0; i < N; ++i) r.d[i] = a.d[i]*b.v + a.v*b.d[i];
+	return r;
+}
+
+template<int N>
+inline Dual<N> operator/(const Dual<N> &a, const Dual<N> &b)
+{
+	Dual<N> r(a.v/b.v);
+	for (int i = 0; i < N; ++i) r.d[i] = (a.d[i] - r.v*b.d[i])/b.v;
+	return r;
+}
+
+// Mixed arithmetic with plain doubles
+template<int N> inline Dual<N> operator+(const Dual<N> &a, double b) { return a + Dual<N>(b); }
+template<int N> inline Dual<N> operator+(double a, const Dual<N> &b) { return Dual<N>(a) + b; }
+template<int N> inline Dual<N> operator-(const Dual<N> &a, double b) { return a - Dual<N>(b); }
+template<int N> inline Dual<N> operator-(double a, const Dual<N> &b) { return Dual<N>(a) - b; }
+template<int N> inline Dual<N> operator*(const Dual<N> &a, double b) { return chain(a.v*b, b, a); }
+template<int N> inline Dual<N> operator*(double a, const Dual<N> &b) { return chain(a*b.v, a, b); }
+template<int N> inline Dual<N> operator/(const Dual<N> &a, double b) { return chain(a.v/b, 1/b, a); }
+template<int N> inline Dual<N> operator/(double a, const Dual<N> &b) { return Dual<N>(a)/b; }
+
+template<int N> inline bool operator<(const Dual<N> &a, const Dual<N> &b) { return a.v < b.v; }
+template<int N> inline bool operator>(const Dual<N> &a, const Dual<N> &b) { return a.v > b.v; }
+template<int N> inline bool operator<=(const Dual<N> &a, const Dual<N> &b) { return a.v <= b.v; }
+template<int N> inline bool operator>=(const Dual<N> &a, const Dual<N> &b) { return a.v >= b.v; }
+template<int N> inline bool operator==(const Dual<N> &a, const Dual<N> &b) { return a.v == b.v; }
+template<int N> inline bool operator<(const Dual<N> &a, double b) { return a.v < b; }
+template<int N> inline bool operator>(const Dual<N> &a, double b) { return a.v > b; }
+template<int N> inline bool operator<=(const Dual<N> &a, double b) { return a.v <= b; }
+template<int N> inline bool operator>=(const Dual<N> &a, double b) { return a.v >= b; }
+template<int N> inline bool operator==(const Dual<N> &a, double b) { return a.v == b; }
+
+template<int N>
+inline Dual<N> sqrt(const Dual<N> &a)
+{
+	double s = std::sqrt(a.v);
+	return chain(s, 0.5/s, a);
+}
+
+template<int N>
+inline Dual<N> sin(const Dual<N> &a)
+{
+	return chain(std::sin(a.v), std::cos(a.v), a);
+}
+
+template<int N>
+inline Dual<N> cos(const Dual<N> &a)
+{
+	return chain(std::cos(a.v), -std::sin(a.v), a);
+}
+
+template<int N>
+inline Dual<N> fabs(const Dual<N> &a)
+{
+	return (a.v < 0)?(-a):a;
+}
+
+template<int N>
+inline Dual<N> atan2(const Dual<N> &y, const Dual<N> &x)
+{
+	double rSq = x.v*x.v + y.v*y.v;
+	Dual<N> r(std::atan2(y.v, x.v));
+	for (int i = 0; i < N; ++i) r.d[i] = (x.v*y.d[i] - y.v*x.d[i])/rSq;
+	return r;
+}
+
+#endif
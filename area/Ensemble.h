@@ -0,0 +1,287 @@
+/*
+Manufacturing tolerance ensemble
+
+Draws finger geometries with Gaussian errors on each notch's position, angle
+and half width, evaluates each one's transmission curve over a swing with the
+exact overlap engine, and keeps only running statistics: the mean curve, its
+per sample variance and the shift of every edge crossing relative to the
+nominal geometry.  Members are shared between threads that each keep their own
+statistics, merged at the end, so memory does not grow with the ensemble size.
+*/
+
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "Circle.h"
+#include "Fingers.h"
+#include "Notch.h"
+#include "Overlap.h"
+#include "Pendulum.h"
+#include "Point.h"
+#include "Random.h"
+
+// One sigma manufacturing errors (meters and radians)
+struct Tolerances
+{
+	double position;
+	double angle;
+	double halfWidth;
+};
+
+// Running mean and variance of curves and edge shifts (Welford, with the
+// parallel merge of Chan et al.)
+class CurveStats
+{
+public:
+	CurveStats(size_t nsamples, size_t nedges)
+	{
+		this->_n = 0;
+		this->_edgeN = 0;
+		this->_mean.assign(nsamples, 0);
+		this->_m2.assign(nsamples, 0);
+		this->_edgeMean.assign(nedges, 0);
+		this->_edgeM2.assign(nedges, 0);
+	}
+
+	void add(const std::vector<double> &curve)
+	{
+		++this->_n;
+		for (size_t i = 0; i < this->_mean.size(); ++i)
+		{
+			double delta = curve[i] - this->_mean[i];
+			this->_mean[i] += delta/this->_n;
+			this->_m2[i] += delta*(curve[i] - this->_mean[i]);
+		}
+	}
+
+	void addEdges(const std::vector<double> &shifts)
+	{
+		++this->_edgeN;
+		for (size_t i = 0; i < this->_edgeMean.size(); ++i)
+		{
+			double delta = shifts[i] - this->_edgeMean[i];
+			this->_edgeMean[i] += delta/this->_edgeN;
+			this->_edgeM2[i] += delta*(shifts[i] - this->_edgeMean[i]);
+		}
+	}
+
+	void merge(const CurveStats &other)
+	{
+		mergeMoments(this->_n, this->_mean, this->_m2, other._n, other._mean, other._m2);
+		mergeMoments(this->_edgeN, this->_edgeMean, this->_edgeM2, other._edgeN, other._edgeMean, other._edgeM2);
+		this->_n += other._n;
+		this->_edgeN += other._edgeN;
+	}
+
+	uint64_t getN() const
+	{
+		return this->_n;
+	}
+
+	// Members whose edges could be matched one to one with the nominal curve
+	uint64_t getEdgeN() const
+	{
+		return this->_edgeN;
+	}
+
+	double getMean(size_t i) const
+	{
+		return this->_mean[i];
+	}
+
+	double getVariance(size_t i) const
+	{
+		return (this->_n > 1)?(this->_m2[i]/(this->_n - 1)):0;
+	}
+
+	double getEdgeMean(size_t i) const
+	{
+		return this->_edgeMean[i];
+	}
+
+	double getEdgeVariance(size_t i) const
+	{
+		return (this->_edgeN > 1)?(this->_edgeM2[i]/(this->_edgeN - 1)):0;
+	}
+
+	size_t getNSamples() const
+	{
+		return this->_mean.size();
+	}
+
+	size_t getNEdges() const
+	{
+		return this->_edgeMean.size();
+	}
+
+private:
+	static void mergeMoments(uint64_t n, std::vector<double> &mean, std::vector<double> &m2,
+		uint64_t otherN, const std::vector<double> &otherMean, const std::vector<double> &otherM2)
+	{
+		if(otherN == 0) return;
+		double total = (double)(n + otherN);
+		for (size_t i = 0; i < mean.size(); ++i)
+		{
+			double delta = otherMean[i] - mean[i];
+			mean[i] += delta*otherN/total;
+			m2[i] += otherM2[i] + delta*delta*n*otherN/total;
+		}
+	}
+
+	uint64_t _n;
+	uint64_t _edgeN;
+	std::vector<double> _mean;
+	std::vector<double> _m2;
+	std::vector<double> _edgeMean;
+	std::vector<double> _edgeM2;
+};
+
+class Ensemble
+{
+public:
+	// Curves have totalSamples samples secondsPerSample apart, centered on dead center
+	Ensemble(const Fingers &nominal, const Circle &beam, const Pendulum &pendulum,
+		uint32_t totalSamples, double secondsPerSample, Tolerances tolerances)
+		: _nominal(nominal), _beam(beam), _tolerances(tolerances)
+	{
+		this->_secondsPerSample = secondsPerSample;
+
+		std::vector<double> t(totalSamples);
+		for (uint32_t i = 0; i < totalSamples; ++i)
+		{
+			t[i] = (i - 0.5*totalSamples)*secondsPerSample;
+		}
+		double amplitude = pendulum.getAmplitude();
+		this->_x.resize(totalSamples);
+		this->_y.resize(totalSamples);
+		pendulum.getX(&t[0], totalSamples, &amplitude, 1, &this->_x[0]);
+		for (uint32_t i = 0; i < totalSamples; ++i)
+		{
+			this->_y[i] = pendulum.getY(this->_x[i]);
+		}
+
+		std::vector<std::vector<Point> > outlines;
+		std::vector<double> curve;
+		evaluate(nominal, curve, outlines);
+		findEdges(curve, this->_nominalEdges);
+	}
+
+	// Evaluates members geometries spread over threads, each with its own random stream
+	CurveStats run(uint64_t members, unsigned threads, uint64_t seed) const
+	{
+		if(threads == 0) threads = 1;
+		std::vector<CurveStats> partial(threads, CurveStats(this->_x.size(), this->_nominalEdges.size()));
+		std::vector<std::thread> workers;
+		for (unsigned k = 0; k < threads; ++k)
+		{
+			uint64_t count = members/threads + ((k < members%threads)?1:0);
+			workers.push_back(std::thread(&Ensemble::runPart, this, count, seed + k, &partial[k]));
+		}
+		for (unsigned k = 0; k < threads; ++k)
+		{
+			workers[k].join();
+		}
+		for (unsigned k = 1; k < threads; ++k)
+		{
+			partial[0].merge(partial[k]);
+		}
+		return partial[0];
+	}
+
+	// Edge crossing times of the nominal curve in seconds from dead center
+	std::vector<double> getNominalEdges() const
+	{
+		std::vector<double> edges(this->_nominalEdges);
+		for (size_t i = 0; i < edges.size(); ++i)
+		{
+			edges[i] = (edges[i] - 0.5*this->_x.size())*this->_secondsPerSample;
+		}
+		return edges;
+	}
+
+private:
+	void runPart(uint64_t count, uint64_t seed, CurveStats *stats) const
+	{
+		Random random(seed);
+		std::vector<std::vector<Point> > outlines;
+		std::vector<double> curve;
+		std::vector<double> edges;
+		for (uint64_t i = 0; i < count; ++i)
+		{
+			Fingers fingers = perturb(random);
+			evaluate(fingers, curve, outlines);
+			stats->add(curve);
+			findEdges(curve, edges);
+			if(edges.size() == this->_nominalEdges.size()) {
+				for (size_t j = 0; j < edges.size(); ++j)
+				{
+					edges[j] = (edges[j] - this->_nominalEdges[j])*this->_secondsPerSample;
+				}
+				stats->addEdges(edges);
+			}
+		}
+	}
+
+	Fingers perturb(Random &random) const
+	{
+		const std::vector<Notch> &nominal = this->_nominal.getNotches();
+		std::vector<Notch> notches;
+		for (std::vector<Notch>::const_iterator i = nominal.begin(); i != nominal.end(); ++i)
+		{
+			double angle = i->getAngle() + this->_tolerances.angle*random.gauss();
+			// Walls leaning past vertical are the same as leaning the other way
+			if(angle > M_PI/2) angle = M_PI - angle;
+			Point center(i->getX() + this->_tolerances.position*random.gauss(),
+				i->getY() + this->_tolerances.position*random.gauss());
+			double halfWidth = i->getHalfWidth() + this->_tolerances.halfWidth*random.gauss();
+			notches.push_back(Notch(angle, center, halfWidth));
+		}
+		Fingers fingers(notches);
+		fingers.setHalfWidth(this->_nominal.getHalfWidth());
+		return fingers;
+	}
+
+	void evaluate(const Fingers &fingers, std::vector<double> &curve, std::vector<std::vector<Point> > &outlines) const
+	{
+		Circle beam(this->_beam);
+		curve.resize(this->_x.size());
+		for (size_t i = 0; i < this->_x.size(); ++i)
+		{
+			beam.setX(this->_x[i]);
+			beam.setY(this->_y[i]);
+			curve[i] = getFractionalAreaExact(beam, fingers, outlines);
+		}
+	}
+
+	// Sample positions where the curve crosses a quarter or three quarters
+	// transmission, the midpoints between its three levels
+	static void findEdges(const std::vector<double> &curve, std::vector<double> &edges)
+	{
+		static const double thresholds[2] = { 0.25, 0.75 };
+		edges.clear();
+		for (size_t i = 0; i + 1 < curve.size(); ++i)
+		{
+			for (int k = 0; k < 2; ++k)
+			{
+				double a = curve[i] - thresholds[k];
+				double b = curve[i + 1] - thresholds[k];
+				if((a < 0) != (b < 0)) edges.push_back(i + a/(a - b));
+			}
+		}
+	}
+
+	const Fingers &_nominal;
+	Circle _beam;
+	Tolerances _tolerances;
+	double _secondsPerSample;
+	std::vector<double> _x;
+	std::vector<double> _y;
+	std::vector<double> _nominalEdges;
+};
+
+#endif
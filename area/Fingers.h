@@ -4,6 +4,7 @@
 #include <cmath>
 #include <vector>
 #include "Point.h"
+#include "Circle.h"
 #include "Notch.h"
 #include "Polygon.h"
 
@@ -28,6 +29,61 @@ public:
 		return false;
 	}
 
+	void getOutlines(const Circle &circle, std::vector<std::vector<Point> > &outlines) const
+	{
+		double r = circle.getR();
+		double x = circle.getX();
+		double y = circle.getY();
+		size_t n = 0;
+
+		outlines.resize(_notches.size() + 2);
+		for (std::vector<Notch>::const_iterator i = _notches.begin(); i != _notches.end(); ++i)
+		{
+			// Skip notches that cannot reach the circle
+			if(std::fabs(x + i->getX()) > i->getHalfWidth() + r) continue;
+			Circle local(r, transformPoint(circle.getC(), i->getX(), i->getY()));
+			std::vector<Point> &outline = outlines[n++];
+			i->getOutline(local, outline);
+			for (std::vector<Point>::iterator p = outline.begin(); p != outline.end(); ++p)
+			{
+				*p = transformPoint(*p, -i->getX(), -i->getY());
+			}
+		}
+		// Everything beyond the fingers is open
+		if(x + r > this->_halfwidth) {
+			std::vector<Point> &outline = outlines[n++];
+			outline.resize(4);
+			outline[0] = Point(this->_halfwidth, y - 2*r);
+			outline[1] = Point(x + 2*r, y - 2*r);
+			outline[2] = Point(x + 2*r, y + 2*r);
+			outline[3] = Point(this->_halfwidth, y + 2*r);
+		}
+		if(x - r < -this->_halfwidth) {
+			std::vector<Point> &outline = outlines[n++];
+			outline.resize(4);
+			outline[0] = Point(x - 2*r, y - 2*r);
+			outline[1] = Point(-this->_halfwidth, y - 2*r);
+			outline[2] = Point(-this->_halfwidth, y + 2*r);
+			outline[3] = Point(x - 2*r, y + 2*r);
+		}
+		outlines.resize(n);
+	}
+
+	const std::vector<Notch> &getNotches() const
+	{
+		return this->_notches;
+	}
+
+	double getHalfWidth() const
+	{
+		return this->_halfwidth;
+	}
+
+	void setHalfWidth(double halfwidth)
+	{
+		this->_halfwidth = halfwidth;
+	}
+
 
 private:
 	Point transformPoint(const Point point, double x_transform, double y_transform) const
@@ -0,0 +1,251 @@
+/*
+Synthetic IR frame generator
+
+Writes a binaryPackets stream (2 byte little endian chunk lengths followed by
+serial data) containing a boot packet and data packets whose raw buffers look
+like what the firmware sends: 10 bit ADC levels between lo and hi plus noise,
+truncated to their low byte and rotated by rawPhase.  Successive frames are
+alternate swings of the pendulum, looked up in a precomputed transmission map.
+Dead center crossings are exactly half a period apart, and each frame starts
+a jittered number of samples before its crossing, so that samplesSinceBoot
+plus the offset of the crossing in the frame gives the period back.
+
+Packet layouts follow mcu/packet.h (offsets below are relative to the start of
+the packet, including the 4 byte header).
+*/
+
+#ifndef FRAMEGENERATOR_H
+#define FRAMEGENERATOR_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "Random.h"
+#include "Pendulum.h"
+#include "TransmissionMap.h"
+
+class FrameGenerator
+{
+public:
+	static const size_t BOOT_PACKET_SIZE = 70;
+	static const size_t RAW_START = 56;
+
+	// Frames follow the pendulum's swing through the transmission map
+	FrameGenerator(const TransmissionMap &map, const Pendulum &pendulum, uint32_t rawLength)
+		: _map(map), _pendulum(pendulum), _random(24071966)
+	{
+		this->_rawLength = rawLength;
+		this->_lo = 100;
+		this->_hi = 900;
+		this->_noise = 1.5;
+		this->_adcTick = 8.32e-5;
+		this->_jitter = 50;
+		this->_chunkSize = 1024;
+		this->_sequenceNumber = 0;
+		this->_ticksSinceBoot = 0;
+		this->_crossing = 0;
+		this->_direction = 1;
+
+		// Gaussian deviates are drawn from a table to keep the per sample cost down
+		this->_gauss.resize(1 << 16);
+		for (size_t i = 0; i < this->_gauss.size(); i += 2)
+		{
+			double u1 = 1.0 - this->_random.uniform();
+			double u2 = this->_random.uniform();
+			double rho = std::sqrt(-2*std::log(u1));
+			this->_gauss[i] = rho*std::cos(2*M_PI*u2);
+			this->_gauss[i+1] = rho*std::sin(2*M_PI*u2);
+		}
+
+		// Tabulate the swing on a time grid finer than the ADC tick, so that
+		// frames only interpolate positions
+		this->_substeps = 16;
+		this->_halfSpan = (size_t)(0.5*rawLength + this->_jitter + 2)*this->_substeps;
+		std::vector<double> times(2*this->_halfSpan + 1);
+		for (size_t k = 0; k < times.size(); ++k)
+		{
+			times[k] = ((double)k - this->_halfSpan)*this->_adcTick/this->_substeps;
+		}
+		double amplitude = pendulum.getAmplitude();
+		this->_trajectory.resize(times.size());
+		pendulum.getX(&times[0], times.size(), &amplitude, 1, &this->_trajectory[0]);
+
+		this->_samples.resize(rawLength);
+		this->_packet.resize(RAW_START + rawLength);
+	}
+
+	void setLevels(double lo, double hi, double noise)
+	{
+		this->_lo = lo;
+		this->_hi = hi;
+		this->_noise = noise;
+	}
+
+	void setSeed(uint64_t seed)
+	{
+		this->_random.setSeed(seed);
+	}
+
+	void setChunkSize(size_t chunkSize)
+	{
+		this->_chunkSize = chunkSize;
+	}
+
+	double getPeriod() const
+	{
+		return this->_pendulum.getPeriod();
+	}
+
+	double getAmplitude() const
+	{
+		return this->_pendulum.getAmplitude();
+	}
+
+	// Sample index of the dead center crossing in the last generated frame
+	double getOffset() const
+	{
+		return this->_offset;
+	}
+
+	// Chronological 10 bit samples of the last generated frame
+	const std::vector<uint16_t> &getSamples() const
+	{
+		return this->_samples;
+	}
+
+	// The logger's file starts with padding before the first boot packet
+	void writeZeroes(FILE *out, size_t n)
+	{
+		std::vector<uint8_t> zeroes(n, 0);
+		writeChunks(out, &zeroes[0], n);
+	}
+
+	void writeBootPacket(FILE *out)
+	{
+		uint8_t packet[BOOT_PACKET_SIZE];
+		std::memset(packet, 0, sizeof(packet));
+		putHeader(packet, 0x00);
+		putLE(packet + 4, 0x5EED, 4);					// serialNumber
+		packet[8] = 1;									// bmpSensorStatus
+		packet[9] = 1;									// gpsSerialOk
+		packet[10] = 1;									// sensorBlockOK
+		putBE(packet + 64, 1860, 2);					// weekNumber
+		float timeOfWeek = 0;
+		uint32_t bits;
+		std::memcpy(&bits, &timeOfWeek, sizeof(bits));
+		putBE(packet + 66, bits, 4);					// timeOfWeek
+		writeChunks(out, packet, sizeof(packet));
+
+		this->_sequenceNumber = 0;
+		this->_ticksSinceBoot = 0;
+		this->_crossing = 0.5*getPeriod()/this->_adcTick;
+	}
+
+	// Generates the next swing and writes it as a data packet
+	void writeDataPacket(FILE *out)
+	{
+		generateFrame();
+
+		uint8_t *packet = &this->_packet[0];
+		std::memset(packet, 0, RAW_START);
+		putHeader(packet, 0x01);
+		putLE(packet + 4, ++this->_sequenceNumber, 4);
+		putLE(packet + 20, this->_ticksSinceBoot, 8);	// timeSinceLastBootPacket
+		putLE(packet + 28, 45*1024, 4);					// humidity
+		putLE(packet + 32, 101325, 4);					// pressure
+		putLE(packet + 36, 32768, 2);					// thermistor
+		putLE(packet + 42, this->_rawPhase, 2);			// rawPhase
+		packet[44] = 0x07;								// recieverMode
+		for (uint32_t i = 0; i < this->_rawLength; ++i)
+		{
+			packet[RAW_START + (this->_rawPhase + i)%this->_rawLength] = (uint8_t)(this->_samples[i] & 0xFF);
+		}
+		writeChunks(out, packet, this->_packet.size());
+
+		// Successive crossings are half a period apart
+		this->_crossing += 0.5*getPeriod()/this->_adcTick;
+	}
+
+private:
+	void generateFrame()
+	{
+		this->_direction = -this->_direction;
+		double offset = 0.5*this->_rawLength + (this->_random.uniform() - 0.5)*2*this->_jitter;
+		this->_ticksSinceBoot = (uint64_t)std::floor(this->_crossing - offset);
+		this->_offset = this->_crossing - this->_ticksSinceBoot;
+		this->_rawPhase = (uint16_t)(this->_random.next() % this->_rawLength);
+
+		double scale = this->_hi - this->_lo;
+		for (uint32_t i = 0; i < this->_rawLength; ++i)
+		{
+			double u = this->_direction*(i - this->_offset)*this->_substeps + this->_halfSpan;
+			size_t k = (size_t)u;
+			double f = u - k;
+			double x = (1 - f)*this->_trajectory[k] + f*this->_trajectory[k + 1];
+			double level = this->_lo + scale*this->_map(x) + this->_noise*this->_gauss[this->_random.next() & 0xFFFF];
+			long q = std::lround(level);
+			if(q < 0) q = 0;
+			if(q > 1023) q = 1023;
+			this->_samples[i] = (uint16_t)q;
+		}
+	}
+
+	void writeChunks(FILE *out, const uint8_t *data, size_t n)
+	{
+		while(n > 0)
+		{
+			size_t c = (n < this->_chunkSize)?n:this->_chunkSize;
+			uint8_t length[2] = { (uint8_t)(c & 0xFF), (uint8_t)(c >> 8) };
+			std::fwrite(length, 1, 2, out);
+			std::fwrite(data, 1, c, out);
+			data += c;
+			n -= c;
+		}
+	}
+
+	static void putHeader(uint8_t *packet, uint8_t type)
+	{
+		packet[0] = packet[1] = packet[2] = 0xFE;
+		packet[3] = type;
+	}
+
+	static void putLE(uint8_t *p, uint64_t value, int n)
+	{
+		for (int i = 0; i < n; ++i) p[i] = (uint8_t)(value >> (8*i));
+	}
+
+	static void putBE(uint8_t *p, uint64_t value, int n)
+	{
+		for (int i = 0; i < n; ++i) p[n - 1 - i] = (uint8_t)(value >> (8*i));
+	}
+
+	const TransmissionMap &_map;
+	const Pendulum &_pendulum;
+	Random _random;
+	uint32_t _rawLength;
+	double _lo;
+	double _hi;
+	double _noise;
+	double _adcTick;
+	double _jitter;
+	double _substeps;
+	size_t _halfSpan;
+	double _offset;
+	size_t _chunkSize;
+	uint32_t _sequenceNumber;
+	// Of the first sample of the last frame
+	uint64_t _ticksSinceBoot;
+	// Of the next dead center crossing, in ADC ticks since boot
+	double _crossing;
+	uint16_t _rawPhase;
+	int _direction;
+	std::vector<double> _gauss;
+	std::vector<double> _trajectory;
+	std::vector<uint16_t> _samples;
+	std::vector<uint8_t> _packet;
+};
+
+#endif
@@ -0,0 +1,729 @@
+/*
+Fits the finger geometry to measured frames
+
+Each frame is a swing of the pendulum past the beam, sampled every
+secondsPerSample, and is modelled as
+
+	sample[i] = lo + (hi - lo)*transmission(x(t), y(x))
+	t = direction*(i - t0)*secondsPerSample
+
+with x(t) the pendulum motion for a dead center speed (see Pendulum.h).  The
+notch positions, angles and half widths, the beam radius and the half width of
+the fingers are shared by all frames while t0, speed, lo and hi belong to each
+frame.  Levenberg-Marquardt steps use the exact Jacobian from
+OverlapJacobian.h, chained through the swing for t0 and speed.  The shared
+parameters are solved for on the Schur complement of the per frame blocks, so
+the cost of a step grows linearly with the number of frames, and frames are
+spread over a thread pool.  Parameters
+the frames do not constrain (e.g. the depth of a notch with vertical walls)
+keep their starting values and are reported with zero uncertainty.
+
+Far from the frames, the fit can settle on a geometry that misses a finger
+altogether, so the starting notches can instead be measured from the frames:
+guessGeometry() averages the half level crossings of the frames, scaled by the
+half width of the fingers.  The chi square is judged against the noise of the
+samples, estimated from their sample to sample scatter on the light level,
+and a fit whose reduced chi square is over MAX_REDUCED_CHI_SQUARE is rejected:
+its geometry does not explain the frames.  The frames of
+fit/NotchedFingersData.dat are rejected (reduced chi square 9.6): across every
+edge their residuals run from +15 ADC counts near dark to -16 near light, so
+the measured beam has softer tails than the uniform disc modelled here.
+
+Scaling every length of the geometry and every frame's speed together changes
+the frames only through the small departure of the swing from a sine, so the
+scale is set by a Gaussian prior on the half width of the fingers, centered on
+its starting value and as wide as their machining tolerance.  The prior is
+weighted by the noise variance, as the frames' chi square is in ADC counts.
+
+Geometry files are plain text, one item per line, with # comments:
+
+	notch angle(rad) x(m) y(m) halfwidth(m)
+	fingers halfwidth(m)
+	radius r(m)
+	speed v(m/s)
+
+where the speed, the median dead center speed of the fitted frames, is
+optional.
+*/
+
+#ifndef GEOMETRYFITTER_H
+#define GEOMETRYFITTER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "Circle.h"
+#include "Fingers.h"
+#include "Notch.h"
+#include "Overlap.h"
+#include "OverlapJacobian.h"
+#include "Pendulum.h"
+#include "Point.h"
+#include "ThreadPool.h"
+
+// Reads a geometry file, leaving halfwidth, radius and speed alone when they are not given
+inline bool readGeometry(const char *filename, std::vector<Notch> &notches, double &halfwidth, double &radius,
+	double *speed = NULL)
+{
+	FILE *in = std::fopen(filename, "r");
+	if(!in) return false;
+	char line[256];
+	notches.clear();
+	while(std::fgets(line, sizeof(line), in))
+	{
+		double a, x, y, hw;
+		if(std::sscanf(line, " notch %lf %lf %lf %lf", &a, &x, &y, &hw) == 4) {
+			notches.push_back(Notch(a, Point(x, y), hw));
+		} else if(std::sscanf(line, " fingers %lf", &a) == 1) {
+			halfwidth = a;
+		} else if(std::sscanf(line, " radius %lf", &a) == 1) {
+			radius = a;
+		} else if(std::sscanf(line, " speed %lf", &a) == 1) {
+			if(speed) *speed = a;
+		}
+	}
+	std::fclose(in);
+	return !notches.empty();
+}
+
+class GeometryFitter
+{
+public:
+	// Per frame parameters
+	enum { T0, SPEED, LO, HI, NUM_LOCAL };
+
+	// Of the half width of the fingers (m), as Ensemble.h's position tolerance
+	static constexpr double DEFAULT_HALFWIDTH_TOLERANCE = 50e-6;
+	static constexpr double MAX_REDUCED_CHI_SQUARE = 2;
+
+	GeometryFitter(const Fingers &fingers, double radius, const Pendulum &pendulum, double secondsPerSample)
+	{
+		this->_length = pendulum.getLength();
+		this->_omega = pendulum.getOmega();
+		this->_secondsPerSample = secondsPerSample;
+		this->_nNotches = fingers.getNotches().size();
+		this->_nGlobal = 4*this->_nNotches + 2;
+		this->_chi2 = 0;
+		this->_nSamples = 0;
+		this->_noiseSquares = 0;
+		this->_noiseCount = 0;
+		this->_nominalHalfWidth = fingers.getHalfWidth();
+		this->_halfWidthTolerance = DEFAULT_HALFWIDTH_TOLERANCE;
+
+		const std::vector<Notch> &notches = fingers.getNotches();
+		for (size_t i = 0; i < this->_nNotches; ++i)
+		{
+			this->_global.push_back(notches[i].getX());
+			this->_global.push_back(notches[i].getY());
+			this->_global.push_back(notches[i].getAngle());
+			this->_global.push_back(notches[i].getHalfWidth());
+		}
+		this->_global.push_back(radius);
+		this->_global.push_back(fingers.getHalfWidth());
+		this->_sigma.assign(this->_nGlobal, 0);
+	}
+
+	void setHalfWidthTolerance(double tolerance)
+	{
+		this->_halfWidthTolerance = tolerance;
+	}
+
+	// Adds a frame with starting values estimated from its levels and outer edges
+	void addFrame(const std::vector<double> &samples)
+	{
+		Frame frame;
+		frame.samples = samples;
+		frame.direction = 0;
+		frame.chi2 = 0;
+
+		std::vector<double> sorted(samples);
+		size_t n = sorted.size();
+		std::nth_element(sorted.begin(), sorted.begin() + n/100, sorted.end());
+		frame.local[LO] = sorted[n/100];
+		std::nth_element(sorted.begin(), sorted.begin() + n - 1 - n/100, sorted.end());
+		frame.local[HI] = sorted[n - 1 - n/100];
+
+		// Half level crossings, interpolated between samples
+		double mid = 0.5*(frame.local[LO] + frame.local[HI]);
+		for (size_t i = 1; i < n; ++i)
+		{
+			if((samples[i - 1] > mid) != (samples[i] > mid)) {
+				frame.edges.push_back(i - 1 + (mid - samples[i - 1])/(samples[i] - samples[i - 1]));
+			}
+		}
+
+		// The beam is dark between the outer edges of the fingers
+		size_t first = 0, last = n - 1;
+		while(first < n - 1 && samples[first] > mid) ++first;
+		while(last > first && samples[last] > mid) --last;
+		frame.local[T0] = 0.5*(first + last);
+		frame.local[SPEED] = (last > first)?(2*getHalfWidth()/((last - first)*this->_secondsPerSample)):0;
+
+		// Second differences where the beam is light are noise alone, with
+		// 3/2 the variance of a sample
+		for (size_t i = 1; i + 1 < n; ++i)
+		{
+			if(samples[i - 1] <= mid || samples[i] <= mid || samples[i + 1] <= mid) continue;
+			double d = samples[i] - 0.5*(samples[i - 1] + samples[i + 1]);
+			this->_noiseSquares += d*d/1.5;
+			++this->_noiseCount;
+		}
+
+		this->_frames.push_back(frame);
+		this->_nSamples += n;
+	}
+
+	// Replaces the starting positions and half widths of the notches that open
+	// past half level by the averages of the frames' half level crossings,
+	// scaled so that the outer edges are at the half width of the fingers.
+	// Frames with the most common number of crossings are turned to agree with
+	// the first of them, and each gap between crossings goes to the nearest
+	// starting notch, mirrored if that matches the starting geometry better.
+	// fit() keeps the directions of the frames turned here.
+	// Shallower notches keep their starting values.  Returns false without
+	// changes if no frame crosses the fingers.
+	bool guessGeometry()
+	{
+		std::vector<size_t> counts;
+		for (size_t f = 0; f < this->_frames.size(); ++f)
+		{
+			size_t n = this->_frames[f].edges.size();
+			if(n < 2 || n % 2 || n > 2*(this->_nNotches + 1)) continue;
+			if(counts.size() <= n) counts.resize(n + 1, 0);
+			++counts[n];
+		}
+		if(counts.empty()) return false;
+		size_t nEdges = std::max_element(counts.begin(), counts.end()) - counts.begin();
+
+		std::vector<double> mean(nEdges, 0), reference, u(nEdges);
+		std::vector<int> turned(this->_frames.size(), 0);
+		for (size_t f = 0; f < this->_frames.size(); ++f)
+		{
+			const std::vector<double> &edges = this->_frames[f].edges;
+			if(edges.size() != nEdges) continue;
+			double center = 0.5*(edges.front() + edges.back());
+			double half = 0.5*(edges.back() - edges.front());
+			for (size_t k = 0; k < nEdges; ++k) u[k] = (edges[k] - center)/half;
+			if(reference.empty()) reference = u;
+			double forward = 0, backward = 0;
+			for (size_t k = 0; k < nEdges; ++k)
+			{
+				forward += (u[k] - reference[k])*(u[k] - reference[k]);
+				backward += (u[k] + reference[nEdges - 1 - k])*(u[k] + reference[nEdges - 1 - k]);
+			}
+			turned[f] = (backward < forward)?-1:1;
+			for (size_t k = 0; k < nEdges; ++k)
+			{
+				mean[k] += (turned[f] > 0)?u[k]:-u[nEdges - 1 - k];
+			}
+		}
+		for (size_t k = 0; k < nEdges; ++k) mean[k] /= counts[nEdges];
+
+		// Notch x is minus the center of its gap
+		size_t nGaps = nEdges/2 - 1;
+		double halfWidth = getHalfWidth();
+		std::vector<double> x(nGaps), halfWidths(nGaps);
+		for (size_t i = 0; i < nGaps; ++i)
+		{
+			x[i] = -0.5*halfWidth*(mean[2*i + 1] + mean[2*i + 2]);
+			halfWidths[i] = 0.5*halfWidth*(mean[2*i + 2] - mean[2*i + 1]);
+		}
+		std::vector<size_t> direct, mirrored;
+		int mirror = (matchNotches(x, 1, direct) <= matchNotches(x, -1, mirrored))?1:-1;
+		const std::vector<size_t> &match = (mirror > 0)?direct:mirrored;
+		for (size_t i = 0; i < nGaps; ++i)
+		{
+			double *n = &this->_global[4*match[i]];
+			n[NOTCH_X] = mirror*x[i];
+			n[NOTCH_HALFWIDTH] = halfWidths[i];
+		}
+		for (size_t f = 0; f < this->_frames.size(); ++f)
+		{
+			if(turned[f]) this->_frames[f].direction = mirror*turned[f];
+		}
+		return true;
+	}
+
+	// Runs up to maxIterations Levenberg-Marquardt steps, returning the final chi square
+	double fit(ThreadPool &pool, int maxIterations, bool verbose)
+	{
+		size_t nFrames = this->_frames.size();
+		size_t P = this->_nGlobal;
+		if(nFrames == 0) return 0;
+
+		// Frames start at a common speed.  Those guessGeometry() did not turn start in
+		// whichever direction matches the starting geometry better.
+		std::vector<double> speeds;
+		for (size_t f = 0; f < nFrames; ++f)
+		{
+			if(this->_frames[f].local[SPEED] > 0) speeds.push_back(this->_frames[f].local[SPEED]);
+		}
+		if(!speeds.empty()) {
+			std::nth_element(speeds.begin(), speeds.begin() + speeds.size()/2, speeds.end());
+			for (size_t f = 0; f < nFrames; ++f)
+			{
+				this->_frames[f].local[SPEED] = speeds[speeds.size()/2];
+			}
+		}
+		pool.run(nFrames, [this](size_t f, unsigned) {
+			Frame &frame = this->_frames[f];
+			if(frame.direction != 0) return;
+			std::vector<std::vector<Point> > outlines;
+			Fingers fingers = makeFingers(this->_global);
+			frame.direction = 1;
+			double forward = chiSquare(fingers, this->_global[4*this->_nNotches], frame, frame.local, outlines);
+			frame.direction = -1;
+			double backward = chiSquare(fingers, this->_global[4*this->_nNotches], frame, frame.local, outlines);
+			frame.direction = (forward <= backward)?1:-1;
+		});
+
+		std::vector<Blocks> blocks(nFrames);
+		std::vector<std::vector<double> > U(pool.size()), g(pool.size());
+		std::vector<double> S, b, step(P), trialGlobal(P);
+		std::vector<double> trialLocal(nFrames*NUM_LOCAL), trialChi2(nFrames);
+		double lambda = 1e-3;
+
+		this->_chi2 = linearize(pool, blocks, U, g);
+		for (int iteration = 0; iteration < maxIterations; ++iteration)
+		{
+			reduce(blocks, U, g, lambda, S, b);
+			solve(S, P, b);
+			step = b;
+			for (size_t p = 0; p < P; ++p)
+			{
+				trialGlobal[p] = this->_global[p] + step[p];
+			}
+			constrainGlobal(trialGlobal);
+
+			// Back substitute for each frame's own step and evaluate the trial point
+			pool.run(nFrames, [&](size_t f, unsigned) {
+				const Blocks &block = blocks[f];
+				std::vector<double> V(block.V, block.V + NUM_LOCAL*NUM_LOCAL);
+				std::vector<double> r(block.gL, block.gL + NUM_LOCAL);
+				for (size_t k = 0; k < NUM_LOCAL; ++k)
+				{
+					V[k*NUM_LOCAL + k] *= 1 + lambda;
+					for (size_t p = 0; p < P; ++p) r[k] -= block.W[p*NUM_LOCAL + k]*step[p];
+				}
+				solve(V, NUM_LOCAL, r);
+				double *local = &trialLocal[f*NUM_LOCAL];
+				for (size_t k = 0; k < NUM_LOCAL; ++k)
+				{
+					local[k] = this->_frames[f].local[k] + r[k];
+				}
+				if(local[SPEED] <= 0) local[SPEED] = 0.5*this->_frames[f].local[SPEED];
+				std::vector<std::vector<Point> > outlines;
+				trialChi2[f] = chiSquare(makeFingers(trialGlobal), trialGlobal[4*this->_nNotches],
+					this->_frames[f], local, outlines);
+			});
+			double chi2 = prior(trialGlobal);
+			for (size_t f = 0; f < nFrames; ++f) chi2 += trialChi2[f];
+
+			if(verbose) std::fprintf(stderr, "iteration %d lambda %.1e chi2 %.6e trial %.6e\n",
+				iteration, lambda, this->_chi2, chi2);
+			if(chi2 < this->_chi2) {
+				double improvement = (this->_chi2 - chi2)/this->_chi2;
+				this->_global = trialGlobal;
+				for (size_t f = 0; f < nFrames; ++f)
+				{
+					std::copy(&trialLocal[f*NUM_LOCAL], &trialLocal[f*NUM_LOCAL] + NUM_LOCAL, this->_frames[f].local);
+				}
+				this->_chi2 = linearize(pool, blocks, U, g);
+				lambda = std::max(lambda/10, 1e-9);
+				if(improvement < 1e-9) break;
+			} else {
+				// Rejected steps that change nothing are rounding noise at the minimum
+				if(chi2 - this->_chi2 < 1e-9*this->_chi2) break;
+				lambda *= 10;
+				if(lambda > 1e9) break;
+			}
+		}
+
+		// Uncertainties of the shared parameters from the undamped normal equations
+		reduce(blocks, U, g, 0, S, b);
+		double scale = this->_chi2/getDegreesOfFreedom();
+		for (size_t p = 0; p < P; ++p)
+		{
+			std::vector<double> e(P, 0);
+			e[p] = 1;
+			solve(S, P, e);
+			this->_sigma[p] = std::sqrt(std::max(0.0, e[p]*scale));
+		}
+		return this->_chi2;
+	}
+
+	Fingers getFingers() const
+	{
+		return makeFingers(this->_global);
+	}
+
+	double getRadius() const
+	{
+		return this->_global[4*this->_nNotches];
+	}
+
+	double getHalfWidth() const
+	{
+		return this->_global[4*this->_nNotches + 1];
+	}
+
+	// Median dead center speed of the frames
+	double getSpeed() const
+	{
+		std::vector<double> speeds;
+		for (size_t f = 0; f < this->_frames.size(); ++f) speeds.push_back(this->_frames[f].local[SPEED]);
+		if(speeds.empty()) return 0;
+		std::nth_element(speeds.begin(), speeds.begin() + speeds.size()/2, speeds.end());
+		return speeds[speeds.size()/2];
+	}
+
+	double getChiSquare() const
+	{
+		return this->_chi2;
+	}
+
+	// Root mean square noise of a sample
+	double getNoise() const
+	{
+		return this->_noiseCount?std::sqrt(this->_noiseSquares/this->_noiseCount):0;
+	}
+
+	// Chi square per degree of freedom in units of the noise variance, about 1
+	// for a geometry that explains the frames
+	double getReducedChiSquare() const
+	{
+		double noise = getNoise();
+		return this->_chi2/(getDegreesOfFreedom()*std::max(noise*noise, 1e-300));
+	}
+
+	bool isRejected() const
+	{
+		return !(getReducedChiSquare() <= MAX_REDUCED_CHI_SQUARE);
+	}
+
+	// Writes the fitted geometry in the format read by readGeometry(), with
+	// uncertainties and the per frame parameters as comments.  Values are
+	// written in full so that vertical walls read back exactly vertical.
+	void writeGeometry(FILE *out) const
+	{
+		std::fprintf(out, "# frames %u samples %llu chi2/dof %.6f noise %.4f reduced chi2 %.4f\n",
+			(unsigned)this->_frames.size(), (unsigned long long)this->_nSamples,
+			this->_chi2/getDegreesOfFreedom(), getNoise(), getReducedChiSquare());
+		if(isRejected()) {
+			std::fprintf(out, "# rejected: reduced chi2 over %g, the geometry does not explain the frames\n",
+				MAX_REDUCED_CHI_SQUARE);
+		}
+		std::fprintf(out, "# notch angle(rad) x(m) y(m) halfwidth(m)\n");
+		for (size_t i = 0; i < this->_nNotches; ++i)
+		{
+			const double *n = &this->_global[4*i];
+			const double *s = &this->_sigma[4*i];
+			std::fprintf(out, "notch %.17g %.17g %.17g %.17g\n", n[NOTCH_ANGLE], n[NOTCH_X], n[NOTCH_Y], n[NOTCH_HALFWIDTH]);
+			std::fprintf(out, "# +/- %.9f %.9f %.9f %.9f\n", s[NOTCH_ANGLE], s[NOTCH_X], s[NOTCH_Y], s[NOTCH_HALFWIDTH]);
+		}
+		std::fprintf(out, "fingers %.17g\n", getHalfWidth());
+		std::fprintf(out, "# +/- %.9f\n", this->_sigma[4*this->_nNotches + 1]);
+		std::fprintf(out, "radius %.17g\n", getRadius());
+		std::fprintf(out, "# +/- %.9f\n", this->_sigma[4*this->_nNotches]);
+		std::fprintf(out, "speed %.17g\n", getSpeed());
+		std::fprintf(out, "# frame direction t0 speed(m/s) lo hi chi2\n");
+		for (size_t f = 0; f < this->_frames.size(); ++f)
+		{
+			const Frame &frame = this->_frames[f];
+			std::fprintf(out, "# %u %+d %.4f %.6f %.2f %.2f %.1f\n", (unsigned)f, frame.direction,
+				frame.local[T0], frame.local[SPEED], frame.local[LO], frame.local[HI], frame.chi2);
+		}
+	}
+
+private:
+	struct Frame
+	{
+		std::vector<double> samples;
+		// Half level crossings in samples
+		std::vector<double> edges;
+		double local[NUM_LOCAL];
+		// +1 or -1, or 0 until guessGeometry() or fit() decides
+		int direction;
+		double chi2;
+	};
+
+	// A frame's share of the normal equations: its own block V, the coupling W
+	// to the shared parameters (P rows of NUM_LOCAL) and its gradient gL
+	struct Blocks
+	{
+		double V[NUM_LOCAL*NUM_LOCAL];
+		std::vector<double> W;
+		double gL[NUM_LOCAL];
+	};
+
+	Fingers makeFingers(const std::vector<double> &global) const
+	{
+		std::vector<Notch> notches;
+		for (size_t i = 0; i < this->_nNotches; ++i)
+		{
+			const double *n = &global[4*i];
+			notches.push_back(Notch(n[NOTCH_ANGLE], Point(n[NOTCH_X], n[NOTCH_Y]), n[NOTCH_HALFWIDTH]));
+		}
+		Fingers fingers(notches);
+		fingers.setHalfWidth(global[4*this->_nNotches + 1]);
+		return fingers;
+	}
+
+	double getDegreesOfFreedom() const
+	{
+		return std::max(1.0, (double)this->_nSamples - this->_nGlobal - NUM_LOCAL*this->_frames.size());
+	}
+
+	// Matches notches at mirror*x to the nearest distinct current notches in
+	// turn, returning the sum of the squared distances
+	double matchNotches(const std::vector<double> &x, int mirror, std::vector<size_t> &match) const
+	{
+		std::vector<bool> used(this->_nNotches, false);
+		double distance = 0;
+		match.assign(x.size(), 0);
+		for (size_t i = 0; i < x.size(); ++i)
+		{
+			double best = HUGE_VAL;
+			for (size_t j = 0; j < this->_nNotches; ++j)
+			{
+				double d = this->_global[4*j + NOTCH_X] - mirror*x[i];
+				if(used[j] || d*d >= best) continue;
+				best = d*d;
+				match[i] = j;
+			}
+			used[match[i]] = true;
+			distance += best;
+		}
+		return distance;
+	}
+
+	// Walls may not lean past vertical and widths stay positive
+	void constrainGlobal(std::vector<double> &global) const
+	{
+		static const double piHalves = 2*std::atan(1);
+		for (size_t i = 0; i < this->_nNotches; ++i)
+		{
+			double *n = &global[4*i];
+			if(n[NOTCH_ANGLE] > piHalves) n[NOTCH_ANGLE] = piHalves;
+			if(n[NOTCH_ANGLE] < 1e-3) n[NOTCH_ANGLE] = 1e-3;
+			if(n[NOTCH_HALFWIDTH] < 1e-6) n[NOTCH_HALFWIDTH] = 1e-6;
+		}
+		double &radius = global[4*this->_nNotches];
+		if(radius < 1e-6) radius = 1e-6;
+		double &halfWidth = global[4*this->_nNotches + 1];
+		if(halfWidth < 1e-6) halfWidth = 1e-6;
+	}
+
+	// Beam position for sample i, with its derivatives along the swing
+	void position(const double *local, int direction, size_t i, double &x, double &y,
+		double &dxdt, double &dxdv) const
+	{
+		double t = direction*(i - local[T0])*this->_secondsPerSample;
+		double thetaMax = local[SPEED]/(this->_length*this->_omega);
+		double phase = std::sin(this->_omega*t);
+		double theta = thetaMax*phase;
+		x = this->_length*std::sin(theta);
+		y = this->_length - std::sqrt(this->_length*this->_length - x*x);
+		dxdt = local[SPEED]*std::cos(theta)*std::cos(this->_omega*t);
+		dxdv = std::cos(theta)*phase/this->_omega;
+	}
+
+	double chiSquare(const Fingers &fingers, double radius, const Frame &frame, const double *local,
+		std::vector<std::vector<Point> > &outlines) const
+	{
+		double chi2 = 0;
+		double x, y, dxdt, dxdv;
+		for (size_t i = 0; i < frame.samples.size(); ++i)
+		{
+			position(local, frame.direction, i, x, y, dxdt, dxdv);
+			double t = getFractionalAreaExact(Circle(radius, Point(x, y)), fingers, outlines);
+			double r = frame.samples[i] - (local[LO] + (local[HI] - local[LO])*t);
+			chi2 += r*r;
+		}
+		return chi2;
+	}
+
+	// Fills every frame's blocks and returns the chi square at the current parameters
+	double linearize(ThreadPool &pool, std::vector<Blocks> &blocks,
+		std::vector<std::vector<double> > &U, std::vector<std::vector<double> > &g)
+	{
+		size_t P = this->_nGlobal;
+		for (size_t k = 0; k < U.size(); ++k)
+		{
+			U[k].assign(P*P, 0);
+			g[k].assign(P, 0);
+		}
+		Fingers fingers = makeFingers(this->_global);
+		double radius = this->_global[4*this->_nNotches];
+
+		pool.run(this->_frames.size(), [&](size_t f, unsigned worker) {
+			Frame &frame = this->_frames[f];
+			Blocks &block = blocks[f];
+			double *u = &U[worker][0];
+			double *gG = &g[worker][0];
+			std::fill(block.V, block.V + NUM_LOCAL*NUM_LOCAL, 0.0);
+			std::fill(block.gL, block.gL + NUM_LOCAL, 0.0);
+			block.W.assign(P*NUM_LOCAL, 0);
+
+			std::vector<double> jacobian, dg(P);
+			double dl[NUM_LOCAL];
+			double x, y, dxdt, dxdv;
+			double range = frame.local[HI] - frame.local[LO];
+			frame.chi2 = 0;
+			for (size_t i = 0; i < frame.samples.size(); ++i)
+			{
+				position(frame.local, frame.direction, i, x, y, dxdt, dxdv);
+				double t = getFractionalAreaJacobian(Circle(radius, Point(x, y)), fingers, jacobian);
+				double r = frame.samples[i] - (frame.local[LO] + range*t);
+				frame.chi2 += r*r;
+
+				// Along the swing the beam also rises with x
+				double dtdx = jacobian[P] + jacobian[P + 1]*x/(this->_length - y);
+				dl[T0] = -range*dtdx*dxdt*frame.direction*this->_secondsPerSample;
+				dl[SPEED] = range*dtdx*dxdv;
+				dl[LO] = 1 - t;
+				dl[HI] = t;
+				for (size_t p = 0; p < P; ++p) dg[p] = range*jacobian[p];
+
+				for (size_t k = 0; k < NUM_LOCAL; ++k)
+				{
+					block.gL[k] += dl[k]*r;
+					for (size_t m = 0; m < NUM_LOCAL; ++m) block.V[k*NUM_LOCAL + m] += dl[k]*dl[m];
+				}
+				for (size_t p = 0; p < P; ++p)
+				{
+					if(dg[p] == 0) continue;
+					gG[p] += dg[p]*r;
+					for (size_t q = 0; q < P; ++q) u[p*P + q] += dg[p]*dg[q];
+					for (size_t k = 0; k < NUM_LOCAL; ++k) block.W[p*NUM_LOCAL + k] += dg[p]*dl[k];
+				}
+			}
+		});
+
+		for (size_t k = 1; k < U.size(); ++k)
+		{
+			for (size_t p = 0; p < P*P; ++p) U[0][p] += U[k][p];
+			for (size_t p = 0; p < P; ++p) g[0][p] += g[k][p];
+		}
+		// The prior is a residual of its own
+		size_t h = 4*this->_nNotches + 1;
+		double weight = getPriorWeight();
+		U[0][h*P + h] += weight;
+		g[0][h] += (this->_nominalHalfWidth - this->_global[h])*weight;
+		double chi2 = prior(this->_global);
+		for (size_t f = 0; f < this->_frames.size(); ++f) chi2 += this->_frames[f].chi2;
+		return chi2;
+	}
+
+	// The frames' chi square is in ADC units squared, so the prior's pull is
+	// scaled by the noise of a sample to weigh the same as the frames' residuals
+	double getPriorWeight() const
+	{
+		double noise = getNoise();
+		return ((noise > 0)?noise*noise:1)/(this->_halfWidthTolerance*this->_halfWidthTolerance);
+	}
+
+	// Chi square of the half width of the fingers from its nominal value
+	double prior(const std::vector<double> &global) const
+	{
+		double offset = global[4*this->_nNotches + 1] - this->_nominalHalfWidth;
+		return offset*offset*getPriorWeight();
+	}
+
+	// Damped normal equations for the shared parameters with the frames' own
+	// parameters eliminated: S = U - sum W V^-1 W^T, b = g - sum W V^-1 gL
+	void reduce(const std::vector<Blocks> &blocks, const std::vector<std::vector<double> > &U,
+		const std::vector<std::vector<double> > &g, double lambda, std::vector<double> &S, std::vector<double> &b) const
+	{
+		size_t P = this->_nGlobal;
+		S = U[0];
+		b = g[0];
+		for (size_t p = 0; p < P; ++p) S[p*P + p] *= 1 + lambda;
+
+		std::vector<double> V(NUM_LOCAL*NUM_LOCAL), column(NUM_LOCAL), VinvW(P*NUM_LOCAL);
+		for (size_t f = 0; f < blocks.size(); ++f)
+		{
+			const Blocks &block = blocks[f];
+			// Rows of V^-1 W^T, one solve per shared parameter
+			for (size_t p = 0; p < P; ++p)
+			{
+				V.assign(block.V, block.V + NUM_LOCAL*NUM_LOCAL);
+				for (size_t k = 0; k < NUM_LOCAL; ++k) V[k*NUM_LOCAL + k] *= 1 + lambda;
+				column.assign(&block.W[p*NUM_LOCAL], &block.W[p*NUM_LOCAL] + NUM_LOCAL);
+				solve(V, NUM_LOCAL, column);
+				std::copy(column.begin(), column.end(), &VinvW[p*NUM_LOCAL]);
+			}
+			for (size_t p = 0; p < P; ++p)
+			{
+				const double *w = &block.W[p*NUM_LOCAL];
+				for (size_t q = 0; q < P; ++q)
+				{
+					const double *z = &VinvW[q*NUM_LOCAL];
+					double sum = 0;
+					for (size_t k = 0; k < NUM_LOCAL; ++k) sum += w[k]*z[k];
+					S[p*P + q] -= sum;
+				}
+				const double *z = &VinvW[p*NUM_LOCAL];
+				for (size_t k = 0; k < NUM_LOCAL; ++k) b[p] -= z[k]*block.gL[k];
+			}
+		}
+	}
+
+	// Solves the symmetric system A x = b in place of b by Gaussian elimination.
+	// Parameters whose pivot vanishes are not constrained by the data and get no step.
+	static void solve(std::vector<double> A, size_t n, std::vector<double> &b)
+	{
+		std::vector<double> diagonal(n);
+		double largest = 0;
+		for (size_t k = 0; k < n; ++k)
+		{
+			diagonal[k] = A[k*n + k];
+			largest = std::max(largest, diagonal[k]);
+		}
+		for (size_t k = 0; k < n; ++k)
+		{
+			// Rounding noise is many orders of magnitude below any real constraint
+			double pivot = A[k*n + k];
+			if(!(pivot > 1e-12*diagonal[k]) || !(pivot > 1e-20*largest)) {
+				for (size_t j = 0; j < n; ++j) A[k*n + j] = A[j*n + k] = 0;
+				A[k*n + k] = 1;
+				b[k] = 0;
+				continue;
+			}
+			for (size_t i = k + 1; i < n; ++i)
+			{
+				double factor = A[i*n + k]/pivot;
+				if(factor == 0) continue;
+				for (size_t j = k + 1; j < n; ++j) A[i*n + j] -= factor*A[k*n + j];
+				b[i] -= factor*b[k];
+			}
+		}
+		for (size_t k = n; k-- > 0;)
+		{
+			double sum = b[k];
+			for (size_t j = k + 1; j < n; ++j) sum -= A[k*n + j]*b[j];
+			b[k] = sum/A[k*n + k];
+		}
+	}
+
+	std::vector<Frame> _frames;
+	std::vector<double> _global;
+	std::vector<double> _sigma;
+	size_t _nNotches;
+	size_t _nGlobal;
+	unsigned long long _nSamples;
+	// Of the light level's second differences, scaled to a sample's variance
+	double _noiseSquares;
+	unsigned long long _noiseCount;
+	double _nominalHalfWidth;
+	double _halfWidthTolerance;
+	double _length;
+	double _omega;
+	double _secondsPerSample;
+	double _chi2;
+};
+
+#endif
@@ -11,7 +11,9 @@ that the center is at the top/center of the notch.
 #define NOTCH_H
 
 #include <cmath>
+#include <vector>
 #include "Point.h"
+#include "Circle.h"
 #include "Polygon.h"
 
 
@@ -71,6 +73,29 @@ public:
 		return (((this->_infSlope)?(p.y >= 0):(abs_x) <= p.y*this->_slope) && abs_x <= this->_halfWidth);
 	}
 
+	void getOutlines(const Circle &circle, std::vector<std::vector<Point> > &outlines) const
+	{
+		outlines.resize(1);
+		getOutline(circle, outlines[0]);
+	}
+
+	// Outline of the notch in the coordinates used by inNotch(), deep enough to cover the circle
+	void getOutline(const Circle &circle, std::vector<Point> &outline) const
+	{
+		double hw = this->_halfWidth;
+		double depth = std::fabs(circle.getY()) + 2*circle.getR();
+		double shoulder = (this->_infSlope)?(0):(hw/this->_slope);
+		if(depth < shoulder) depth = shoulder;
+
+		outline.resize(this->_infSlope?4:5);
+		size_t i = 0;
+		if(!this->_infSlope) outline[i++] = Point(0,0);
+		outline[i++] = Point(hw,shoulder);
+		outline[i++] = Point(hw,depth);
+		outline[i++] = Point(-hw,depth);
+		outline[i++] = Point(-hw,shoulder);
+	}
+
 	double getAngle() const
 	{
 		return this->_angle;
@@ -86,6 +111,11 @@ public:
 		return this->_center.y;
 	}
 
+	double getHalfWidth() const
+	{
+		return this->_halfWidth;
+	}
+
 	bool isInfSlope() const
 	{
 		return this->_infSlope;
@@ -0,0 +1,118 @@
+/*
+Exact area of a circle overlapped by convex polygons
+
+Each polygon edge AB contributes the signed area of the circle intersected
+with the triangle (center, A, B).  Summing over the edges of a closed polygon
+gives the area of the circle inside the polygon, with no sampling noise.
+
+The calculation is templated on its scalar type so that it can also be run
+with Dual numbers (see Dual.h) to get exact derivatives.
+*/
+
+#ifndef OVERLAP_H
+#define OVERLAP_H
+
+#include <cmath>
+#include <vector>
+#include "Point.h"
+#include "Circle.h"
+#include "Polygon.h"
+
+// Signed area of the sector of a circle (centered at the origin) swept from u to v
+template<typename T>
+inline T circleSectorArea(const T &ux, const T &uy, const T &vx, const T &vy, const T &rSq)
+{
+	using std::atan2;
+	return 0.5*rSq*atan2(ux*vy - uy*vx, ux*vx + uy*vy);
+}
+
+// Signed area of a circle of radius r centered at the origin intersected with
+// the triangle (origin, a, b).  Positive when a->b runs counterclockwise.
+template<typename T>
+inline T circleTriangleArea(const T &ax, const T &ay, const T &bx, const T &by, const T &r)
+{
+	using std::sqrt;
+	T rSq = r*r;
+	T aSq = ax*ax + ay*ay;
+	T bSq = bx*bx + by*by;
+
+	if(aSq <= rSq && bSq <= rSq) return 0.5*(ax*by - ay*bx);
+
+	// Solve |a + t(b-a)|^2 = r^2 for the points where the edge crosses the circle
+	T dx = bx - ax;
+	T dy = by - ay;
+	T qa = dx*dx + dy*dy;
+	T qb = ax*dx + ay*dy;
+	T qc = aSq - rSq;
+	T disc = qb*qb - qa*qc;
+
+	if(qa == 0 || disc <= 0) return circleSectorArea(ax,ay,bx,by,rSq);
+
+	T root = sqrt(disc);
+	T t1 = (-qb - root)/qa;
+	T t2 = (-qb + root)/qa;
+	T p1x = ax + t1*dx, p1y = ay + t1*dy;
+	T p2x = ax + t2*dx, p2y = ay + t2*dy;
+
+	if(aSq <= rSq) {
+		// Leaves the circle at p2
+		return 0.5*(ax*p2y - ay*p2x) + circleSectorArea(p2x,p2y,bx,by,rSq);
+	} else if(bSq <= rSq) {
+		// Enters the circle at p1
+		return circleSectorArea(ax,ay,p1x,p1y,rSq) + 0.5*(p1x*by - p1y*bx);
+	} else if(t1 > 0 && t2 < 1) {
+		// Passes through the circle
+		return circleSectorArea(ax,ay,p1x,p1y,rSq) + 0.5*(p1x*p2y - p1y*p2x) + circleSectorArea(p2x,p2y,bx,by,rSq);
+	}
+	return circleSectorArea(ax,ay,bx,by,rSq);
+}
+
+// Area of the circle (center cx,cy and radius r) inside a convex polygon given by
+// its vertices (x[i],y[i]) in order
+template<typename T>
+inline T circlePolygonArea(const std::vector<T> &x, const std::vector<T> &y, const T &cx, const T &cy, const T &r)
+{
+	using std::fabs;
+	T area(0);
+	size_t n = x.size();
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		size_t j = (i+1)%n;
+		area += circleTriangleArea(T(x[i]-cx),T(y[i]-cy),T(x[j]-cx),T(y[j]-cy),r);
+	}
+	return fabs(area);
+}
+
+// Area of the circle inside a convex polygon given by its vertices in order
+inline double circlePolygonArea(const std::vector<Point> &polygon, const Circle &circle)
+{
+	double area = 0;
+	double cx = circle.getX();
+	double cy = circle.getY();
+	size_t n = polygon.size();
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		const Point &a = polygon[i];
+		const Point &b = polygon[(i+1)%n];
+		area += circleTriangleArea(a.x-cx,a.y-cy,b.x-cx,b.y-cy,circle.getR());
+	}
+	return std::fabs(area);
+}
+
+// Fraction of the circle inside the open region of the polygon.  The outlines
+// vector is scratch space that callers can reuse between evaluations.
+inline double getFractionalAreaExact(const Circle &circle, const Polygon &polygon,
+	std::vector<std::vector<Point> > &outlines)
+{
+	polygon.getOutlines(circle,outlines);
+	double area = 0;
+	for (std::vector<std::vector<Point> >::const_iterator i = outlines.begin(); i != outlines.end(); ++i)
+	{
+		area += circlePolygonArea(*i,circle);
+	}
+	return area/(4*std::atan(1)*circle.getRSq());
+}
+
+#endif
@@ -0,0 +1,133 @@
+/*
+Derivatives of the beam transmission with respect to the finger geometry
+
+The notches of a Fingers polygon do not overlap, so each one's contribution to
+the transmitted area depends only on its own position, angle and half width,
+plus the beam radius and position.  Each piece is evaluated once with Dual
+numbers seeded for those six parameters and the results are scattered into a
+Jacobian over the whole geometry, with the open sides beyond the fingers
+seeded for the half width of the fingers:
+
+	jacobian[4*i + 0..3]	d/d(notch i x, y, angle, half width)
+	jacobian[4*n]			d/d(beam radius)
+	jacobian[4*n + 1]		d/d(fingers half width)
+	jacobian[4*n + 2]		d/d(beam x)
+	jacobian[4*n + 3]		d/d(beam y)
+*/
+
+#ifndef OVERLAPJACOBIAN_H
+#define OVERLAPJACOBIAN_H
+
+#include <cmath>
+#include <vector>
+
+#include "Circle.h"
+#include "Dual.h"
+#include "Fingers.h"
+#include "Notch.h"
+#include "Overlap.h"
+
+enum GeometryParameter { NOTCH_X, NOTCH_Y, NOTCH_ANGLE, NOTCH_HALFWIDTH, BEAM_RADIUS, FINGERS_HALFWIDTH, BEAM_X, BEAM_Y,
+	NUM_GEOMETRY_PARAMETERS };
+
+typedef Dual<NUM_GEOMETRY_PARAMETERS> GeometryDual;
+
+// Value of a scalar without its derivatives
+inline double value(double a)
+{
+	return a;
+}
+
+template<int N>
+inline double value(const Dual<N> &a)
+{
+	return a.v;
+}
+
+// Outline of a notch placed as in Fingers (apex at -(nx,ny)), deep enough to
+// cover a beam at height beamY.  Unlike Notch::getOutline() vertical walls are
+// not special cased, so derivatives with respect to the angle are defined there.
+template<typename T>
+void getNotchOutline(const T &nx, const T &ny, const T &angle, const T &halfWidth, double beamY, double r,
+	std::vector<T> &x, std::vector<T> &y)
+{
+	using std::sin;
+	using std::cos;
+	T shoulder = halfWidth*cos(angle)/sin(angle);
+	T depth(std::fabs(beamY + value(ny)) + 2*r);
+	if(depth < shoulder) depth = shoulder;
+
+	x.resize(5);
+	y.resize(5);
+	x[0] = T(0) - nx;			y[0] = T(0) - ny;
+	x[1] = halfWidth - nx;		y[1] = shoulder - ny;
+	x[2] = halfWidth - nx;		y[2] = depth - ny;
+	x[3] = T(0) - halfWidth - nx;	y[3] = depth - ny;
+	x[4] = T(0) - halfWidth - nx;	y[4] = shoulder - ny;
+}
+
+// Fraction of the beam transmitted by fingers, filling jacobian as described above
+inline double getFractionalAreaJacobian(const Circle &beam, const Fingers &fingers, std::vector<double> &jacobian)
+{
+	const std::vector<Notch> &notches = fingers.getNotches();
+	size_t n = notches.size();
+	double r = beam.getR();
+	double bx = beam.getX();
+	double by = beam.getY();
+
+	jacobian.assign(4*n + 4, 0);
+	GeometryDual radius(r, BEAM_RADIUS);
+	GeometryDual cx(bx, BEAM_X);
+	GeometryDual cy(by, BEAM_Y);
+	GeometryDual area(0);
+	std::vector<GeometryDual> x, y;
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		const Notch &notch = notches[i];
+		if(std::fabs(bx + notch.getX()) > notch.getHalfWidth() + r) continue;
+		getNotchOutline(GeometryDual(notch.getX(), NOTCH_X), GeometryDual(notch.getY(), NOTCH_Y),
+			GeometryDual(notch.getAngle(), NOTCH_ANGLE), GeometryDual(notch.getHalfWidth(), NOTCH_HALFWIDTH),
+			by, r, x, y);
+		GeometryDual piece = circlePolygonArea(x, y, cx, cy, radius);
+		for (int k = 0; k < 4; ++k)
+		{
+			jacobian[4*i + k] += piece.d[k];
+		}
+		piece.d[NOTCH_X] = piece.d[NOTCH_Y] = piece.d[NOTCH_ANGLE] = piece.d[NOTCH_HALFWIDTH] = 0;
+		area += piece;
+	}
+
+	// Everything beyond the fingers is open
+	GeometryDual hw(fingers.getHalfWidth(), FINGERS_HALFWIDTH);
+	if(bx + r > hw.v || bx - r < -hw.v) {
+		x.resize(4);
+		y.resize(4);
+		y[0] = y[1] = cy - 2*radius;
+		y[2] = y[3] = cy + 2*radius;
+		if(bx + r > hw.v) {
+			x[0] = x[3] = hw;
+			x[1] = x[2] = cx + 2*radius;
+			area += circlePolygonArea(x, y, cx, cy, radius);
+		}
+		if(bx - r < -hw.v) {
+			x[0] = x[3] = cx - 2*radius;
+			x[1] = x[2] = -hw;
+			area += circlePolygonArea(x, y, cx, cy, radius);
+		}
+	}
+
+	// Normalize by the beam area, which also depends on the radius
+	double norm = 4*std::atan(1)*r*r;
+	for (size_t i = 0; i < 4*n; ++i)
+	{
+		jacobian[i] /= norm;
+	}
+	jacobian[4*n] = area.d[BEAM_RADIUS]/norm - 2*area.v/(norm*r);
+	jacobian[4*n + 1] = area.d[FINGERS_HALFWIDTH]/norm;
+	jacobian[4*n + 2] = area.d[BEAM_X]/norm;
+	jacobian[4*n + 3] = area.d[BEAM_Y]/norm;
+	return area.v/norm;
+}
+
+#endif
@@ -0,0 +1,128 @@
+/*
+Pendulum kinematics for the fiducial marker
+
+Uses the same motion model as fit/model.py: the angle follows
+theta(t) = thetaMax*sin(omega*t) with thetaMax = 2*sin(amplitude/2), and the
+marker sits a distance length from the pivot so it moves along
+x = length*sin(theta), y = length*(1 - cos(theta)).
+Lengths are in meters, times in seconds and amplitudes in degrees (as in fit.py).
+*/
+
+#ifndef PENDULUM_H
+#define PENDULUM_H
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+class Pendulum
+{
+public:
+	Pendulum(double length, double period, double amplitude)
+	{
+		this->_length = length;
+		this->_period = period;
+		this->_amplitude = amplitude;
+	}
+
+	double getLength() const
+	{
+		return this->_length;
+	}
+
+	double getPeriod() const
+	{
+		return this->_period;
+	}
+
+	double getAmplitude() const
+	{
+		return this->_amplitude;
+	}
+
+	void setAmplitude(double amplitude)
+	{
+		this->_amplitude = amplitude;
+	}
+
+	void setPeriod(double period)
+	{
+		this->_period = period;
+	}
+
+	double getOmega() const
+	{
+		return 2*M_PI/this->_period;
+	}
+
+	// Speed of the marker at dead center in meters per second
+	double getVelocity(double amplitude) const
+	{
+		return this->_length*getOmega()*thetaMax(amplitude);
+	}
+
+	double getVelocity() const
+	{
+		return getVelocity(this->_amplitude);
+	}
+
+	// Inverse of getVelocity(), as used by fit/frameProcessor.py
+	double amplitudeForVelocity(double velocity) const
+	{
+		double cosTheta = 1 - 0.5*std::pow(velocity*this->_period/(2*M_PI*this->_length),2);
+		return std::acos(cosTheta)*180/M_PI;
+	}
+
+	// Time in seconds for the marker to cross half the fiducial width at dead
+	// center speed: the duration fitted by fit/template.py (in seconds, not ticks)
+	double getDuration(double amplitude, double width) const
+	{
+		return 0.5*width/getVelocity(amplitude);
+	}
+
+	// Transverse position of the marker t seconds after dead center
+	double getX(double t) const
+	{
+		return this->_length*std::sin(thetaMax(this->_amplitude)*std::sin(getOmega()*t));
+	}
+
+	// Height of the marker above its dead center position at transverse position x
+	double getY(double x) const
+	{
+		return this->_length - std::sqrt(this->_length*this->_length - x*x);
+	}
+
+	// Fills x[j*nt + i] with the position at time t[i] for amplitude amplitudes[j].
+	// The time dependence is shared by every amplitude so each extra amplitude
+	// costs one multiply and sine per sample.
+	void getX(const double *t, size_t nt, const double *amplitudes, size_t na, double *x) const
+	{
+		std::vector<double> phase(nt);
+		double omega = getOmega();
+		for (size_t i = 0; i < nt; ++i)
+		{
+			phase[i] = std::sin(omega*t[i]);
+		}
+		for (size_t j = 0; j < na; ++j)
+		{
+			double k = thetaMax(amplitudes[j]);
+			double *row = x + j*nt;
+			for (size_t i = 0; i < nt; ++i)
+			{
+				row[i] = this->_length*std::sin(k*phase[i]);
+			}
+		}
+	}
+
+private:
+	static double thetaMax(double amplitude)
+	{
+		return std::sqrt(2*(1 - std::cos(amplitude*M_PI/180)));
+	}
+
+	double _length;
+	double _period;
+	double _amplitude;
+};
+
+#endif
@@ -5,11 +5,18 @@
 #ifndef POLYGON_H
 #define POLYGON_H
 
+#include <vector>
+#include "Point.h"
+#include "Circle.h"
+
 class Polygon
 {
 public:
-	// Subclasses are required by law to implement this method
+	// Subclasses are required by law to implement these methods
     virtual bool inNotch(Point p) const = 0;
+    // Fills outlines with the convex pieces of the open region, clipped to
+    // extend just past the circle.  Pieces are assumed not to overlap.
+    virtual void getOutlines(const Circle &circle, std::vector<std::vector<Point> > &outlines) const = 0;
     virtual ~Polygon(){};
 };
 
@@ -0,0 +1,52 @@
+/*
+Random number generator with a period of about 2 x 10^19
+
+Same xorshift generator as the global one in area.cpp, wrapped in a class so
+that each thread or generator can own an independent, reproducible stream.
+*/
+
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cmath>
+#include <cstdint>
+
+class Random
+{
+public:
+	Random(uint64_t seed)
+	{
+		setSeed(seed);
+	}
+
+	void setSeed(uint64_t seed)
+	{
+		this->_v = 4101842887655102017LL ^ seed;
+		this->_v = next();
+	}
+
+	uint64_t next()
+	{
+		this->_v ^= this->_v >> 21; this->_v ^= this->_v << 35; this->_v ^= this->_v >> 4;
+		return this->_v*2685821657736338717LL;
+	}
+
+	// Uniform in [0,1)
+	double uniform()
+	{
+		return 5.42101086242752217e-20*next();
+	}
+
+	// Standard normal deviate (Box-Muller)
+	double gauss()
+	{
+		double u1 = 1.0 - uniform();
+		double u2 = uniform();
+		return std::sqrt(-2*std::log(u1))*std::cos(2*M_PI*u2);
+	}
+
+private:
+	uint64_t _v;
+};
+
+#endif
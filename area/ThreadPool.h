@@ -0,0 +1,101 @@
+/*
+Fixed pool of worker threads for data parallel loops
+
+run(n, task) calls task(i, worker) for every i in [0,n) spread over the
+workers and returns when all calls have finished.  The worker index lets
+tasks keep per thread accumulators without locking.
+*/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	ThreadPool(unsigned threads)
+	{
+		if(threads == 0) threads = 1;
+		this->_generation = 0;
+		this->_busy = 0;
+		this->_stop = false;
+		this->_count = 0;
+		for (unsigned k = 0; k < threads; ++k)
+		{
+			this->_workers.push_back(std::thread(&ThreadPool::work, this, k));
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->_mutex);
+			this->_stop = true;
+		}
+		this->_start.notify_all();
+		for (size_t k = 0; k < this->_workers.size(); ++k)
+		{
+			this->_workers[k].join();
+		}
+	}
+
+	unsigned size() const
+	{
+		return (unsigned)this->_workers.size();
+	}
+
+	void run(size_t n, std::function<void(size_t, unsigned)> task)
+	{
+		std::unique_lock<std::mutex> lock(this->_mutex);
+		this->_task = task;
+		this->_count = n;
+		this->_next = 0;
+		this->_busy = this->_workers.size();
+		++this->_generation;
+		this->_start.notify_all();
+		this->_done.wait(lock, [this]{ return this->_busy == 0; });
+	}
+
+private:
+	void work(unsigned worker)
+	{
+		unsigned long seen = 0;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(this->_mutex);
+				this->_start.wait(lock, [this, seen]{ return this->_stop || this->_generation != seen; });
+				if(this->_stop) return;
+				seen = this->_generation;
+			}
+			for (size_t i = this->_next++; i < this->_count; i = this->_next++)
+			{
+				this->_task(i, worker);
+			}
+			{
+				std::lock_guard<std::mutex> lock(this->_mutex);
+				if(--this->_busy == 0) this->_done.notify_one();
+			}
+		}
+	}
+
+	std::vector<std::thread> _workers;
+	std::function<void(size_t, unsigned)> _task;
+	std::atomic<size_t> _next;
+	size_t _count;
+	size_t _busy;
+	unsigned long _generation;
+	bool _stop;
+	std::mutex _mutex;
+	std::condition_variable _start;
+	std::condition_variable _done;
+};
+
+#endif
@@ -0,0 +1,79 @@
+/*
+Tabulated transmission of the beam through a polygon
+
+The marker moves along the arc traced by the pendulum, so its transmission is a
+function of the transverse position x alone.  The map is built once with the
+exact overlap engine and then resampled by linear interpolation, so families
+of curves (different amplitudes, offsets or directions) cost only lookups.
+*/
+
+#ifndef TRANSMISSIONMAP_H
+#define TRANSMISSIONMAP_H
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "Circle.h"
+#include "Point.h"
+#include "Polygon.h"
+#include "Pendulum.h"
+#include "Overlap.h"
+
+class TransmissionMap
+{
+public:
+	// Tabulates transmission at beam centers from -xmax to +xmax in steps of dx
+	TransmissionMap(const Polygon &polygon, Circle beam, const Pendulum &pendulum, double xmax, double dx)
+	{
+		this->_xmax = xmax;
+		this->_dx = dx;
+
+		size_t n = (size_t)(2*xmax/dx) + 2;
+		std::vector<std::vector<Point> > outlines;
+		this->_table.resize(n);
+		for (size_t i = 0; i < n; ++i)
+		{
+			double x = -xmax + i*dx;
+			beam.setX(x);
+			beam.setY(pendulum.getY(x));
+			this->_table[i] = getFractionalAreaExact(beam,polygon,outlines);
+		}
+	}
+
+	// Positions beyond the map take the transmission at its ends
+	double operator()(double x) const
+	{
+		double u = (x + this->_xmax)/this->_dx;
+		if(u <= 0) return this->_table.front();
+		if(u >= this->_table.size() - 1) return this->_table.back();
+		size_t j = (size_t)u;
+		double f = u - j;
+		return (1 - f)*this->_table[j] + f*this->_table[j + 1];
+	}
+
+	void evaluate(const double *x, size_t n, double *t) const
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			t[i] = (*this)(x[i]);
+		}
+	}
+
+	double getXMax() const
+	{
+		return this->_xmax;
+	}
+
+	double getDX() const
+	{
+		return this->_dx;
+	}
+
+private:
+	double _xmax;
+	double _dx;
+	std::vector<double> _table;
+};
+
+#endif
@@ -16,9 +16,11 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib> 
+#include <cstring>
 #include <ctime>
 #include <csignal>
 
+#include <thread>
 #include <vector>
 
 #include "Notch.h"
@@ -27,6 +29,14 @@
 #include "Point.h"
 #include "Polygon.h"
 #include "Fingers.h"
+#include "Overlap.h"
+#include "Pendulum.h"
+#include "TransmissionMap.h"
+#include "FrameGenerator.h"
+#include "Ensemble.h"
+#include "AdaptiveCurve.h"
+#include "GeometryFitter.h"
+#include "ThreadPool.h"
 
 #define BATCH_MODE 0
 #define ERROR_MODE 1
@@ -41,11 +51,25 @@ static const double piHalves = 2*std::atan(1);
 
 bool doubleRatio = true;
 bool monteCarlo = true;
+bool analytic = false;
+bool adaptive = false;
+
+// Curves sampled adaptively start every adaptiveCoarse uniform steps and refine
+// down to single steps where they depart from linear by more than adaptiveTolerance
+static const double adaptiveCoarse = 8;
+static const double adaptiveTolerance = 1e-3;
 
 uint16_t status = 0;
 uint16_t maxSteps = 0;
 
-double _velocity = 0.8;
+// Length (m), period (s) and amplitude (deg) of the swing carrying the fingers
+Pendulum pendulum(1.020, 2.0, 4.66);
+
+// Half width (m) of the fingers recorded in fit/NotchedFingers.template
+static const double notchedFingersHalfWidth = 0.027;
+
+// Dark fingers at half level, fit.py's --nfingers
+static const int templateFingers = 5;
 
 
 /* A random number generator with a period of about 2 x 10^19 */
@@ -71,7 +95,10 @@ void setSeed(unsigned long long int j) {
 double getFractionalArea(const Grid &grid, Circle &circle, const Polygon &notch);
 double getFractionalAreaGrid(const Grid &grid, Circle &circle, const Polygon &notch);
 double getFractionalAreaMonteCarlo(const Grid &grid, Circle &circle, const Polygon &notch);
+double getFractionalAreaAnalytic(const Circle &circle, const Polygon &notch);
+double getFractionalAreaSigma(const Grid &grid, double fractionalArea);
 double deg2rad(double degrees);
+std::vector<Notch> getNotchedFingers();
 
 uint8_t calculateError(const Grid &grid, const Notch &notch);
 
@@ -82,12 +109,18 @@ void printCurvesForRange(double ystart, double yrange, double ysteps, double xst
 void printDYDF(double y1, double y2, const Grid &grid, Circle &circle, const Polygon &notch);
 void printCurve(double xstart, double xrange, double xsteps, const Grid &grid, Circle &circle, const Polygon &notch);
 void printCurve(uint32_t totalSamples, const Grid &grid, Circle &circle, const Polygon &notch);
+void printCurves(uint32_t totalSamples, double secondsPerSample, const std::vector<double> &amplitudes,
+	const TransmissionMap &map);
+bool printTemplate(uint32_t nspline, double splinePad, Circle &circle, const Fingers &fingers);
+double swingTransmission(double t, Circle &circle, const Fingers &fingers,
+	std::vector<std::vector<Point> > &outlines);
+size_t readFrames(const char *filename, uint32_t samplesPerFrame, std::vector<std::vector<double> > &frames);
+void parseCurveOptions(const char *options);
 
 static void catch_function(int signo);
 
 double yForCircle(double x);
 double initialVelocity();
-double acceleration();
 
 
 
@@ -119,6 +152,7 @@ int main(int argc, char *argv[])
 		else if(*argv[1] == 'd') {
 
 			MODE = BATCH_MODE;
+			if(argc > 2) parseCurveOptions(argv[2]);
 
 			// Parameters of test
 			uint16_t yStepsPerRange = 41;
@@ -142,6 +176,7 @@ int main(int argc, char *argv[])
 		}
 		else if(*argv[1] == 'c') {
 			MODE = BATCH_MODE;
+			if(argc > 2) parseCurveOptions(argv[2]);
 
 			double a = deg2rad(90.0);
 
@@ -156,6 +191,7 @@ int main(int argc, char *argv[])
 		}
 		else if(*argv[1] == 'h') {
 			MODE = BATCH_MODE;
+			if(argc > 2) parseCurveOptions(argv[2]);
 
 			double a = deg2rad(90.0);
 
@@ -180,11 +216,136 @@ int main(int argc, char *argv[])
 				Notch(a,Point(0.012,0.01),0.006)
 			};
 			Fingers fingers(v);
-			for (int i = 0; i < 2; ++i)
+
+			// One exact map serves every amplitude
+			TransmissionMap map(fingers,circle,pendulum,0.030,1e-6);
+			std::vector<double> amplitudes { 4.66, 5.66 };
+			printCurves(2048,8.32e-5,amplitudes,map);
+		}
+		else if(*argv[1] == 'p') {
+			MODE = BATCH_MODE;
+
+			// The recorded fingers, whose uneven ends tell fit.py which way a frame went
+			Fingers fingers(getNotchedFingers());
+			fingers.setHalfWidth(notchedFingersHalfWidth);
+
+			// Writes a binaryPackets stream to stdout for replay and fit testing
+			uint32_t numFrames = (argc > 2)?std::strtoul(argv[2],NULL,10):1000;
+			const uint32_t rawLength = 2042;		// CIRCULAR_BUFFER_LENGTH for 2098 byte data packets
+
+			// Swing wide enough that every frame starts and ends beyond the fingers
+			pendulum.setAmplitude(8.0);
+			TransmissionMap map(fingers,circle,pendulum,0.035,1e-6);
+			FrameGenerator generator(map,pendulum,rawLength);
+			generator.writeZeroes(stdout,100);
+			generator.writeBootPacket(stdout);
+			for (uint32_t i = 0; i < numFrames; ++i)
+			{
+				generator.writeDataPacket(stdout);
+			}
+			std::fprintf(stderr, "Frames: %u Period: %.9f s Amplitude: %.6f deg\n",
+				numFrames, generator.getPeriod(), generator.getAmplitude());
+		}
+		else if(*argv[1] == 'm') {
+			MODE = BATCH_MODE;
+
+			double a = deg2rad(90.0);
+
+			std::vector<Notch> v { 
+				Notch(a,Point(-0.016,0.01)),
+				Notch(a,Point(-0.008,0.01)),
+				Notch(a,Point(0.00,0.00)),
+				Notch(a,Point(0.012,0.01),0.006)
+			};
+			Fingers fingers(v);
+
+			// Ensemble of geometries with manufacturing errors
+			uint64_t members = (argc > 2)?std::strtoull(argv[2],NULL,10):1000;
+			Tolerances tolerances = { 50e-6, deg2rad(0.5), 25e-6 };
+
+			Ensemble ensemble(fingers,circle,pendulum,2048,8.32e-5,tolerances);
+			CurveStats stats = ensemble.run(members,std::thread::hardware_concurrency(),24071966);
+
+			// Edge summary as comments, then the mean curve and its rms spread
+			std::vector<double> edges = ensemble.getNominalEdges();
+			std::printf("# members %llu matched %llu\n",(unsigned long long)stats.getN(),(unsigned long long)stats.getEdgeN());
+			for (size_t i = 0; i < stats.getNEdges(); ++i)
+			{
+				std::printf("# edge %u t %.9f shift %.3e rms %.3e\n",(unsigned)i,edges[i],
+					stats.getEdgeMean(i),std::sqrt(stats.getEdgeVariance(i)));
+			}
+			for (size_t i = 0; i < stats.getNSamples(); ++i)
 			{
-				printCurve(2048,grid,circle,fingers);
-				// printCurve(-0.025,0.050,200,grid,circle,fingers);
-				_velocity+=0.2;
+				std::printf("%u %.16f %.16f\n",(unsigned)i,stats.getMean(i),std::sqrt(stats.getVariance(i)));
+			}
+		}
+		else if(*argv[1] == 'f') {
+			MODE = BATCH_MODE;
+
+			std::vector<Notch> v = getNotchedFingers();
+
+			// Fits the geometry to frames stored as by fit.py (samplesSinceBoot then the samples)
+			if(argc < 3) {
+				std::fprintf(stderr, "usage: %s f frames [samples per frame] [starting geometry]\n", argv[0]);
+				return 1;
+			}
+			uint32_t samplesPerFrame = (argc > 3)?std::strtoul(argv[3],NULL,10):3072;
+			double halfwidth = notchedFingersHalfWidth;
+			double radius = circle.getR();
+			if(argc > 4 && !readGeometry(argv[4],v,halfwidth,radius)) {
+				std::fprintf(stderr, "Cannot read geometry from %s\n", argv[4]);
+				return 1;
+			}
+			Fingers fingers(v);
+			fingers.setHalfWidth(halfwidth);
+
+			std::vector<std::vector<double> > frames;
+			if(readFrames(argv[2],samplesPerFrame,frames) == 0) {
+				std::fprintf(stderr, "No frames of %u samples in %s\n", samplesPerFrame, argv[2]);
+				return 1;
+			}
+			GeometryFitter fitter(fingers,radius,pendulum,8.32e-5);
+			for (size_t i = 0; i < frames.size(); ++i)
+			{
+				fitter.addFrame(frames[i]);
+			}
+			// Without a starting geometry, the notches are measured from the frames
+			if(argc <= 4 && !fitter.guessGeometry()) {
+				std::fprintf(stderr, "No frame crosses %u notches\n", (unsigned)v.size());
+			}
+			ThreadPool pool(std::thread::hardware_concurrency());
+			fitter.fit(pool,50,true);
+			fitter.writeGeometry(stdout);
+			if(fitter.isRejected()) {
+				std::fprintf(stderr, "Fit rejected: reduced chi square %.2f with noise %.2f\n",
+					fitter.getReducedChiSquare(), fitter.getNoise());
+				return 1;
+			}
+		}
+		else if(*argv[1] == 't') {
+			MODE = BATCH_MODE;
+
+			std::vector<Notch> v = getNotchedFingers();
+
+			// Spline template for fit.py --load-template, with the same defaults as its
+			// --nspline and --spline-pad, from the nominal or a fitted geometry, swinging
+			// at the fitted frames' speed if it is given
+			uint32_t nspline = (argc > 2)?std::strtoul(argv[2],NULL,10):1024;
+			double splinePad = (argc > 3)?std::strtod(argv[3],NULL):0.03;
+			double halfwidth = notchedFingersHalfWidth;
+			double radius = circle.getR();
+			double speed = pendulum.getVelocity();
+			if(argc > 4 && !readGeometry(argv[4],v,halfwidth,radius,&speed)) {
+				std::fprintf(stderr, "Cannot read geometry from %s\n", argv[4]);
+				return 1;
+			}
+			pendulum.setAmplitude(pendulum.amplitudeForVelocity(speed));
+			Fingers fingers(v);
+			fingers.setHalfWidth(halfwidth);
+			Circle beam(radius,Point(0,0));
+			if(!printTemplate(nspline,splinePad,beam,fingers)) {
+				std::fprintf(stderr, "The beam does not cross %d fingers\n", templateFingers);
+				return 1;
 			}
 		}
 		else if(*argv[1] == 's') {
@@ -323,6 +484,26 @@ void printCurve(double xstart, double xrange, double xsteps, const Grid &grid, C
 {
 	double ix;
 
+	if(adaptive) {
+		// Irregular steps, printed at their fractional step number
+		AdaptiveCurve::Function f = [&](double u, double &sigma) {
+			double xc = xstart + initialVelocity()*xrange*(u/xsteps);
+			circle.setX(xc);
+			circle.setY(yForCircle(xc));
+			double fractionalArea = getFractionalArea(grid,circle,notch);
+			sigma = getFractionalAreaSigma(grid,fractionalArea);
+			return fractionalArea;
+		};
+		AdaptiveCurve curve(f,0,xsteps,std::ceil(xsteps/adaptiveCoarse),adaptiveTolerance,1);
+		if(MODE == BATCH_MODE) {
+			for (size_t i = 0; i < curve.size(); ++i)
+			{
+				std::printf("%.16f %.16f\n",curve.getX(i),curve.getF(i));
+			}
+		}
+		return;
+	}
+
 	for (ix = 0; ix <= xsteps; ++ix)
 	{
 		double xc = xstart + initialVelocity()*xrange*(ix/xsteps);
@@ -353,11 +534,32 @@ void printCurve(uint32_t totalSamples, const Grid &grid, Circle &circle, const P
 	double secondsPerSample = 6.400e-6;			// (10MHz/64)^-1
 	if(totalSamples%2)++totalSamples;		// Make sure samples is even
 
+	if(adaptive) {
+		// Every sample, interpolated between the adaptively chosen ones
+		AdaptiveCurve::Function f = [&](double u, double &sigma) {
+			double xc = pendulum.getX((u - 0.5*totalSamples)*secondsPerSample);
+			circle.setX(xc);
+			circle.setY(yForCircle(xc));
+			double fractionalArea = getFractionalArea(grid,circle,notch);
+			sigma = getFractionalAreaSigma(grid,fractionalArea);
+			return fractionalArea;
+		};
+		AdaptiveCurve curve(f,0,totalSamples,std::ceil(totalSamples/adaptiveCoarse),adaptiveTolerance,1);
+		if(MODE == BATCH_MODE) {
+			for (ix = 0; ix <= totalSamples; ++ix)
+			{
+				std::printf("%i %.16f\n",ix,curve(ix));
+			}
+		}
+		std::fprintf(stderr, "Evaluations: %u of %u\n",(uint32_t)curve.size(),totalSamples + 1);
+		return;
+	}
+
 	for (ix = 0; ix <= totalSamples; ++ix)
 	{
 		sample = (totalSamples*-0.5+ix);
 		double t = (sample*secondsPerSample);
-		double xc = initialVelocity()*t + 0.5*acceleration()*t*t; 
+		double xc = pendulum.getX(t);
 		circle.setX(xc);
 		circle.setY(yForCircle(xc));
 
@@ -377,22 +579,124 @@ void printCurve(uint32_t totalSamples, const Grid &grid, Circle &circle, const P
 	}
 }
 
-double r = 1.0;
-double yForCircle(double x)
+// Prints each amplitude's curve as a block of totalSamples lines centered on dead center
+void printCurves(uint32_t totalSamples, double secondsPerSample, const std::vector<double> &amplitudes,
+	const TransmissionMap &map)
 {
-	return r-std::sqrt(r*r - x*x);
-	return 0;
+	std::vector<double> t(totalSamples);
+	for (uint32_t ix = 0; ix < totalSamples; ++ix)
+	{
+		t[ix] = (ix - 0.5*totalSamples)*secondsPerSample;
+	}
+
+	std::vector<double> x(totalSamples*amplitudes.size());
+	std::vector<double> transmission(x.size());
+	pendulum.getX(&t[0],totalSamples,&amplitudes[0],amplitudes.size(),&x[0]);
+	map.evaluate(&x[0],x.size(),&transmission[0]);
+
+	for (size_t i = 0; i < transmission.size(); ++i)
+	{
+		std::printf("%u %.16f\n",(uint32_t)(i%totalSamples),transmission[i]);
+	}
 }
 
-// In meters per second
-double initialVelocity()
+// Prints the transmission against s as fit/frameProcessor.py buildSplineTemplate()
+// stacks it: numpy.savetxt() of (s, value) rows on an nspline point grid spanning
+// |s| <= 1 + splinePad, with s the time from fit/frame.py's quick fit t0, between
+// the third falling and rising edges, in units of half the time between the
+// outer edges, all at half level.  s increases with x.  Returns false if the
+// swing does not cross templateFingers fingers.
+bool printTemplate(uint32_t nspline, double splinePad, Circle &circle, const Fingers &fingers)
+{
+	std::vector<std::vector<Point> > outlines;
+
+	// Half level crossings along the swing, a step at a time and then by bisection
+	double tmax = pendulum.getPeriod()/4;
+	double step = 1e-5;
+	std::vector<double> rise, fall;
+	double previous = 0;
+	for (double t = -tmax; t <= tmax; t += step)
+	{
+		double level = swingTransmission(t,circle,fingers,outlines) - 0.5;
+		if(t > -tmax && (level > 0) != (previous > 0)) {
+			double lo = t - step, hi = t;
+			for (int i = 0; i < 40; ++i)
+			{
+				double mid = 0.5*(lo + hi);
+				if((swingTransmission(mid,circle,fingers,outlines) > 0.5) == (level > 0)) hi = mid;
+				else lo = mid;
+			}
+			if(level > 0) rise.push_back(0.5*(lo + hi));
+			else fall.push_back(0.5*(lo + hi));
+		}
+		previous = level;
+	}
+	if(rise.size() != (size_t)templateFingers || fall.size() != (size_t)templateFingers) return false;
+	double t0 = 0.5*(fall[2] + rise[2]);
+	double stretch = 0.5*(rise.back() - fall.front());
+
+	double smax = 1 + splinePad;
+	for (uint32_t i = 0; i < nspline; ++i)
+	{
+		double s = (nspline > 1)?(-smax + 2*smax*i/(nspline - 1)):0;
+		std::printf("%.18e %.18e\n",s,swingTransmission(t0 + s*stretch,circle,fingers,outlines));
+	}
+	return true;
+}
+
+// Transmission t seconds after dead center
+double swingTransmission(double t, Circle &circle, const Fingers &fingers,
+	std::vector<std::vector<Point> > &outlines)
 {
-	return _velocity;			// Measured: 3.639 m/s
+	double xc = pendulum.getX(t);
+	circle.setX(xc);
+	circle.setY(yForCircle(xc));
+	return getFractionalAreaExact(circle,fingers,outlines);
 }
 
-double acceleration()
+// Reads whitespace separated frames of a samplesSinceBoot value followed by
+// samplesPerFrame samples, dropping an incomplete last frame
+size_t readFrames(const char *filename, uint32_t samplesPerFrame, std::vector<std::vector<double> > &frames)
 {
-	return 0.0;
+	FILE *in = std::fopen(filename, "r");
+	if(!in) return 0;
+	std::vector<double> frame;
+	double value;
+	bool header = true;
+	while(std::fscanf(in, "%lf", &value) == 1)
+	{
+		if(header) {
+			header = false;
+			continue;
+		}
+		frame.push_back(value);
+		if(frame.size() == samplesPerFrame) {
+			frames.push_back(frame);
+			frame.clear();
+			header = true;
+		}
+	}
+	std::fclose(in);
+	return frames.size();
+}
+
+// Options of the modes that sample curves: a leading a uses the exact overlap
+// instead of sampling, and an r anywhere refines curves only where they bend
+void parseCurveOptions(const char *options)
+{
+	if(*options == 'a') analytic = true;
+	if(std::strchr(options,'r')) adaptive = true;
+}
+
+double yForCircle(double x)
+{
+	return pendulum.getY(x);
+}
+
+// In meters per second
+double initialVelocity()
+{
+	return pendulum.getVelocity();
 }
 
 // Assume for accuracy that theta is 10 degrees
@@ -427,6 +731,7 @@ uint8_t calculateError(const Grid &grid, const Notch &notch)
 
 double getFractionalArea(const Grid &grid, Circle &circle, const Polygon &notch)
 {
+	if(analytic) return getFractionalAreaAnalytic(circle,notch);
 	return((monteCarlo)?(getFractionalAreaMonteCarlo(grid,circle,notch)):(getFractionalAreaGrid(grid,circle,notch)));
 }
 
@@ -510,11 +815,45 @@ double getFractionalAreaMonteCarlo(const Grid &grid, Circle &circle, const Polyg
 	}
 }
 
+// Statistical uncertainty of getFractionalArea(), zero for the deterministic methods
+double getFractionalAreaSigma(const Grid &grid, double fractionalArea)
+{
+	if(analytic || !monteCarlo) return 0;
+	double n = grid.getN();
+	double p = std::min(std::max(fractionalArea,0.0),1.0);
+	// About pi/4 of the n*n points land in the circle
+	return std::sqrt(p*(1 - p)/(0.25*pi*n*n));
+}
+
+double getFractionalAreaAnalytic(const Circle &circle, const Polygon &notch)
+{
+	static std::vector<std::vector<Point> > outlines;
+	return getFractionalAreaExact(circle,notch,outlines);
+}
+
 double deg2rad(double degrees)
 {
 	return (degrees/180.0)*pi;
 }
 
+// Notches of the fingers recorded in fit/NotchedFingers.template, from the
+// half level edges of the template scaled by notchedFingersHalfWidth.  The
+// first finger is twice as wide as the last and the last gap twice as wide
+// as the others.  The middle finger has a shallow window that passes the
+// third of a 1 mm beam seen on the template's plateau.
+std::vector<Notch> getNotchedFingers()
+{
+	double a = deg2rad(90.0);
+
+	return std::vector<Notch> {
+		Notch(a,Point(0.0168,0.01),0.002),
+		Notch(a,Point(0.0088,0.01),0.002),
+		Notch(a,Point(0.0,-0.00029),0.00265),
+		Notch(a,Point(-0.0088,0.01),0.002),
+		Notch(a,Point(-0.0188,0.01),0.004)
+	};
+}
+
 static void catch_function(int signo) {
     std::fprintf(stderr, "%i/%i\n", status, maxSteps);
 }
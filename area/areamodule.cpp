@@ -0,0 +1,197 @@
+// Python extension exposing the exact overlap calculation to the fit pipeline,
+// which calls it from fit/model.py for the transmission of the fingers
+//
+//	import area
+//	t = area.transmission(x, y, notches, radius)
+//	t, J = area.transmissionJacobian(x, y, notches, radius)
+//
+// Inputs are anything numpy can convert to arrays of doubles.  The loops over
+// beam positions run with the GIL released.
+
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+
+#include <Python.h>
+#include <numpy/arrayobject.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "Notch.h"
+#include "Circle.h"
+#include "Point.h"
+#include "Fingers.h"
+#include "Overlap.h"
+#include "OverlapJacobian.h"
+
+// Returns a new contiguous double array for obj, or NULL with an exception set
+static PyArrayObject *asDoubleArray(PyObject *obj)
+{
+	return (PyArrayObject *)PyArray_FROM_OTF(obj, NPY_DOUBLE, NPY_ARRAY_IN_ARRAY);
+}
+
+// Notches are rows of (angle, x, y) or (angle, x, y, halfwidth)
+static bool parseNotches(PyObject *obj, std::vector<Notch> &notches)
+{
+	PyArrayObject *notchArray = asDoubleArray(obj);
+	if(!notchArray) return false;
+	if(PyArray_NDIM(notchArray) != 2 || PyArray_DIM(notchArray,1) < 3 || PyArray_DIM(notchArray,1) > 4) {
+		Py_DECREF(notchArray);
+		PyErr_SetString(PyExc_ValueError, "notches must be rows of (angle, x, y[, halfwidth])");
+		return false;
+	}
+	const double *row = (const double *)PyArray_DATA(notchArray);
+	npy_intp ncol = PyArray_DIM(notchArray,1);
+	for (npy_intp i = 0; i < PyArray_DIM(notchArray,0); ++i, row += ncol)
+	{
+		if(ncol == 4) notches.push_back(Notch(row[0],Point(row[1],row[2]),row[3]));
+		else notches.push_back(Notch(row[0],Point(row[1],row[2])));
+	}
+	Py_DECREF(notchArray);
+	return true;
+}
+
+// Beam centers: y is either a scalar or has one entry per x
+static bool parsePositions(PyObject *xObj, PyObject *yObj, PyArrayObject **xArray, PyArrayObject **yArray)
+{
+	*xArray = asDoubleArray(xObj);
+	if(!*xArray) return false;
+	*yArray = asDoubleArray(yObj);
+	if(!*yArray) {
+		Py_DECREF(*xArray);
+		return false;
+	}
+	npy_intp n = PyArray_SIZE(*xArray);
+	npy_intp ny = PyArray_SIZE(*yArray);
+	if(ny != n && ny != 1) {
+		Py_DECREF(*xArray);
+		Py_DECREF(*yArray);
+		PyErr_SetString(PyExc_ValueError, "y must be a scalar or have the same size as x");
+		return false;
+	}
+	return true;
+}
+
+static PyObject *area_transmission(PyObject *self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = { "x", "y", "notches", "radius", "halfwidth", NULL };
+	PyObject *xObj, *yObj, *notchesObj;
+	double radius;
+	double halfwidth = 0.022;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "OOOd|d", (char **)kwlist,
+		&xObj, &yObj, &notchesObj, &radius, &halfwidth)) return NULL;
+
+	std::vector<Notch> notches;
+	if(!parseNotches(notchesObj, notches)) return NULL;
+	Fingers fingers(notches);
+	fingers.setHalfWidth(halfwidth);
+
+	PyArrayObject *xArray, *yArray;
+	if(!parsePositions(xObj, yObj, &xArray, &yArray)) return NULL;
+	npy_intp n = PyArray_SIZE(xArray);
+	npy_intp ny = PyArray_SIZE(yArray);
+
+	PyArrayObject *result = (PyArrayObject *)PyArray_SimpleNew(PyArray_NDIM(xArray), PyArray_DIMS(xArray), NPY_DOUBLE);
+	if(result) {
+		const double *x = (const double *)PyArray_DATA(xArray);
+		const double *y = (const double *)PyArray_DATA(yArray);
+		double *t = (double *)PyArray_DATA(result);
+
+		Py_BEGIN_ALLOW_THREADS
+		std::vector<std::vector<Point> > outlines;
+		Circle circle(radius);
+		for (npy_intp i = 0; i < n; ++i)
+		{
+			circle.setX(x[i]);
+			circle.setY(y[(ny == 1)?0:i]);
+			t[i] = getFractionalAreaExact(circle,fingers,outlines);
+		}
+		Py_END_ALLOW_THREADS
+	}
+	Py_DECREF(xArray);
+	Py_DECREF(yArray);
+	return (PyObject *)result;
+}
+
+static PyObject *area_transmissionJacobian(PyObject *self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = { "x", "y", "notches", "radius", "halfwidth", NULL };
+	PyObject *xObj, *yObj, *notchesObj;
+	double radius;
+	double halfwidth = 0.022;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "OOOd|d", (char **)kwlist,
+		&xObj, &yObj, &notchesObj, &radius, &halfwidth)) return NULL;
+
+	std::vector<Notch> notches;
+	if(!parseNotches(notchesObj, notches)) return NULL;
+	Fingers fingers(notches);
+	fingers.setHalfWidth(halfwidth);
+
+	PyArrayObject *xArray, *yArray;
+	if(!parsePositions(xObj, yObj, &xArray, &yArray)) return NULL;
+	npy_intp n = PyArray_SIZE(xArray);
+	npy_intp ny = PyArray_SIZE(yArray);
+	npy_intp npar = 4*notches.size() + 4;
+
+	npy_intp dims[2] = { n, npar };
+	PyArrayObject *result = (PyArrayObject *)PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+	PyArrayObject *jacobian = (PyArrayObject *)PyArray_SimpleNew(2, dims, NPY_DOUBLE);
+	PyObject *tuple = NULL;
+	if(result && jacobian) {
+		const double *x = (const double *)PyArray_DATA(xArray);
+		const double *y = (const double *)PyArray_DATA(yArray);
+		double *t = (double *)PyArray_DATA(result);
+		double *J = (double *)PyArray_DATA(jacobian);
+
+		Py_BEGIN_ALLOW_THREADS
+		std::vector<double> row;
+		Circle circle(radius);
+		for (npy_intp i = 0; i < n; ++i)
+		{
+			circle.setX(x[i]);
+			circle.setY(y[(ny == 1)?0:i]);
+			t[i] = getFractionalAreaJacobian(circle,fingers,row);
+			std::copy(row.begin(), row.end(), J + i*npar);
+		}
+		Py_END_ALLOW_THREADS
+		tuple = Py_BuildValue("(OO)", result, jacobian);
+	}
+	Py_XDECREF(result);
+	Py_XDECREF(jacobian);
+	Py_DECREF(xArray);
+	Py_DECREF(yArray);
+	return tuple;
+}
+
+static PyMethodDef areaMethods[] = {
+	{ "transmission", (PyCFunction)area_transmission, METH_VARARGS | METH_KEYWORDS,
+		"transmission(x, y, notches, radius, halfwidth=0.022)\n\n"
+		"Fraction of a beam of the given radius centered at each (x,y) that passes through\n"
+		"fingers made of notches given as rows of (angle, x, y[, halfwidth])." },
+	{ "transmissionJacobian", (PyCFunction)area_transmissionJacobian, METH_VARARGS | METH_KEYWORDS,
+		"transmissionJacobian(x, y, notches, radius, halfwidth=0.022) -> (t, J)\n\n"
+		"Transmission as above for a flat array of beam positions, plus its derivatives J[i,4*k+(0..3)]\n"
+		"with respect to notch k's x, y, angle and half width, J[i,-4] and J[i,-3] with respect to the\n"
+		"beam radius and the half width of the fingers, and J[i,-2], J[i,-1] with respect to the beam x and y." },
+	{ NULL, NULL, 0, NULL }
+};
+
+#if PY_MAJOR_VERSION >= 3
+static struct PyModuleDef areaModule = {
+	PyModuleDef_HEAD_INIT, "area", "Exact beam transmission through the fiducial fingers.", -1, areaMethods
+};
+
+PyMODINIT_FUNC PyInit_area(void)
+{
+	import_array();
+	return PyModule_Create(&areaModule);
+}
+#else
+PyMODINIT_FUNC initarea(void)
+{
+	import_array();
+	Py_InitModule3("area", areaMethods, "Exact beam transmission through the fiducial fingers.");
+}
+#endif
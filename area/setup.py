@@ -0,0 +1,15 @@
+# Builds the area Python extension used by the fit package and installs it
+# where fit/model.py can import it
+#
+# python setup.py install --user
+
+try:
+    from setuptools import setup, Extension
+except ImportError:
+    from distutils.core import setup, Extension
+import numpy
+
+setup(name = 'area',
+    ext_modules = [Extension('area', ['areamodule.cpp'],
+        include_dirs = [numpy.get_include()],
+        extra_compile_args = ['-std=c++11'])])
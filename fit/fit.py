@@ -52,6 +52,8 @@ def main():
         help = 'display height mark on analysis plots')
     parser.add_argument('--physical', action = 'store_true',
         help = 'fit frames to a physical model')
+    parser.add_argument('--geometry', type = str, default = None,
+        help = 'fingers geometry fitted by area.out f to use in the physical model instead of the tabs')
     parser.add_argument('--spline', action = 'store_true',
         help = 'fit frames to a spline model')
     parser.add_argument('--save-template', type = str, default = None,
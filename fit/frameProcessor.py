@@ -11,6 +11,11 @@ import frame
 class FrameProcessor(object):
     def __init__(self,tabs,args,db):
         self.tabs = tabs
+        # the fingers of the physical model, fitted by area.out f or else made of the tabs
+        if args.geometry:
+            self.fingers = model.Geometry.load(args.geometry)
+        else:
+            self.fingers = model.Geometry.fromTabs(tabs)
         self.args = args
         self.db = db
         self.lastDirection = None
@@ -108,7 +113,7 @@ class FrameProcessor(object):
         # always start with a quick fit
         direction,lo,hi,offset,rise,fall,height = frame.quickFit(self.args)
         if self.args.physical:
-            fitParams,bestFit = model.Model().fitPhysicalModel(frame,self.tabs,self.args,direction,lo,hi,offset)
+            fitParams,bestFit = model.Model().fitPhysicalModel(frame,self.fingers,self.args,direction,lo,hi,offset)
             offset,amplitude = fitParams[0],fitParams[5]
         elif self.template is not None:
             fitParams,bestFit = self.template.fitTemplateModel(frame,self.args,
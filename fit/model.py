@@ -1,6 +1,65 @@
 from iminuit import Minuit
 import numpy
 
+# the exact overlap calculation, when the extension has been installed from ../area
+try:
+    import area
+except ImportError:
+    area = None
+
+class Geometry(object):
+    """
+    Fingers of the fiducial marker as the area module describes them: a dark body of the given
+    halfwidth with notches given as rows of (angle, x, y, halfwidth), all in meters and radians.
+    A notch at x is centered at -x, and opens fully for y above 0.01.
+    """
+    def __init__(self,notches,halfwidth):
+        self.notches = numpy.asarray(notches,dtype=float)
+        self.halfwidth = halfwidth
+
+    @staticmethod
+    def fromTabs(tabs):
+        """
+        Returns the fingers whose dark tabs have edges at rows of (x1,x2) in mm, with vertical walls.
+        """
+        tabs = sorted(tabs,key=lambda tab: tab[0])
+        halfwidth = max(-tabs[0][0],tabs[-1][1])
+        edges = [-halfwidth] + [x for tab in tabs for x in tab] + [halfwidth]
+        notches = [ ]
+        for (x1,x2) in zip(edges[::2],edges[1::2]):
+            if x2 > x1:
+                notches.append([numpy.pi/2,-0.5e-3*(x1+x2),0.01,0.5e-3*(x2-x1)])
+        return Geometry(notches,1e-3*halfwidth)
+
+    @staticmethod
+    def load(filename):
+        """
+        Reads the fingers from a geometry file written by area.out f (see area/GeometryFitter.h).
+        """
+        notches = [ ]
+        halfwidth = 0.022
+        with open(filename) as f:
+            for line in f:
+                fields = line.split()
+                if len(fields) == 5 and fields[0] == 'notch':
+                    notches.append([float(value) for value in fields[1:]])
+                elif len(fields) == 2 and fields[0] == 'fingers':
+                    halfwidth = float(fields[1])
+        if not notches:
+            raise RuntimeError('No notches in %s' % filename)
+        return Geometry(notches,halfwidth)
+
+    def getTabs(self):
+        """
+        Returns the dark tabs between the notches as rows of (x1,x2) in mm, ignoring the depth and
+        angle of the notches.
+        """
+        edges = [-self.halfwidth]
+        for (angle,x,y,halfwidth) in sorted(self.notches,key=lambda notch: -notch[1]):
+            edges += [-x-halfwidth,-x+halfwidth]
+        edges.append(self.halfwidth)
+        return 1e3*numpy.array([(x1,x2) for (x1,x2) in zip(edges[::2],edges[1::2]) if x2 > x1])
+
 class Model(object):
 
     def edgeTransmission(self,x,D):
@@ -25,8 +84,20 @@ class Model(object):
         """
         result = numpy.ones_like(x)
         for (x1,x2) in tabs:
-            result += edgeTransmission(x-x1,D) - edgeTransmission(x-x2,D)
+            result += self.edgeTransmission(x-x1,D) - self.edgeTransmission(x-x2,D)
         return result
+
+    def fingersTransmission(self,x,y,fingers,D):
+        """
+        Returns the transmission fraction (0-1) of the fingers when the center of the beam with
+        diameter D is at (x,y), with y the height the beam has risen by. The inputs x and y can be
+        numpy arrays and are in mm, as is D. Uses the exact overlap calculation of the area module
+        when it is installed, and otherwise the tabs between the notches.
+        """
+        if area is None:
+            return self.tabsTransmission(x,fingers.getTabs(),D)
+        return area.transmission(1e-3*numpy.asarray(x,dtype=float),1e-3*numpy.asarray(y,dtype=float),
+            fingers.notches,0.5e-3*D,fingers.halfwidth)
     
     def motion(self,dt,L,dtheta,T):
         """
@@ -44,20 +115,23 @@ class Model(object):
         # reduced.  Second, the angular speed decreases as the pendulum moves away from dead center.
         return L*numpy.sin(thdot/omega*numpy.sin(omega*dt))
     
-    def physicalModel(self,t0,direction,lo,hi,tabs,D=2.,L=1108.,dtheta=4.66,T=2.0,nsamples=1024,adcTick=1664e-7):
+    def physicalModel(self,t0,direction,lo,hi,fingers,D=2.,L=1108.,dtheta=4.66,T=2.0,nsamples=1024,adcTick=1664e-7):
         """
         t0 = offset of dead center relative to first sample (ADC samples)
+        fingers = Geometry of the fiducial marker
         """
         # initialize an array of times (secs) relative to the assumed dead center
         dt = direction*adcTick*(numpy.arange(nsamples) - t0)
-        # convert to transverse positions (mm) relative to the tabs
-        dx = motion(dt,L,dtheta,T)
-        # calculate expected tranmission fraction (0-1) at each transverse position
-        trans = tabsTransmission(dx,tabs,D)
+        # convert to transverse positions (mm) relative to the fingers, and the height the marker
+        # has risen by there
+        dx = self.motion(dt,L,dtheta,T)
+        dy = L - numpy.sqrt(L*L - dx*dx)
+        # calculate expected tranmission fraction (0-1) at each position
+        trans = self.fingersTransmission(dx,dy,fingers,D)
         # scale to ADC units
         return lo + (hi-lo)*trans
     
-    def fitPhysicalModel(self,frame,tabs,args,direction,lo,hi,offset):
+    def fitPhysicalModel(self,frame,fingers,args,direction,lo,hi,offset):
     
         # initial parameter guesses
         loGuess = lo
@@ -74,7 +148,7 @@ class Model(object):
         # define chi-square function to use
         def chiSquare(t0,lo,hi,D,L,dtheta):
             global prediction
-            prediction = physicalModel(t0,direction,lo,hi,tabs,D,L,dtheta,
+            prediction = self.physicalModel(t0,direction,lo,hi,fingers,D,L,dtheta,
                 nsamples=args.nsamples,adcTick=args.adc_tick)
             residuals = frame.samples - prediction
             return numpy.dot(residuals,residuals)
@@ -0,0 +1,88 @@
+#!/usr/bin/env python
+
+import unittest
+import os
+import tempfile
+import numpy
+import model
+
+class test_Model(unittest.TestCase):
+
+	def setUp(self):
+		self.model = model.Model()
+		self.fingers = model.Geometry.fromTabs(tabs())
+
+	def test_fromTabs(self):
+		self.assertAlmostEqual(self.fingers.halfwidth,0.027,
+			msg="From tabs halfwidth test failed")
+		self.assertTrue(numpy.allclose(self.fingers.notches,expectedNotches(),rtol=0,atol=1e-15),
+			msg="From tabs notches test failed")
+		self.assertTrue(numpy.allclose(self.fingers.getTabs(),tabs(),rtol=0,atol=1e-12),
+			msg="From tabs round trip test failed")
+
+	def test_load(self):
+		(fd,filename) = tempfile.mkstemp(suffix='.geometry')
+		try:
+			with os.fdopen(fd,'w') as f:
+				f.write(geometryFile(self.fingers))
+			loaded = model.Geometry.load(filename)
+		finally:
+			os.remove(filename)
+		self.assertTrue(numpy.array_equal(loaded.notches,self.fingers.notches),
+			msg="Load notches test failed")
+		self.assertEqual(loaded.halfwidth,self.fingers.halfwidth,
+			msg="Load halfwidth test failed")
+		self.assertTrue(numpy.allclose(loaded.getTabs(),tabs(),rtol=0,atol=1e-12),
+			msg="Load tabs test failed")
+
+	def test_loadWithoutNotches(self):
+		(fd,filename) = tempfile.mkstemp(suffix='.geometry')
+		try:
+			with os.fdopen(fd,'w') as f:
+				f.write('# rejected\nfingers 0.027\n')
+			self.assertRaises(RuntimeError,model.Geometry.load,filename)
+		finally:
+			os.remove(filename)
+
+	@unittest.skipIf(model.area is None,"area module is not installed")
+	def test_fingersTransmission(self):
+		# With vertical walls the exact overlap does not depend on the height the beam has
+		# risen by, and matches the tabs on either side of every edge
+		x = numpy.linspace(-32.,32.,1001)
+		expected = self.model.tabsTransmission(x,tabs(),2.)
+		for y in (0.,0.5,3.):
+			trans = self.model.fingersTransmission(x,numpy.full_like(x,y),self.fingers,2.)
+			self.assertTrue(numpy.allclose(trans,expected,rtol=0,atol=1e-12),
+				msg="Fingers transmission test failed at y = %g" % y)
+
+	def test_fingersTransmissionWithoutArea(self):
+		x = numpy.linspace(-32.,32.,1001)
+		saved = model.area
+		model.area = None
+		try:
+			trans = self.model.fingersTransmission(x,numpy.zeros_like(x),self.fingers,2.)
+		finally:
+			model.area = saved
+		self.assertTrue(numpy.allclose(trans,self.model.tabsTransmission(x,tabs(),2.),rtol=0,atol=1e-12),
+			msg="Fingers transmission fallback test failed")
+
+def tabs():
+	a = numpy.array([[-27.,-19.],[-15.,-11.],[-7.,-3.],[3.,7.],[11.,15.],[23.,27.]])
+	return a
+
+def expectedNotches():
+	a = numpy.array([[numpy.pi/2,0.017,0.01,0.002],[numpy.pi/2,0.009,0.01,0.002],
+		[numpy.pi/2,0.,0.01,0.003],[numpy.pi/2,-0.009,0.01,0.002],[numpy.pi/2,-0.019,0.01,0.004]])
+	return a
+
+def geometryFile(fingers):
+	"""
+	Returns the fingers as area.out f writes them, comments included.
+	"""
+	lines = ['# frames 2 samples 6144 chi2/dof 1.000000 noise 1.0000 reduced chi2 1.0000',
+		'# notch angle(rad) x(m) y(m) halfwidth(m)']
+	for notch in fingers.notches:
+		lines.append('notch %.17g %.17g %.17g %.17g' % tuple(notch))
+		lines.append('# +/- 0.000001000 0.000001000 0.000001000 0.000001000')
+	lines += ['fingers %.17g' % fingers.halfwidth,'# +/- 0.000001000','radius 0.001','speed 0.447']
+	return '\n'.join(lines) + '\n'
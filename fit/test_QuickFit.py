@@ -0,0 +1,96 @@
+#!/usr/bin/env python
+
+import unittest
+import os
+import subprocess
+import numpy
+import frame
+import test_Frame
+
+here = os.path.dirname(os.path.abspath(__file__))
+
+# The port of Frame.quickFit in replay/QuickFit.h, run through its driver (make quickFitFrames.out in ../replay)
+quickFitFrames = os.path.join(here,'..','replay','quickFitFrames.out')
+
+# QuickFitter::Status, for each exception Frame.quickFit raises
+FIT,NO_LEVEL,RISING_EDGES,FALLING_EDGES,EDGE_AT_END = range(5)
+
+@unittest.skipUnless(os.path.exists(quickFitFrames),"replay/quickFitFrames.out is not built")
+class test_QuickFit(unittest.TestCase):
+
+    def setUp(self):
+        class Object(object):
+            pass
+        self.args = Object()
+        self.args.nfingers = 5
+        self.args.verbose = False
+
+    def test_testFrames(self):
+        self.assertEqual(self.checkFrames([test_Frame.samples(),test_Frame.oppositeSwingSamples()]),[FIT,FIT],
+            msg="Quick Fit parity test failed")
+        self.assertEqual(self.checkFrames([test_Frame.slantedMiddleShelfSamples()]),[FIT],
+            msg="Quick Fit parity (slant) test failed")
+
+    def test_recordedFrames(self):
+        nsamples = 3072
+        data = numpy.loadtxt(os.path.join(here,'NotchedFingersData.dat'),dtype=int)
+        nframe = len(data)//(1+nsamples)
+        frames = data[:nframe*(1+nsamples)].reshape((nframe,1+nsamples))[:,1:]
+        self.assertEqual(self.checkFrames(frames),[FIT]*nframe,
+            msg="Quick Fit parity (recorded frames) test failed")
+
+    def test_failedFits(self):
+        # Rolling the frame moves the first falling edge to the end, or drops an edge
+        samples = test_Frame.samples()
+        frames = [numpy.roll(samples,-60),numpy.roll(samples,-57),numpy.roll(samples,191),noLevelSamples()]
+        self.assertEqual(self.checkFrames(frames),[EDGE_AT_END,FALLING_EDGES,RISING_EDGES,NO_LEVEL],
+            msg="Quick Fit parity (failures) test failed")
+
+    def quickFit(self,samples):
+        """
+        Returns the status of Frame.quickFit on the samples and, for a fit, its results in the
+        order the driver prints them.
+        """
+        try:
+            direction,lo,hi,t0,riseFit,fallFit,height = frame.Frame(samples).quickFit(self.args)
+        except ZeroDivisionError:
+            return NO_LEVEL,None
+        except RuntimeError as error:
+            return (RISING_EDGES if 'rising' in str(error) else FALLING_EDGES),None
+        except ValueError:
+            return EDGE_AT_END,None
+        return FIT,numpy.r_[direction,lo,hi,height,t0,riseFit,fallFit]
+
+    def checkFrames(self,frames):
+        """
+        Quick fits frames of one length with the driver and with frame.py, checks that the
+        statuses agree and that the fits agree to 1e-9 samples or ADC counts, and returns the
+        statuses.
+        """
+        nsamples = len(frames[0])
+        text = ''.join('0\n' + ''.join('%d\n' % value for value in samples) for samples in frames)
+        driver = subprocess.Popen([quickFitFrames,'-',str(nsamples),str(self.args.nfingers)],
+            stdin=subprocess.PIPE,stdout=subprocess.PIPE,universal_newlines=True)
+        lines = driver.communicate(text)[0].splitlines()
+        self.assertEqual(len(lines),len(frames),msg="Quick Fit driver test failed")
+        statuses = [ ]
+        for i in range(len(frames)):
+            values = numpy.array([float(value) for value in lines[i].split()])
+            status,expected = self.quickFit(numpy.asarray(frames[i],dtype=int))
+            self.assertEqual(int(values[0]),status,
+                msg="Quick Fit status of frame %d: %d != %d" % (i,int(values[0]),status))
+            if expected is not None:
+                self.assertTrue(numpy.allclose(values[1:],expected,rtol=0,atol=1e-9),
+                    msg="Quick Fit of frame %d test failed by %g" % (i,numpy.max(numpy.abs(values[1:]-expected))))
+            statuses.append(status)
+        return statuses
+
+def noLevelSamples():
+    # Four levels whose closest two, 995 and 1020, are merged into a histogram peak at 1007
+    # with no samples within 10 of it
+    a = numpy.r_[[1020]*800,[0]*700,[300]*700,[995]*872]
+    return a
+
+if __name__ == '__main__':
+    suite = unittest.TestLoader().loadTestsFromTestCase(test_QuickFit)
+    unittest.TextTestRunner(verbosity=2).run(suite)
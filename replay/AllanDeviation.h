@@ -0,0 +1,173 @@
+/*
+Streaming Allan deviations
+
+Overlapping Allan and modified Allan deviations of a series of fractional
+frequencies y, sampled every tau0, at octave spaced tau = m*tau0 for
+m = 1, 2, 4 ...  The phase is x[n] = tau0*(y[0] + ... + y[n - 1]) and
+
+	avar(tau) = <(x[i + 2m] - 2x[i + m] + x[i])^2>/(2 tau^2)
+	mvar(tau) = <(X[i + 2m] - 2X[i + m] + X[i])^2>/(2 m^2 tau^2)
+
+with X[i] the sum of the m phases from x[i] on, averaged over the i seen so
+far.  Rather than keeping the whole series, each octave keeps the phases and
+the sums of phases it needs at a stride of m/overlap samples (1 up to
+m = overlap), so its memory is O(overlap) however long the run, and every
+m/overlap samples it adds one term of each average: up to m = overlap the
+deviations are the fully overlapping ones, and above the terms still overlap
+overlap-fold.  The frequencies are taken relative to the first, which leaves
+the deviations as they are and keeps the phases small over long runs.
+
+Samples are added from one thread, and a snapshot of the deviations can be
+taken between any two of them.
+*/
+
+#ifndef ALLANDEVIATION_H
+#define ALLANDEVIATION_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct AllanPoint
+{
+	double tau;
+	double adev;
+	// NAN until modTerms > 0
+	double mdev;
+	// Of the averages
+	uint64_t terms;
+	uint64_t modTerms;
+};
+
+class AllanDeviation
+{
+public:
+	// tau up to 2^(DEFAULT_OCTAVES - 1) tau0
+	static const int DEFAULT_OCTAVES = 32;
+	static const uint32_t DEFAULT_OVERLAP = 16;
+
+	AllanDeviation(double tau0, int octaves = DEFAULT_OCTAVES, uint32_t overlap = DEFAULT_OVERLAP)
+	{
+		this->_tau0 = tau0;
+		this->_samples = 0;
+		this->_first = 0;
+		this->_phase = 0;
+		if(overlap < 1) overlap = 1;
+		this->_octaves.resize(octaves);
+		for (int k = 0; k < octaves; ++k)
+		{
+			Octave &octave = this->_octaves[k];
+			octave.m = (uint64_t)1 << k;
+			octave.blocks = (octave.m < overlap)?(uint32_t)octave.m:overlap;
+			octave.stride = octave.m/octave.blocks;
+			octave.phases.assign(2*octave.blocks + 1, 0);
+			octave.sums.assign(3*octave.blocks, 0);
+			octave.phaseCount = octave.sumCount = 0;
+			octave.partial = 0;
+			octave.squares = octave.modSquares = 0;
+			octave.terms = octave.modTerms = 0;
+		}
+		// x[0]
+		addPhase(0, 0);
+	}
+
+	void add(double y)
+	{
+		if(this->_samples == 0) this->_first = y;
+		this->_phase += (y - this->_first)*this->_tau0;
+		addPhase(++this->_samples, this->_phase);
+	}
+
+	// Samples added
+	uint64_t size() const
+	{
+		return this->_samples;
+	}
+
+	// The deviations at every tau with terms so far
+	void snapshot(std::vector<AllanPoint> &points) const
+	{
+		points.clear();
+		for (size_t k = 0; k < this->_octaves.size(); ++k)
+		{
+			const Octave &octave = this->_octaves[k];
+			if(octave.terms == 0) break;
+			AllanPoint point;
+			point.tau = octave.m*this->_tau0;
+			point.adev = std::sqrt(octave.squares/(2*point.tau*point.tau*octave.terms));
+			point.mdev = octave.modTerms?std::sqrt(octave.modSquares/(2*(double)octave.m*octave.m*point.tau*point.tau*octave.modTerms)):NAN;
+			point.terms = octave.terms;
+			point.modTerms = octave.modTerms;
+			points.push_back(point);
+		}
+	}
+
+private:
+	struct Octave
+	{
+		uint64_t m;
+		uint64_t stride;
+		// Strides in m
+		uint32_t blocks;
+		// Rings of the last 2*blocks + 1 phases at the stride, and of the last
+		// 3*blocks sums of stride phases
+		std::vector<double> phases;
+		std::vector<double> sums;
+		uint64_t phaseCount;
+		uint64_t sumCount;
+		// Of the stride being summed
+		double partial;
+		double squares;
+		double modSquares;
+		uint64_t terms;
+		uint64_t modTerms;
+	};
+
+	// x[n]
+	void addPhase(uint64_t n, double x)
+	{
+		for (size_t k = 0; k < this->_octaves.size(); ++k)
+		{
+			Octave &octave = this->_octaves[k];
+			uint64_t mask = octave.stride - 1;
+			if((n & mask) == 0) {
+				size_t length = octave.phases.size();
+				octave.phases[octave.phaseCount % length] = x;
+				if(++octave.phaseCount >= length) {
+					double x1 = octave.phases[(octave.phaseCount - 1 - octave.blocks) % length];
+					double x0 = octave.phases[octave.phaseCount % length];
+					double term = x - 2*x1 + x0;
+					octave.squares += term*term;
+					++octave.terms;
+				}
+			}
+			octave.partial += x;
+			if((n & mask) == mask) {
+				size_t length = octave.sums.size();
+				octave.sums[octave.sumCount % length] = octave.partial;
+				octave.partial = 0;
+				if(++octave.sumCount >= length) {
+					// The sums of the three runs of m phases, oldest first
+					double run[3] = { 0, 0, 0 };
+					for (size_t j = 0; j < length; ++j)
+					{
+						run[j/octave.blocks] += octave.sums[(octave.sumCount + j) % length];
+					}
+					double term = run[2] - 2*run[1] + run[0];
+					octave.modSquares += term*term;
+					++octave.modTerms;
+				}
+			}
+		}
+	}
+
+	double _tau0;
+	uint64_t _samples;
+	double _first;
+	// x[_samples]
+	double _phase;
+	std::vector<Octave> _octaves;
+};
+
+#endif
@@ -0,0 +1,350 @@
+/*
+Compressed archive of the packets in a binaryPackets log
+
+Packets are stored in blocks of up to BLOCK_PACKETS that decode on their own,
+followed by an index of the blocks and a footer that points at it, so a block
+can be found by packet ordinal and blocks can be decoded in parallel.  Only
+whole packets are kept: the logger's chunk framing and damaged regions are
+not.
+
+Within a block, each data packet's fields are stored as byte differences
+(mod 256) from the previous data packet's, and its raw samples as differences
+from the sample before, also mod 256, so that 8 bit wraps at the quadrant
+edges stay small.  Boot packets are stored as they are.  The differences go in
+two streams, fields and samples, each entropy coded with its own table (see
+RansCoder.h).
+
+File layout (little endian):
+
+	ArchiveHeader, blocks, padding to 8 bytes, ArchiveBlock[blocks], ArchiveFooter
+	block: uint32 packets, fields stream, samples stream
+	fields stream: per packet the type, then 66 bytes (boot) or 52 (data)
+*/
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "MappedFile.h"
+#include "PacketReader.h"
+#include "RansCoder.h"
+
+struct ArchiveHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t rawLength;
+};
+
+struct ArchiveBlock
+{
+	uint64_t offset;
+	uint64_t firstPacket;
+	uint32_t size;
+	uint32_t packets;
+};
+
+struct ArchiveFooter
+{
+	uint64_t indexOffset;
+	uint64_t blocks;
+	char magic[8];
+};
+
+// Packets of one decoded block, pointing into its own buffer.  A packet's
+// position.offset is its ordinal in the archive.
+struct ArchiveBlockData
+{
+	std::vector<uint8_t> bytes;
+	std::vector<Packet> packets;
+};
+
+class ArchiveWriter
+{
+public:
+	static const uint32_t VERSION = 1;
+	static const size_t BLOCK_PACKETS = 256;
+
+	ArchiveWriter()
+	{
+		this->_out = 0;
+		this->_rawLength = 0;
+		this->_packets = 0;
+		this->_bytes = 0;
+		this->_blockPackets = 0;
+	}
+
+	~ArchiveWriter()
+	{
+		if(this->_out) std::fclose(this->_out);
+	}
+
+	// Returns false (with errno set) if the archive cannot be created
+	bool open(const char *filename, size_t rawLength)
+	{
+		this->_out = std::fopen(filename, "wb");
+		if(!this->_out) return false;
+		this->_rawLength = rawLength;
+		ArchiveHeader header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, "GEARSARC", 8);
+		header.version = VERSION;
+		header.rawLength = (uint32_t)rawLength;
+		this->_bytes = std::fwrite(&header, 1, sizeof(header), this->_out);
+		return this->_bytes == sizeof(header);
+	}
+
+	// Adds a packet read from a log with the same rawLength
+	void add(const Packet &packet)
+	{
+		this->_block.push_back(packet.type);
+		this->_block.insert(this->_block.end(), packet.data + PacketReader::HEADER_SIZE, packet.data + packet.size);
+		++this->_blockPackets;
+		if(this->_blockPackets == BLOCK_PACKETS) flush();
+	}
+
+	// Writes the last block, the index and the footer.  Returns false on error.
+	bool close()
+	{
+		flush();
+		// The index is mapped by the reader, so it starts 8 byte aligned
+		static const uint8_t padding[8] = {0};
+		this->_bytes += std::fwrite(padding, 1, (8 - this->_bytes % 8) % 8, this->_out);
+		ArchiveFooter footer;
+		std::memset(&footer, 0, sizeof(footer));
+		footer.indexOffset = this->_bytes;
+		footer.blocks = this->_index.size();
+		std::memcpy(footer.magic, "GEARSEND", 8);
+		if(!this->_index.empty()) std::fwrite(&this->_index[0], sizeof(ArchiveBlock), this->_index.size(), this->_out);
+		std::fwrite(&footer, sizeof(footer), 1, this->_out);
+		bool ok = !std::ferror(this->_out);
+		ok = (std::fclose(this->_out) == 0) && ok;
+		this->_out = 0;
+		return ok;
+	}
+
+	// Bytes written so far
+	uint64_t getSize() const
+	{
+		return this->_bytes;
+	}
+
+private:
+	// Codes the buffered packets as one block
+	void flush()
+	{
+		if(this->_blockPackets == 0) return;
+		std::vector<uint8_t> fields;
+		std::vector<uint8_t> samples;
+		size_t fieldsSize = PacketReader::RAW_START - PacketReader::HEADER_SIZE;
+		std::vector<uint8_t> previous(fieldsSize, 0);
+		for (size_t at = 0; at < this->_block.size();)
+		{
+			uint8_t type = this->_block[at++];
+			fields.push_back(type);
+			if(type != PacketReader::DATA_PACKET) {
+				size_t n = PacketReader::BOOT_PACKET_SIZE - PacketReader::HEADER_SIZE;
+				fields.insert(fields.end(), &this->_block[at], &this->_block[at] + n);
+				at += n;
+				continue;
+			}
+			const uint8_t *p = &this->_block[at];
+			for (size_t i = 0; i < fieldsSize; ++i)
+			{
+				fields.push_back((uint8_t)(p[i] - previous[i]));
+				previous[i] = p[i];
+			}
+			const uint8_t *raw = p + fieldsSize;
+			uint8_t last = 0;
+			for (size_t i = 0; i < this->_rawLength; ++i)
+			{
+				samples.push_back((uint8_t)(raw[i] - last));
+				last = raw[i];
+			}
+			at += fieldsSize + this->_rawLength;
+		}
+
+		std::vector<uint8_t> coded(4);
+		for (int i = 0; i < 4; ++i) coded[i] = (uint8_t)(this->_blockPackets >> (8*i));
+		RansCoder::encode(fields.empty()?0:&fields[0], fields.size(), coded);
+		RansCoder::encode(samples.empty()?0:&samples[0], samples.size(), coded);
+
+		ArchiveBlock block;
+		block.offset = this->_bytes;
+		block.firstPacket = this->_packets;
+		block.size = (uint32_t)coded.size();
+		block.packets = (uint32_t)this->_blockPackets;
+		this->_index.push_back(block);
+		this->_bytes += std::fwrite(&coded[0], 1, coded.size(), this->_out);
+		this->_packets += this->_blockPackets;
+		this->_block.clear();
+		this->_blockPackets = 0;
+	}
+
+	FILE *_out;
+	size_t _rawLength;
+	uint64_t _packets;
+	uint64_t _bytes;
+	// Type and payload of each packet of the block being filled
+	std::vector<uint8_t> _block;
+	size_t _blockPackets;
+	std::vector<ArchiveBlock> _index;
+};
+
+class ArchiveReader
+{
+public:
+	ArchiveReader()
+	{
+		this->_rawLength = 0;
+		this->_blocks = 0;
+		this->_count = 0;
+	}
+
+	// Returns false if the file cannot be mapped or is not a whole archive
+	bool open(const char *filename)
+	{
+		if(!this->_file.open(filename)) return false;
+		const uint8_t *data = this->_file.getData();
+		size_t size = this->_file.getSize();
+		if(size < sizeof(ArchiveHeader) + sizeof(ArchiveFooter)) return false;
+		ArchiveHeader header;
+		ArchiveFooter footer;
+		std::memcpy(&header, data, sizeof(header));
+		std::memcpy(&footer, data + size - sizeof(footer), sizeof(footer));
+		if(std::memcmp(header.magic, "GEARSARC", 8) != 0 || header.version != ArchiveWriter::VERSION) return false;
+		if(std::memcmp(footer.magic, "GEARSEND", 8) != 0) return false;
+		if(footer.indexOffset > size - sizeof(footer) ||
+			footer.blocks != (size - sizeof(footer) - footer.indexOffset)/sizeof(ArchiveBlock)) return false;
+		this->_rawLength = header.rawLength;
+		this->_blocks = (const ArchiveBlock *)(data + footer.indexOffset);
+		this->_count = footer.blocks;
+		return true;
+	}
+
+	size_t getRawLength() const
+	{
+		return this->_rawLength;
+	}
+
+	uint64_t getBlockCount() const
+	{
+		return this->_count;
+	}
+
+	const ArchiveBlock &getBlock(uint64_t b) const
+	{
+		return this->_blocks[b];
+	}
+
+	uint64_t getPacketCount() const
+	{
+		return (this->_count == 0)?0:(this->_blocks[this->_count - 1].firstPacket + this->_blocks[this->_count - 1].packets);
+	}
+
+	// Block holding the packet with this ordinal, or getBlockCount() if there is none
+	uint64_t findBlock(uint64_t ordinal) const
+	{
+		if(ordinal >= getPacketCount()) return this->_count;
+		return std::upper_bound(this->_blocks, this->_blocks + this->_count, ordinal,
+			[](uint64_t v, const ArchiveBlock &b) { return v < b.firstPacket; }) - this->_blocks - 1;
+	}
+
+	// Decodes block b into whole packets, header and all.  Returns false if it is damaged.
+	bool decode(uint64_t b, ArchiveBlockData &out) const
+	{
+		const ArchiveBlock &block = this->_blocks[b];
+		const uint8_t *in = this->_file.getData() + block.offset;
+		size_t size = block.size;
+		out.packets.clear();
+		if(size < 4 || block.offset + size > this->_file.getSize()) return false;
+		uint32_t packets = in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+		in += 4;
+		size -= 4;
+		if(packets > ArchiveWriter::BLOCK_PACKETS) return false;
+
+		// Stream lengths are checked before anything is allocated for them
+		size_t fieldsSize = PacketReader::RAW_START - PacketReader::HEADER_SIZE;
+		size_t bootSize = PacketReader::BOOT_PACKET_SIZE - PacketReader::HEADER_SIZE;
+		size_t fieldsSymbols = RansCoder::getSymbols(in, size);
+		size_t fieldsBytes = RansCoder::getStreamSize(in, size);
+		if(fieldsBytes == 0 || fieldsSymbols > packets*(1 + std::max(fieldsSize, bootSize))) return false;
+		std::vector<uint8_t> fields(fieldsSymbols);
+		if(!RansCoder::decode(in, size, fields.data())) return false;
+		in += fieldsBytes;
+		size -= fieldsBytes;
+		size_t samplesSymbols = RansCoder::getSymbols(in, size);
+		if(samplesSymbols > packets*this->_rawLength) return false;
+		std::vector<uint8_t> samples(samplesSymbols);
+		if(!RansCoder::decode(in, size, samples.data())) return false;
+
+		// Put the packets back together
+		size_t dataPacketSize = PacketReader::RAW_START + this->_rawLength;
+		out.bytes.resize(packets*std::max(dataPacketSize, (size_t)PacketReader::BOOT_PACKET_SIZE));
+		std::vector<uint8_t> previous(fieldsSize, 0);
+		size_t at = 0;
+		size_t sample = 0;
+		size_t written = 0;
+		std::vector<size_t> starts;
+		for (uint32_t k = 0; k < packets; ++k)
+		{
+			if(at >= fields.size()) return false;
+			uint8_t type = fields[at++];
+			uint8_t *p = &out.bytes[written];
+			p[0] = p[1] = p[2] = PacketReader::START_BYTE;
+			p[3] = type;
+			starts.push_back(written);
+			if(type != PacketReader::DATA_PACKET) {
+				if(at + bootSize > fields.size()) return false;
+				std::memcpy(p + PacketReader::HEADER_SIZE, &fields[at], bootSize);
+				at += bootSize;
+				written += PacketReader::BOOT_PACKET_SIZE;
+				continue;
+			}
+			if(at + fieldsSize > fields.size() || sample + this->_rawLength > samples.size()) return false;
+			uint8_t *q = p + PacketReader::HEADER_SIZE;
+			for (size_t i = 0; i < fieldsSize; ++i)
+			{
+				previous[i] = (uint8_t)(previous[i] + fields[at + i]);
+				q[i] = previous[i];
+			}
+			at += fieldsSize;
+			uint8_t *raw = p + PacketReader::RAW_START;
+			uint8_t last = 0;
+			for (size_t i = 0; i < this->_rawLength; ++i)
+			{
+				last = (uint8_t)(last + samples[sample + i]);
+				raw[i] = last;
+			}
+			sample += this->_rawLength;
+			written += dataPacketSize;
+		}
+
+		Packet packet;
+		packet.position.offset = 0;
+		packet.position.chunkRemaining = 0;
+		for (size_t k = 0; k < starts.size(); ++k)
+		{
+			packet.data = &out.bytes[starts[k]];
+			packet.type = packet.data[3];
+			packet.size = (packet.type == PacketReader::DATA_PACKET)?dataPacketSize:PacketReader::BOOT_PACKET_SIZE;
+			packet.position.offset = block.firstPacket + k;
+			out.packets.push_back(packet);
+		}
+		return true;
+	}
+
+private:
+	MappedFile _file;
+	size_t _rawLength;
+	const ArchiveBlock *_blocks;
+	uint64_t _count;
+};
+
+#endif
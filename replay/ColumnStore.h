@@ -0,0 +1,350 @@
+/*
+Columnar export of decoded data packets
+
+Every data packet that reconstitutes to a frame becomes one row.  Each field
+is written as its own array, <directory>/<field>.npy, and the frames as one
+rows x CIRCULAR_BUFFER_LENGTH uint16 matrix, frames.npy.  The .npy header is
+a few lines of text padded to 64 bytes followed by the raw little endian
+values, so any column can be used straight from disk:
+
+	numpy.load('export/pressure.npy', mmap_mode='r')
+
+Fields are stored as the firmware sends them (see mcu/packet.h), with the big
+endian GPS alarms and clock offset swapped.  gpsAlarms and gpsStatus are never
+filled by the firmware and are zero (see PacketViews.h).  Units are converted
+in the analysis, as in node/logger.js (e.g. temperature/500 + 24 for degrees C).  Two columns are
+derived: epoch, the number of boot packets before the row, and timestamp, the
+GPS time in seconds since the Unix epoch as in PacketIndex.h (zero before the
+first boot packet).
+
+With quick fits of the frames (see QuickFit.h), each result field gets a
+column too, rise and fall as rows x nfingers matrices, and fitStatus holds
+the QuickFitter::Status (NaN fields when it is not FIT).  Template fits (see
+TemplateFit.h) add templateStatus, templateT0, duration, templateLo,
+templateRng and chiSquare.  Environmental corrections of the periods (see
+EnvironmentCorrector.h) add period, correctedPeriod and the rows x 6 matrix
+environmentCoefficients (NaN for frames without a kept period).
+
+Rows come in segments, one per range of the log, added in log order.
+*/
+
+#ifndef COLUMNSTORE_H
+#define COLUMNSTORE_H
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "EnvironmentCorrector.h"
+#include "PacketIndex.h"
+#include "PacketReader.h"
+#include "PacketViews.h"
+#include "QuickFit.h"
+#include "Reconstituter.h"
+#include "TemplateFit.h"
+
+struct Telemetry
+{
+	uint32_t epoch;
+	uint32_t sequenceNumber;
+	uint64_t timeSinceLastBootPacket;
+	uint32_t humidity;
+	uint32_t pressure;
+	uint16_t thermistor;
+	int16_t temperature;
+	uint16_t irLevel;
+	uint16_t rawPhase;
+	uint16_t gpsAlarms;
+	uint16_t gpsStatus;
+	uint8_t recieverMode;
+	uint8_t discipliningMode;
+	uint16_t criticalAlarms;
+	uint16_t minorAlarms;
+	uint8_t gpsDecodingStatus;
+	uint8_t discipliningActivity;
+	float clockOffset;
+
+	// Fields of a data packet (with its header), epoch counted within its segment
+	void parse(const DataPacketView &packet, uint32_t bootPackets)
+	{
+		this->epoch = bootPackets;
+		this->sequenceNumber = packet.getSequenceNumber();
+		this->gpsAlarms = packet.getGpsAlarms();
+		this->gpsStatus = packet.getGpsStatus();
+		this->timeSinceLastBootPacket = packet.getTimeSinceLastBootPacket();
+		this->humidity = packet.getHumidity();
+		this->pressure = packet.getPressure();
+		this->thermistor = packet.getThermistor();
+		this->temperature = packet.getTemperature();
+		this->irLevel = packet.getIrLevel();
+		this->rawPhase = packet.getRawPhase();
+		this->recieverMode = packet.getRecieverMode();
+		this->discipliningMode = packet.getDiscipliningMode();
+		this->criticalAlarms = packet.getCriticalAlarms();
+		this->minorAlarms = packet.getMinorAlarms();
+		this->gpsDecodingStatus = packet.getGpsDecodingStatus();
+		this->discipliningActivity = packet.getDiscipliningActivity();
+		this->clockOffset = packet.getClockOffset();
+	}
+};
+
+class ColumnStore
+{
+public:
+	ColumnStore(const std::string &directory)
+	{
+		this->_directory = directory;
+		this->_rows = 0;
+		this->_fingers = 0;
+	}
+
+	// Rows of one range with their frames, and the times of the range's boot
+	// packets (see PacketIndex::getBootTime()), which start the epochs counted
+	// in the rows.  Rows and frames are not copied.
+	void addSegment(const std::vector<Telemetry> &rows, const FrameArena &frames, const std::vector<double> &bootTimes)
+	{
+		Segment segment = { &rows, &frames, 0, 0, 0, this->_bootTimes.size() };
+		this->_segments.push_back(segment);
+		this->_bootTimes.insert(this->_bootTimes.end(), bootTimes.begin(), bootTimes.end());
+		this->_rows += rows.size();
+	}
+
+	// Quick fits of the frames of the segment added last, one per row, with
+	// nfingers edges each.  Fits are written only if every segment has them.
+	void addFits(const std::vector<QuickFitResult> &fits, int nfingers)
+	{
+		if(this->_segments.empty()) return;
+		this->_segments.back().fits = &fits;
+		this->_fingers = nfingers;
+	}
+
+	// Template fits of the frames of the segment added last, one per row,
+	// written only if every segment has them
+	void addTemplateFits(const std::vector<TemplateFitResult> &fits)
+	{
+		if(this->_segments.empty()) return;
+		this->_segments.back().templateFits = &fits;
+	}
+
+	// Environmental corrections of the periods of the segment added last, one
+	// per row, written only if every segment has them
+	void addCorrections(const std::vector<EnvironmentCorrector::Result> &corrections)
+	{
+		if(this->_segments.empty()) return;
+		this->_segments.back().corrections = &corrections;
+	}
+
+	uint64_t size() const
+	{
+		return this->_rows;
+	}
+
+	// Writes every column, creating the directory if needed.  Returns false with
+	// errno set on error.
+	bool write()
+	{
+		if(mkdir(this->_directory.c_str(), 0777) != 0 && errno != EEXIST) return false;
+#define COLUMN(field, descr) \
+		if(!writeColumn(#field, descr, sizeof(Telemetry::field), offsetof(Telemetry, field))) return false;
+		COLUMN(epoch, "<u4")
+		COLUMN(sequenceNumber, "<u4")
+		COLUMN(timeSinceLastBootPacket, "<u8")
+		COLUMN(humidity, "<u4")
+		COLUMN(pressure, "<u4")
+		COLUMN(thermistor, "<u2")
+		COLUMN(temperature, "<i2")
+		COLUMN(irLevel, "<u2")
+		COLUMN(rawPhase, "<u2")
+		COLUMN(gpsAlarms, "<u2")
+		COLUMN(gpsStatus, "<u2")
+		COLUMN(recieverMode, "|u1")
+		COLUMN(discipliningMode, "|u1")
+		COLUMN(criticalAlarms, "<u2")
+		COLUMN(minorAlarms, "<u2")
+		COLUMN(gpsDecodingStatus, "|u1")
+		COLUMN(discipliningActivity, "|u1")
+		COLUMN(clockOffset, "<f4")
+#undef COLUMN
+		if(!writeTimestamps() || !writeFrames()) return false;
+		bool fits = true, templateFits = true, corrections = true;
+		for (size_t s = 0; s < this->_segments.size(); ++s)
+		{
+			fits = fits && this->_segments[s].fits;
+			templateFits = templateFits && this->_segments[s].templateFits;
+			corrections = corrections && this->_segments[s].corrections;
+		}
+		if(fits) {
+#define FIT(name, field, descr, columns) \
+			if(!writeResultColumn(name, descr, &Segment::fits, columns, \
+				(columns > 0)?columns*sizeof(double):sizeof(QuickFitResult::field), offsetof(QuickFitResult, field))) return false;
+			FIT("fitStatus", status, "<i4", 0)
+			FIT("direction", direction, "<f8", 0)
+			FIT("lo", lo, "<f8", 0)
+			FIT("hi", hi, "<f8", 0)
+			FIT("height", height, "<f8", 0)
+			FIT("t0", t0, "<f8", 0)
+			FIT("rise", rise, "<f8", this->_fingers)
+			FIT("fall", fall, "<f8", this->_fingers)
+#undef FIT
+		}
+		if(templateFits) {
+#define FIT(name, field, descr) \
+			if(!writeResultColumn(name, descr, &Segment::templateFits, 0, \
+				sizeof(TemplateFitResult::field), offsetof(TemplateFitResult, field))) return false;
+			FIT("templateStatus", status, "<i4")
+			FIT("templateT0", t0, "<f8")
+			FIT("duration", duration, "<f8")
+			FIT("templateLo", lo, "<f8")
+			FIT("templateRng", rng, "<f8")
+			FIT("chiSquare", chiSquare, "<f8")
+#undef FIT
+		}
+		if(corrections) {
+			typedef EnvironmentCorrector::Result Result;
+			if(!writeResultColumn("period", "<f8", &Segment::corrections, 0, sizeof(double),
+				offsetof(Result, period))) return false;
+			if(!writeResultColumn("correctedPeriod", "<f8", &Segment::corrections, 0, sizeof(double),
+				offsetof(Result, correctedPeriod))) return false;
+			if(!writeResultColumn("environmentCoefficients", "<f8", &Segment::corrections, EnvironmentCorrector::FEATURES,
+				sizeof(Result::coefficients), offsetof(Result, coefficients))) return false;
+		}
+		return true;
+	}
+
+private:
+	struct Segment
+	{
+		const std::vector<Telemetry> *rows;
+		const FrameArena *frames;
+		const std::vector<QuickFitResult> *fits;
+		const std::vector<TemplateFitResult> *templateFits;
+		const std::vector<EnvironmentCorrector::Result> *corrections;
+		size_t firstBoot;
+	};
+
+	// Values are buffered this many bytes at a time
+	static const size_t BUFFER_SIZE = 1 << 16;
+
+	FILE *create(const char *name, const char *descr, uint64_t columns)
+	{
+		std::string filename = this->_directory + "/" + name + ".npy";
+		FILE *out = std::fopen(filename.c_str(), "wb");
+		if(!out) return 0;
+
+		char shape[64];
+		if(columns > 0) {
+			std::snprintf(shape, sizeof(shape), "(%llu, %llu)", (unsigned long long)this->_rows, (unsigned long long)columns);
+		} else {
+			std::snprintf(shape, sizeof(shape), "(%llu,)", (unsigned long long)this->_rows);
+		}
+		std::string header = std::string("{'descr': '") + descr + "', 'fortran_order': False, 'shape': " + shape + ", }";
+		// Magic, version 1.0 and the header length come first, and the data is 64 byte aligned
+		size_t length = 10 + header.size() + 1;
+		header.append((64 - length % 64) % 64, ' ');
+		header += '\n';
+		uint16_t headerLength = (uint16_t)header.size();
+		const uint8_t preamble[10] = { 0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0, (uint8_t)(headerLength & 0xFF), (uint8_t)(headerLength >> 8) };
+		std::fwrite(preamble, 1, sizeof(preamble), out);
+		std::fwrite(header.data(), 1, header.size(), out);
+		return out;
+	}
+
+	static bool close(FILE *out)
+	{
+		bool ok = !std::ferror(out);
+		return (std::fclose(out) == 0) && ok;
+	}
+
+	bool writeColumn(const char *name, const char *descr, size_t size, size_t offset)
+	{
+		FILE *out = create(name, descr, 0);
+		if(!out) return false;
+		std::vector<uint8_t> buffer;
+		buffer.reserve(BUFFER_SIZE + size);
+		for (size_t s = 0; s < this->_segments.size(); ++s)
+		{
+			const std::vector<Telemetry> &rows = *this->_segments[s].rows;
+			for (size_t i = 0; i < rows.size(); ++i)
+			{
+				Telemetry row = rows[i];
+				row.epoch += (uint32_t)this->_segments[s].firstBoot;
+				const uint8_t *value = (const uint8_t *)&row + offset;
+				buffer.insert(buffer.end(), value, value + size);
+				if(buffer.size() >= BUFFER_SIZE) {
+					std::fwrite(&buffer[0], 1, buffer.size(), out);
+					buffer.clear();
+				}
+			}
+		}
+		if(!buffer.empty()) std::fwrite(&buffer[0], 1, buffer.size(), out);
+		return close(out);
+	}
+
+	bool writeTimestamps()
+	{
+		FILE *out = create("timestamp", "<f8", 0);
+		if(!out) return false;
+		std::vector<double> buffer;
+		for (size_t s = 0; s < this->_segments.size(); ++s)
+		{
+			const std::vector<Telemetry> &rows = *this->_segments[s].rows;
+			for (size_t i = 0; i < rows.size(); ++i)
+			{
+				size_t epoch = this->_segments[s].firstBoot + rows[i].epoch;
+				double bootTime = (epoch > 0)?this->_bootTimes[epoch - 1]:0;
+				buffer.push_back((bootTime > 0)?(bootTime + rows[i].timeSinceLastBootPacket*PacketIndex::SECONDS_PER_SAMPLE):0);
+				if(buffer.size()*sizeof(double) >= BUFFER_SIZE) {
+					std::fwrite(&buffer[0], sizeof(double), buffer.size(), out);
+					buffer.clear();
+				}
+			}
+		}
+		if(!buffer.empty()) std::fwrite(&buffer[0], sizeof(double), buffer.size(), out);
+		return close(out);
+	}
+
+	bool writeFrames()
+	{
+		size_t frameLength = this->_segments.empty()?0:this->_segments[0].frames->getFrameLength();
+		FILE *out = create("frames", "<u2", frameLength);
+		if(!out) return false;
+		for (size_t s = 0; s < this->_segments.size(); ++s)
+		{
+			const FrameArena &frames = *this->_segments[s].frames;
+			if(frames.size() > 0) std::fwrite(frames.getFrame(0), sizeof(uint16_t)*frameLength, frames.size(), out);
+		}
+		return close(out);
+	}
+
+	// bytes from offset of every row's fit, as columns elements if not zero
+	template <class Result>
+	bool writeResultColumn(const char *name, const char *descr, const std::vector<Result> *Segment::*results,
+		size_t columns, size_t bytes, size_t offset)
+	{
+		FILE *out = create(name, descr, columns);
+		if(!out) return false;
+		for (size_t s = 0; s < this->_segments.size(); ++s)
+		{
+			const std::vector<Result> &fits = *(this->_segments[s].*results);
+			for (size_t i = 0; i < fits.size(); ++i)
+			{
+				std::fwrite((const uint8_t *)&fits[i] + offset, 1, bytes, out);
+			}
+		}
+		return close(out);
+	}
+
+	std::string _directory;
+	std::vector<Segment> _segments;
+	std::vector<double> _bootTimes;
+	uint64_t _rows;
+	int _fingers;
+};
+
+#endif
@@ -0,0 +1,217 @@
+/*
+Online environmental correction of the periods
+
+learn/learn.py regresses the period variation of a whole dump against the
+block temperature (and half its square), pressure and humidity.  An
+EnvironmentCorrector instead fits every kept period as it comes by recursive
+least squares, with the board temperature as well, and gives the period
+corrected to the environment of the first packet along with the
+coefficients so far.  Each period costs O(k^2) for the k coefficients, and a
+forgetting factor below 1 lets the coefficients follow changes of the clock
+with a memory of about 1/(1 - forgetting) periods.
+
+The sensor readings are converted to physical units as node/logger.js does.
+*/
+
+#ifndef ENVIRONMENTCORRECTOR_H
+#define ENVIRONMENTCORRECTOR_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "PacketViews.h"
+
+// The environment of a data packet
+struct Environment
+{
+	// degC, from the thermistor in the sensor block
+	double blockTemperature;
+	// degC
+	double boardTemperature;
+	// Pa
+	double pressure;
+	// Percent
+	double humidity;
+
+	// From the raw fields of a data packet
+	void set(uint16_t thermistor, int16_t temperature, uint32_t pressure, uint32_t humidity)
+	{
+		// Thermistor resistance in ohms with a 100uA current source, and its
+		// Steinhart-Hart temperature
+		double logr = std::log(thermistor/65536.*5/100e-6);
+		this->blockTemperature = 1/(0.000878844 + 0.000231913*logr + 7.70349e-8*logr*logr*logr) - 273.15;
+		this->boardTemperature = temperature/500. + 24;
+		this->pressure = pressure;
+		this->humidity = humidity/1024.;
+	}
+
+	void parse(const DataPacketView &packet)
+	{
+		set(packet.getThermistor(), packet.getTemperature(), packet.getPressure(), packet.getHumidity());
+	}
+};
+
+// y ~ coefficients . x, updated an observation at a time
+class RecursiveLeastSquares
+{
+public:
+	// Starting variance of the coefficients, large enough to carry no weight
+	static constexpr double DEFAULT_DELTA = 1e6;
+
+	RecursiveLeastSquares(size_t k, double forgetting = 1, double delta = DEFAULT_DELTA)
+	{
+		this->_k = k;
+		this->_forgetting = forgetting;
+		this->_delta = delta;
+		this->_observations = 0;
+		this->_coefficients.assign(k, 0);
+		this->_covariance.assign(k*k, 0);
+		for (size_t i = 0; i < k; ++i) this->_covariance[i*k + i] = delta;
+		this->_px.resize(k);
+	}
+
+	// Adds an observation of the k values of x.  Returns the error of its
+	// prediction before the update.
+	double add(const double *x, double y)
+	{
+		size_t k = this->_k;
+		std::vector<double> &p = this->_covariance;
+		double xpx = 0;
+		for (size_t i = 0; i < k; ++i)
+		{
+			double sum = 0;
+			for (size_t j = 0; j < k; ++j) sum += p[i*k + j]*x[j];
+			this->_px[i] = sum;
+			xpx += x[i]*sum;
+		}
+		double error = y - predict(x);
+		double denominator = this->_forgetting + xpx;
+		for (size_t i = 0; i < k; ++i) this->_coefficients[i] += this->_px[i]*error/denominator;
+		// P = (P - Px (Px)'/denominator)/forgetting, forgetting held back while
+		// P is as large as it started so that it does not wind up while x stays
+		// the same
+		double trace = 0;
+		for (size_t i = 0; i < k; ++i)
+		{
+			for (size_t j = i; j < k; ++j)
+			{
+				p[i*k + j] -= this->_px[i]*this->_px[j]/denominator;
+				p[j*k + i] = p[i*k + j];
+			}
+			trace += p[i*k + i];
+		}
+		if(trace < k*this->_delta*this->_forgetting) {
+			for (size_t i = 0; i < k*k; ++i) p[i] /= this->_forgetting;
+		}
+		++this->_observations;
+		return error;
+	}
+
+	double predict(const double *x) const
+	{
+		double y = 0;
+		for (size_t i = 0; i < this->_k; ++i) y += this->_coefficients[i]*x[i];
+		return y;
+	}
+
+	const std::vector<double> &getCoefficients() const
+	{
+		return this->_coefficients;
+	}
+
+	uint64_t size() const
+	{
+		return this->_observations;
+	}
+
+private:
+	size_t _k;
+	double _forgetting;
+	double _delta;
+	uint64_t _observations;
+	std::vector<double> _coefficients;
+	// k by k, row major
+	std::vector<double> _covariance;
+	// Scratch for P x
+	std::vector<double> _px;
+};
+
+class EnvironmentCorrector
+{
+public:
+	// Of the regression, the period variation in ppm against the environment
+	// less that of the first packet
+	enum Feature {
+		INTERCEPT,
+		BLOCK_TEMPERATURE,
+		// Half the square, as learn.py has it
+		BLOCK_TEMPERATURE_SQUARED,
+		BOARD_TEMPERATURE,
+		PRESSURE,
+		HUMIDITY,
+		FEATURES
+	};
+
+	// About a day of periods
+	static constexpr double DEFAULT_FORGETTING = 1 - 1/86400.;
+
+	struct Result
+	{
+		// Seconds, NAN for a frame without a kept period
+		double period;
+		double correctedPeriod;
+		// ppm per unit of each feature
+		double coefficients[FEATURES];
+	};
+
+	EnvironmentCorrector(double nominalPeriod, double forgetting = DEFAULT_FORGETTING) :
+		_fit(FEATURES, forgetting)
+	{
+		this->_nominalPeriod = nominalPeriod;
+	}
+
+	// Fits a period in seconds with the environment of its packet
+	void add(double period, const Environment &environment, Result &result)
+	{
+		if(this->_fit.size() == 0) this->_reference = environment;
+		double x[FEATURES];
+		features(environment, x);
+		double variation = 1e6*(period/this->_nominalPeriod - 1);
+		this->_fit.add(x, variation);
+		const std::vector<double> &coefficients = this->_fit.getCoefficients();
+		double correction = this->_fit.predict(x) - coefficients[INTERCEPT];
+		result.period = period;
+		result.correctedPeriod = period - 1e-6*correction*this->_nominalPeriod;
+		for (int i = 0; i < FEATURES; ++i) result.coefficients[i] = coefficients[i];
+	}
+
+	const std::vector<double> &getCoefficients() const
+	{
+		return this->_fit.getCoefficients();
+	}
+
+	uint64_t size() const
+	{
+		return this->_fit.size();
+	}
+
+private:
+	void features(const Environment &environment, double *x) const
+	{
+		double temperature = environment.blockTemperature - this->_reference.blockTemperature;
+		x[INTERCEPT] = 1;
+		x[BLOCK_TEMPERATURE] = temperature;
+		x[BLOCK_TEMPERATURE_SQUARED] = 0.5*temperature*temperature;
+		x[BOARD_TEMPERATURE] = environment.boardTemperature - this->_reference.boardTemperature;
+		x[PRESSURE] = environment.pressure - this->_reference.pressure;
+		x[HUMIDITY] = environment.humidity - this->_reference.humidity;
+	}
+
+	double _nominalPeriod;
+	Environment _reference;
+	RecursiveLeastSquares _fit;
+};
+
+#endif
@@ -0,0 +1,79 @@
+/*
+Waits for a file that is being appended to to grow
+
+On Linux an inotify watch wakes the caller as soon as the writer modifies the
+file; elsewhere the size is polled every POLL_MICROSECONDS.  The size is
+checked after the watch is set up and before blocking, so an append that lands
+in between is not missed.
+*/
+
+#ifndef FILEFOLLOWER_H
+#define FILEFOLLOWER_H
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+class FileFollower
+{
+public:
+	static const unsigned POLL_MICROSECONDS = 100000;
+
+	FileFollower()
+	{
+		this->_filename = 0;
+		this->_notify = -1;
+	}
+
+	~FileFollower()
+	{
+		if(this->_notify >= 0) ::close(this->_notify);
+	}
+
+	// Returns false (with errno set) if the file cannot be watched
+	bool open(const char *filename)
+	{
+		this->_filename = filename;
+#ifdef __linux__
+		this->_notify = inotify_init1(IN_CLOEXEC);
+		if(this->_notify < 0) return false;
+		if(inotify_add_watch(this->_notify, filename, IN_MODIFY) < 0) return false;
+#endif
+		struct stat info;
+		return stat(filename, &info) == 0;
+	}
+
+	// Blocks until the file is larger than size.  Returns false on error.
+	bool wait(uint64_t size)
+	{
+		for (;;)
+		{
+			struct stat info;
+			if(stat(this->_filename, &info) != 0) return false;
+			if((uint64_t)info.st_size > size) return true;
+#ifdef __linux__
+			char events[4096];
+			if(read(this->_notify, events, sizeof(events)) < 0 && errno != EINTR) return false;
+#else
+			usleep(POLL_MICROSECONDS);
+#endif
+		}
+	}
+
+private:
+	// Not copyable: the watch has a single owner
+	FileFollower(const FileFollower &);
+	FileFollower &operator=(const FileFollower &);
+
+	const char *_filename;
+	int _notify;
+};
+
+#endif
@@ -0,0 +1,237 @@
+/*
+In memory binaryPackets logs for benchmarks
+
+A log is built from a set of frames (10 bit samples in time order) that its
+data packets cycle through, each sent as the firmware does: truncated to the
+low byte and rotated by a random rawPhase.  It starts with the logger's
+leading zeroes and a boot packet, with another boot packet every
+BOOT_INTERVAL data packets, and the serial stream is cut into chunks of
+random length as node/logger.js receives them.
+
+Frames come from a file in the fit.py input format (samplesSinceBoot and then
+the frame, one value per line, e.g. fit/NotchedFingersData.dat) or are
+synthesized: five dark fingers with soft edges on a bright level, plus noise,
+as fit.py expects them.
+
+Damage is modelled as serial data lost from inside a packet: a packet is hit
+with probability corruption and a random run of its bytes is dropped, which
+leaves the chunk framing intact and sends a reader into resync.
+*/
+
+#ifndef LOGFIXTURE_H
+#define LOGFIXTURE_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "PacketViews.h"
+#include "Random.h"
+
+class LogFixture
+{
+public:
+	static const size_t ZEROES = 100;
+	static const uint64_t BOOT_INTERVAL = 10000;
+	static const size_t MIN_CHUNK = 16;
+	static const size_t MAX_CHUNK = 1024;
+
+	LogFixture(size_t rawLength, uint64_t seed) : _random(seed)
+	{
+		this->_rawLength = rawLength;
+		this->_corruption = 0;
+		this->_damaged = 0;
+	}
+
+	size_t getRawLength() const
+	{
+		return this->_rawLength;
+	}
+
+	size_t getFrameCount() const
+	{
+		return this->_frames.size()/this->_rawLength;
+	}
+
+	// Fraction of packets that lose a run of bytes
+	void setCorruption(double corruption)
+	{
+		this->_corruption = corruption;
+	}
+
+	// Packets damaged by the last build()
+	uint64_t getDamagedPackets() const
+	{
+		return this->_damaged;
+	}
+
+	// Adds every frame in a file of fit.py input.  Returns false if the file
+	// cannot be read or holds no whole frame.
+	bool loadFrames(const char *filename)
+	{
+		FILE *in = std::fopen(filename, "r");
+		if(!in) return false;
+		std::vector<uint16_t> frame(this->_rawLength);
+		unsigned long long samplesSinceBoot;
+		unsigned value;
+		size_t added = 0;
+		while(std::fscanf(in, "%llu", &samplesSinceBoot) == 1)
+		{
+			size_t i = 0;
+			while(i < this->_rawLength && std::fscanf(in, "%u", &value) == 1) frame[i++] = (uint16_t)(value & 0x3FF);
+			if(i < this->_rawLength) break;
+			this->_frames.insert(this->_frames.end(), frame.begin(), frame.end());
+			++added;
+		}
+		std::fclose(in);
+		return added > 0;
+	}
+
+	// Adds count frames of fingers passing a bright level at random offsets
+	void addSyntheticFrames(size_t count)
+	{
+		const double lo = 100, hi = 900, noise = 1.5, edge = 8;
+		const double fingers[] = { -0.3, -0.15, 0.0, 0.15, 0.3 };
+		const double widths[] = { 0.08, 0.05, 0.04, 0.05, 0.05 };
+		for (size_t f = 0; f < count; ++f)
+		{
+			double center = (0.5 + 0.1*(this->_random.uniform() - 0.5))*this->_rawLength;
+			for (size_t i = 0; i < this->_rawLength; ++i)
+			{
+				double transmission = 1;
+				for (size_t k = 0; k < sizeof(fingers)/sizeof(fingers[0]); ++k)
+				{
+					double d = std::fabs(i - center - fingers[k]*this->_rawLength) - 0.5*widths[k]*this->_rawLength;
+					transmission *= 0.5*(1 + std::tanh(d/edge));
+				}
+				long q = std::lround(lo + (hi - lo)*transmission + noise*this->_random.gauss());
+				if(q < 0) q = 0;
+				if(q > 1023) q = 1023;
+				this->_frames.push_back((uint16_t)q);
+			}
+		}
+	}
+
+	// Replaces log with a log of about size bytes of serial data, adding a
+	// synthetic frame first if there are none
+	void build(size_t size, std::vector<uint8_t> &log)
+	{
+		if(getFrameCount() == 0) addSyntheticFrames(1);
+		std::vector<uint8_t> stream;
+		stream.reserve(size);
+		stream.resize(ZEROES, 0);
+		this->_damaged = 0;
+
+		size_t dataPacketSize = DataPacketView::getSize(this->_rawLength);
+		std::vector<uint8_t> packet(dataPacketSize);
+		uint64_t dataPackets = 0;
+		uint32_t sequenceNumber = 0;
+		uint64_t ticksSinceBoot = 0;
+		size_t frames = getFrameCount();
+		while(stream.size() < size)
+		{
+			if(dataPackets % BOOT_INTERVAL == 0) {
+				makeBootPacket(&packet[0]);
+				append(stream, &packet[0], BootPacketView::SIZE);
+				sequenceNumber = 0;
+				ticksSinceBoot = 0;
+			}
+			makeDataPacket(&packet[0], ++sequenceNumber, ticksSinceBoot, &this->_frames[(dataPackets % frames)*this->_rawLength]);
+			append(stream, &packet[0], dataPacketSize);
+			++dataPackets;
+			// About two swings a second
+			ticksSinceBoot += 6010;
+		}
+
+		// Chunk it as the logger would
+		log.clear();
+		log.reserve(stream.size() + stream.size()/MIN_CHUNK*2 + 2);
+		uint8_t length[2] = { (uint8_t)ZEROES, 0 };
+		log.insert(log.end(), length, length + 2);
+		log.insert(log.end(), stream.begin(), stream.begin() + ZEROES);
+		size_t at = ZEROES;
+		while(at < stream.size())
+		{
+			size_t c = MIN_CHUNK + this->_random.next() % (MAX_CHUNK - MIN_CHUNK + 1);
+			if(c > stream.size() - at) c = stream.size() - at;
+			length[0] = (uint8_t)(c & 0xFF);
+			length[1] = (uint8_t)(c >> 8);
+			log.insert(log.end(), length, length + 2);
+			log.insert(log.end(), stream.begin() + at, stream.begin() + at + c);
+			at += c;
+		}
+	}
+
+private:
+	// Adds a packet to the serial stream, damaged with probability _corruption
+	void append(std::vector<uint8_t> &stream, const uint8_t *packet, size_t n)
+	{
+		if(this->_corruption > 0 && this->_random.uniform() < this->_corruption) {
+			size_t begin = this->_random.next() % n;
+			size_t end = begin + 1 + this->_random.next() % (n - begin);
+			stream.insert(stream.end(), packet, packet + begin);
+			stream.insert(stream.end(), packet + end, packet + n);
+			++this->_damaged;
+			return;
+		}
+		stream.insert(stream.end(), packet, packet + n);
+	}
+
+	void makeBootPacket(uint8_t *packet)
+	{
+		std::memset(packet, 0, BootPacketView::SIZE);
+		putHeader(packet, PacketView::BOOT_PACKET);
+		putLE(packet + BootPacketView::SERIAL_NUMBER, 0x5EED, 4);
+		packet[BootPacketView::BMP_SENSOR_STATUS] = 1;
+		packet[BootPacketView::GPS_SERIAL_OK] = 1;
+		packet[BootPacketView::SENSOR_BLOCK_OK] = 1;
+		putBE(packet + BootPacketView::WEEK_NUMBER, 1860, 2);
+	}
+
+	void makeDataPacket(uint8_t *packet, uint32_t sequenceNumber, uint64_t ticksSinceBoot, const uint16_t *frame)
+	{
+		std::memset(packet, 0, DataPacketView::RAW);
+		putHeader(packet, PacketView::DATA_PACKET);
+		putLE(packet + DataPacketView::SEQUENCE_NUMBER, sequenceNumber, 4);
+		putLE(packet + DataPacketView::TIME_SINCE_LAST_BOOT_PACKET, ticksSinceBoot, 8);
+		putLE(packet + DataPacketView::HUMIDITY, 45*1024, 4);
+		putLE(packet + DataPacketView::PRESSURE, 101325, 4);
+		putLE(packet + DataPacketView::THERMISTOR, 32768, 2);
+		size_t rawPhase = this->_random.next() % this->_rawLength;
+		putLE(packet + DataPacketView::RAW_PHASE, rawPhase, 2);
+		packet[DataPacketView::RECIEVER_MODE] = 0x07;
+		uint8_t *raw = packet + DataPacketView::RAW;
+		for (size_t i = 0; i < this->_rawLength; ++i)
+		{
+			raw[(rawPhase + i) % this->_rawLength] = (uint8_t)(frame[i] & 0xFF);
+		}
+	}
+
+	static void putHeader(uint8_t *packet, uint8_t type)
+	{
+		packet[0] = packet[1] = packet[2] = PacketView::START_BYTE;
+		packet[PacketView::TYPE] = type;
+	}
+
+	static void putLE(uint8_t *p, uint64_t value, int n)
+	{
+		for (int i = 0; i < n; ++i) p[i] = (uint8_t)(value >> (8*i));
+	}
+
+	static void putBE(uint8_t *p, uint64_t value, int n)
+	{
+		for (int i = 0; i < n; ++i) p[n - 1 - i] = (uint8_t)(value >> (8*i));
+	}
+
+	Random _random;
+	size_t _rawLength;
+	double _corruption;
+	uint64_t _damaged;
+	// Frames back to back
+	std::vector<uint16_t> _frames;
+};
+
+#endif
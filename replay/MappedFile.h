@@ -0,0 +1,86 @@
+/*
+Read only memory map of a whole file
+
+The mapping is private and advised for sequential access, so the kernel reads
+ahead and pages can be dropped behind the reader.  An empty file maps to an
+empty range.
+*/
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class MappedFile
+{
+public:
+	MappedFile()
+	{
+		this->_data = 0;
+		this->_size = 0;
+	}
+
+	~MappedFile()
+	{
+		close();
+	}
+
+	// Returns false (with errno set) if the file cannot be opened or mapped
+	bool open(const char *filename)
+	{
+		close();
+		int fd = ::open(filename, O_RDONLY);
+		if(fd < 0) return false;
+		struct stat info;
+		if(fstat(fd, &info) < 0) {
+			::close(fd);
+			return false;
+		}
+		size_t size = (size_t)info.st_size;
+		if(size > 0) {
+			void *data = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(data == MAP_FAILED) {
+				::close(fd);
+				return false;
+			}
+			madvise(data, size, MADV_SEQUENTIAL);
+			this->_data = (const uint8_t *)data;
+		}
+		this->_size = size;
+		::close(fd);
+		return true;
+	}
+
+	void close()
+	{
+		if(this->_data) munmap((void *)this->_data, this->_size);
+		this->_data = 0;
+		this->_size = 0;
+	}
+
+	const uint8_t *getData() const
+	{
+		return this->_data;
+	}
+
+	size_t getSize() const
+	{
+		return this->_size;
+	}
+
+private:
+	// Not copyable: the mapping has a single owner
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+	const uint8_t *_data;
+	size_t _size;
+};
+
+#endif
@@ -0,0 +1,238 @@
+/*
+Sidecar index of a binaryPackets log
+
+A fixed size entry per packet records where the packet starts (so a
+PacketReader can seek() straight to it), its type, its data packet sequence
+number, its boot epoch (the number of boot packets up to and including it)
+and its reconstructed timestamp.  Entries are in log order, so a packet is
+found by its ordinal directly and by epoch, (epoch, sequence number) or time
+with a binary search.
+
+Timestamps follow node/logger.js: the boot packet's GPS week and whole second
+of week, plus 8.32e-5 s per ADC sample since then, counted in GPS seconds from
+the Unix epoch.  The 10 bit GPS week is unrolled to the latest cycle that
+does not put the boot after the log was last modified.  Packets before the
+first boot packet get a timestamp of zero.
+
+The index lives next to the log (<log>.idx) and update() extends it with
+the packets appended since it was last written, starting from the position
+and boot state saved in its header.
+*/
+
+#ifndef PACKETINDEX_H
+#define PACKETINDEX_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <sys/stat.h>
+
+#include "MappedFile.h"
+#include "PacketReader.h"
+#include "PacketViews.h"
+
+struct IndexEntry
+{
+	uint64_t offset;
+	uint32_t chunkRemaining;
+	uint32_t sequenceNumber;
+	uint32_t epoch;
+	uint8_t type;
+	uint8_t unused[3];
+	double timestamp;
+};
+
+struct IndexHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t rawLength;
+	// Log bytes covered and where to carry on from
+	uint64_t logSize;
+	uint64_t resumeOffset;
+	uint32_t resumeChunkRemaining;
+	uint32_t epoch;
+	double bootTime;
+	uint64_t entries;
+};
+
+class PacketIndex
+{
+public:
+	static const uint32_t VERSION = 1;
+
+	// GPS time origin (January 6, 1980) in Unix seconds, and the ADC sample period
+	static constexpr double GPS_EPOCH = 315964800;
+	static constexpr double SECONDS_PER_WEEK = 7*24*60*60;
+	static constexpr double SECONDS_PER_SAMPLE = 64*13/10e6;
+	static const uint32_t GPS_WEEK_NUMBER_ROLLOVER = 1024;
+
+	PacketIndex()
+	{
+		this->_entries = 0;
+		this->_count = 0;
+	}
+
+	// Creates or extends the index of the log and maps it.  Returns the number
+	// of new entries, or -1 on error.
+	long update(const char *logFilename, size_t rawLength)
+	{
+		this->_filename = std::string(logFilename) + ".idx";
+		this->_index.close();
+		this->_entries = 0;
+		this->_count = 0;
+
+		MappedFile log;
+		if(!log.open(logFilename)) return -1;
+		struct stat info;
+		double modified = (stat(logFilename, &info) == 0)?(double)info.st_mtime:0;
+
+		IndexHeader header;
+		FILE *out = std::fopen(this->_filename.c_str(), "r+b");
+		if(!out || std::fread(&header, sizeof(header), 1, out) != 1 || !isCompatible(header, rawLength, log.getSize())) {
+			// Start over
+			if(out) std::fclose(out);
+			out = std::fopen(this->_filename.c_str(), "w+b");
+			if(!out) return -1;
+			std::memset(&header, 0, sizeof(header));
+			std::memcpy(header.magic, "GEARSIDX", 8);
+			header.version = VERSION;
+			header.rawLength = (uint32_t)rawLength;
+			std::fwrite(&header, sizeof(header), 1, out);
+		}
+		std::fseek(out, sizeof(header) + header.entries*sizeof(IndexEntry), SEEK_SET);
+
+		PacketReader reader(log.getData(), log.getSize(), rawLength);
+		StreamPosition resume = { header.resumeOffset, header.resumeChunkRemaining };
+		reader.seek(resume);
+		long added = 0;
+		Packet packet;
+		IndexEntry entry;
+		std::memset(&entry, 0, sizeof(entry));
+		for (;;)
+		{
+			PacketReader::Status status = reader.next(packet);
+			if(status == PacketReader::BAD_HEADER) {
+				SkippedRegion skipped;
+				StreamPosition bad = reader.getPosition();
+				if(reader.resync(skipped)) continue;
+				// The next good packet may not be complete yet, so look again from here
+				reader.seek(bad);
+			}
+			if(status != PacketReader::PACKET) break;
+
+			entry.offset = packet.position.offset;
+			entry.chunkRemaining = packet.position.chunkRemaining;
+			entry.type = packet.type;
+			if(packet.type == PacketReader::BOOT_PACKET) {
+				++header.epoch;
+				header.bootTime = getBootTime(packet.data, modified);
+				entry.sequenceNumber = 0;
+				entry.timestamp = header.bootTime;
+			} else {
+				DataPacketView view(packet.data, rawLength);
+				entry.sequenceNumber = view.getSequenceNumber();
+				entry.timestamp = (header.bootTime > 0)?(header.bootTime + view.getTimeSinceLastBootPacket()*SECONDS_PER_SAMPLE):0;
+			}
+			entry.epoch = header.epoch;
+			std::fwrite(&entry, sizeof(entry), 1, out);
+			++added;
+		}
+
+		// A packet or chunk still being written, or damage with no good packet
+		// after it yet, is picked up next time
+		StreamPosition position = reader.getPosition();
+		header.resumeOffset = position.offset;
+		header.resumeChunkRemaining = position.chunkRemaining;
+		header.logSize = log.getSize();
+		header.entries += added;
+		std::fseek(out, 0, SEEK_SET);
+		std::fwrite(&header, sizeof(header), 1, out);
+		bool ok = !std::ferror(out);
+		ok = (std::fclose(out) == 0) && ok;
+		if(!ok || !this->_index.open(this->_filename.c_str())) return -1;
+
+		this->_entries = (const IndexEntry *)(this->_index.getData() + sizeof(header));
+		this->_count = header.entries;
+		return added;
+	}
+
+	uint64_t size() const
+	{
+		return this->_count;
+	}
+
+	const IndexEntry &operator[](uint64_t ordinal) const
+	{
+		return this->_entries[ordinal];
+	}
+
+	// Where to seek() a PacketReader to read the packet with this ordinal
+	StreamPosition getPosition(uint64_t ordinal) const
+	{
+		StreamPosition position = { this->_entries[ordinal].offset, this->_entries[ordinal].chunkRemaining };
+		return position;
+	}
+
+	// Where the next packet after the last indexed one starts, e.g. to carry on
+	// reading a log that is being written
+	StreamPosition getResumePosition() const
+	{
+		const IndexHeader *header = (const IndexHeader *)this->_index.getData();
+		StreamPosition position = { header->resumeOffset, header->resumeChunkRemaining };
+		return position;
+	}
+
+	// Ordinal of the first packet of the epoch, or size() if there is none
+	uint64_t findEpoch(uint32_t epoch) const
+	{
+		return std::lower_bound(this->_entries, this->_entries + this->_count, epoch,
+			[](const IndexEntry &e, uint32_t v) { return e.epoch < v; }) - this->_entries;
+	}
+
+	// Ordinal of the first packet at or after the sequence number within an epoch
+	uint64_t findSequenceNumber(uint32_t epoch, uint32_t sequenceNumber) const
+	{
+		return std::lower_bound(this->_entries, this->_entries + this->_count, std::make_pair(epoch, sequenceNumber),
+			[](const IndexEntry &e, const std::pair<uint32_t, uint32_t> &v) {
+				return e.epoch < v.first || (e.epoch == v.first && e.sequenceNumber < v.second);
+			}) - this->_entries;
+	}
+
+	// Ordinal of the first packet at or after the time
+	uint64_t findTime(double timestamp) const
+	{
+		return std::lower_bound(this->_entries, this->_entries + this->_count, timestamp,
+			[](const IndexEntry &e, double v) { return e.timestamp < v; }) - this->_entries;
+	}
+
+	// Whole GPS second of a boot packet, in Unix seconds, with the week unrolled
+	// to the latest cycle before the log was last modified
+	static double getBootTime(const uint8_t *packet, double modified)
+	{
+		BootPacketView view(packet);
+		uint32_t week = view.getWeekNumber() % GPS_WEEK_NUMBER_ROLLOVER;
+		double seconds = GPS_EPOCH + week*SECONDS_PER_WEEK + std::floor(view.getTimeOfWeek());
+		double cycle = GPS_WEEK_NUMBER_ROLLOVER*SECONDS_PER_WEEK;
+		while(seconds + cycle <= modified + SECONDS_PER_WEEK) seconds += cycle;
+		return seconds;
+	}
+
+private:
+	static bool isCompatible(const IndexHeader &header, size_t rawLength, uint64_t logSize)
+	{
+		return std::memcmp(header.magic, "GEARSIDX", 8) == 0 && header.version == VERSION &&
+			header.rawLength == rawLength && header.logSize <= logSize;
+	}
+
+	std::string _filename;
+	MappedFile _index;
+	const IndexEntry *_entries;
+	uint64_t _count;
+};
+
+#endif
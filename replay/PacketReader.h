@@ -0,0 +1,355 @@
+/*
+Packet reader for binaryPackets logs
+
+node/logger.js writes every chunk of serial data it receives as a 2 byte
+little endian length followed by the data, so packets can be split between
+chunks.  The reader walks this framing over a memory mapped log and hands out
+views of whole packets: a packet that lies within one chunk points straight
+into the mapping, and only packets that straddle chunks are assembled in a
+scratch buffer.  A view stays valid until the next call to next().
+
+After a bad header, resync() scans for the next start sequence (memchr over
+each chunk) that begins a plausible packet: a known type, an in range
+rawPhase for data packets, and either another start sequence or the end of
+the log right after it.  Logs appended to across logger restarts or damaged
+in places can then be read in one pass.
+
+The chunk framing is checked as well.  A serial read returns at most the 4 kB
+tty buffer and never nothing, so a header for more (or for none) is damage,
+and a chunk is only read if the header after it makes sense too.  Where that
+breaks (a damaged length, or a log cut short in the middle of a chunk and
+restarted), next() reports a bad header and resync() finds the framing again
+by scanning byte by byte for the next offset that starts a chain of
+FRAMING_CHAIN headers that make sense, then carries on from there.
+
+Packets start with three 0xFE bytes and a type byte: 0x00 for a boot packet
+(70 bytes) and 0x01 for a data packet (56 bytes plus CIRCULAR_BUFFER_LENGTH
+raw samples).  See mcu/packet.h and PacketViews.h for their fields.
+*/
+
+#ifndef PACKETREADER_H
+#define PACKETREADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "PacketViews.h"
+
+// Where the reader is in the log: the file offset of the next byte and the
+// number of bytes left in the current chunk (zero before a length header)
+struct StreamPosition
+{
+	uint64_t offset;
+	uint32_t chunkRemaining;
+};
+
+// Bytes passed over while resynchronizing, as file offsets [begin, end)
+// including any chunk framing in between
+struct SkippedRegion
+{
+	uint64_t begin;
+	uint64_t end;
+	uint64_t streamBytes;
+};
+
+struct Packet
+{
+	const uint8_t *data;
+	size_t size;
+	uint8_t type;
+	// Position of the packet's first byte, to come back to it with seek()
+	StreamPosition position;
+};
+
+class PacketReader
+{
+public:
+	static const uint8_t START_BYTE = PacketView::START_BYTE;
+	static const uint8_t BOOT_PACKET = PacketView::BOOT_PACKET;
+	static const uint8_t DATA_PACKET = PacketView::DATA_PACKET;
+	static const size_t HEADER_SIZE = PacketView::HEADER_SIZE;
+	static const size_t BOOT_PACKET_SIZE = BootPacketView::SIZE;
+	static const size_t RAW_START = DataPacketView::RAW;
+	static const uint32_t MAX_CHUNK_SIZE = 4096;
+	// Chunk headers that make sense in a row, to keep trusting the framing that
+	// has been read, and to take an offset of unknown bytes for the framing
+	// (about 1e-10 likely by chance)
+	static const int TRUSTED_CHAIN = 2;
+	static const int FRAMING_CHAIN = 8;
+
+	enum Status { PACKET, END, TRUNCATED, BAD_HEADER };
+
+	PacketReader(const uint8_t *data, size_t size, size_t rawLength)
+	{
+		this->_data = data;
+		this->_size = size;
+		this->_rawLength = rawLength;
+		this->_position.offset = 0;
+		this->_position.chunkRemaining = 0;
+		this->_streamBytes = 0;
+		this->_scratch.resize((RAW_START + rawLength > BOOT_PACKET_SIZE)?(RAW_START + rawLength):BOOT_PACKET_SIZE);
+	}
+
+	// Size of a packet of the given type, or zero for an unknown type
+	size_t getPacketSize(uint8_t type) const
+	{
+		if(type == BOOT_PACKET) return BOOT_PACKET_SIZE;
+		if(type == DATA_PACKET) return RAW_START + this->_rawLength;
+		return 0;
+	}
+
+	// Skips n bytes of serial data, e.g. the zeroes the logger writes first
+	bool skip(size_t n)
+	{
+		const uint8_t *unused;
+		while(n > 0)
+		{
+			if(!nextChunk()) return false;
+			size_t k = (n < this->_position.chunkRemaining)?n:this->_position.chunkRemaining;
+			if(!read(k, unused)) return false;
+			n -= k;
+		}
+		return true;
+	}
+
+	// Reads the next packet.  BAD_HEADER leaves the position at the bad header
+	// (or at the start of a packet that runs into a damaged chunk header) and
+	// fills packet with the bytes found there.
+	Status next(Packet &packet)
+	{
+		StreamPosition start = this->_position;
+		uint64_t streamBytes = this->_streamBytes;
+		if(!nextChunk()) return isMisframed()?misframed(packet, start, streamBytes):END;
+		start = this->_position;
+		const uint8_t *header;
+		if(!read(HEADER_SIZE, header)) {
+			if(isMisframed()) return misframed(packet, start, streamBytes);
+			seek(start);
+			this->_streamBytes = streamBytes;
+			return TRUNCATED;
+		}
+		packet.position = start;
+		packet.type = header[3];
+		size_t size = getPacketSize(header[3]);
+		if(header[0] != START_BYTE || header[1] != START_BYTE || header[2] != START_BYTE || size == 0) {
+			std::memmove(&this->_scratch[0], header, HEADER_SIZE);
+			packet.data = &this->_scratch[0];
+			packet.size = HEADER_SIZE;
+			seek(start);
+			this->_streamBytes = streamBytes;
+			return BAD_HEADER;
+		}
+		seek(start);
+		this->_streamBytes = streamBytes;
+		if(!read(size, packet.data)) {
+			if(isMisframed()) return misframed(packet, start, streamBytes);
+			seek(start);
+			this->_streamBytes = streamBytes;
+			return TRUNCATED;
+		}
+		packet.size = size;
+		return PACKET;
+	}
+
+	// Moves to the start of the next plausible packet after the current position,
+	// filling skipped with what was passed over.  Returns false at the end of the log.
+	bool resync(SkippedRegion &skipped)
+	{
+		uint64_t streamBytes = this->_streamBytes;
+		nextChunk();
+		skipped.begin = this->_position.offset;
+		bool found = false;
+		if(this->_position.chunkRemaining > 0 && !isFramed(this->_position.offset + this->_position.chunkRemaining, TRUSTED_CHAIN)) {
+			// Seeked into a chunk whose header was damaged: its length is not followed by another
+			this->_position.chunkRemaining = 0;
+		} else if(nextChunk()) {
+			advance(1);
+		}
+		for (;;)
+		{
+			if(!nextChunk()) {
+				if(!isMisframed()) break;
+				uint64_t header = findFraming(this->_position.offset);
+				this->_streamBytes += header - this->_position.offset;
+				this->_position.offset = header;
+				continue;
+			}
+			const uint8_t *p = this->_data + this->_position.offset;
+			size_t n = this->_position.chunkRemaining;
+			if(n > this->_size - this->_position.offset) n = this->_size - this->_position.offset;
+			const uint8_t *hit = (const uint8_t *)std::memchr(p, START_BYTE, n);
+			if(!hit) {
+				advance(n);
+				continue;
+			}
+			advance(hit - p);
+			if(isPlausible()) {
+				found = true;
+				break;
+			}
+			advance(1);
+		}
+		skipped.end = found?this->_position.offset:this->_size;
+		skipped.streamBytes = this->_streamBytes - streamBytes;
+		return found;
+	}
+
+	// Moves to the first plausible packet at or after the current position, e.g.
+	// after seeking into the middle of the log.  Returns false at the end of the log.
+	bool align()
+	{
+		if(!nextChunk() && !isMisframed()) return false;
+		if(this->_position.chunkRemaining > 0 && isFramed(this->_position.offset + this->_position.chunkRemaining, TRUSTED_CHAIN) &&
+			isPlausible()) return true;
+		SkippedRegion skipped;
+		return resync(skipped);
+	}
+
+	// Whether a chain of chunk headers that make sense starts at the file
+	// offset, or as many as there are before the end of the log
+	bool isFramed(uint64_t header, int chain) const
+	{
+		for (int i = 0; i < chain; ++i)
+		{
+			if(header + 2 > this->_size) return true;
+			uint32_t length = this->_data[header] | (this->_data[header + 1] << 8);
+			if(length == 0 || length > MAX_CHUNK_SIZE) return false;
+			header += 2 + length;
+		}
+		return true;
+	}
+
+	// File offset of the first chunk header at or after offset that starts a
+	// chain of FRAMING_CHAIN, or the size of the log if there is none
+	uint64_t findFraming(uint64_t offset) const
+	{
+		for (; offset + 2 <= this->_size; ++offset)
+		{
+			if(isFramed(offset, FRAMING_CHAIN)) return offset;
+		}
+		return this->_size;
+	}
+
+	StreamPosition getPosition() const
+	{
+		return this->_position;
+	}
+
+	void seek(StreamPosition position)
+	{
+		this->_position = position;
+	}
+
+	// Serial data bytes consumed, not counting the chunk framing
+	uint64_t getStreamBytes() const
+	{
+		return this->_streamBytes;
+	}
+
+	size_t getRawLength() const
+	{
+		return this->_rawLength;
+	}
+
+private:
+	// Steps over n bytes of the current chunk
+	void advance(size_t n)
+	{
+		this->_position.offset += n;
+		this->_position.chunkRemaining -= n;
+		this->_streamBytes += n;
+	}
+
+	// Whether a packet that makes sense starts at the current position, which is left unchanged
+	bool isPlausible()
+	{
+		StreamPosition start = this->_position;
+		uint64_t streamBytes = this->_streamBytes;
+		Packet packet;
+		bool plausible = (next(packet) == PACKET);
+		if(plausible && packet.type == DATA_PACKET) {
+			plausible = (DataPacketView(packet.data, this->_rawLength).getRawPhase() < this->_rawLength);
+		}
+		const uint8_t *following;
+		if(plausible && nextChunk() && read(3, following)) {
+			plausible = (following[0] == START_BYTE && following[1] == START_BYTE && following[2] == START_BYTE);
+		}
+		seek(start);
+		this->_streamBytes = streamBytes;
+		return plausible;
+	}
+
+	// Moves past a length header to the next data byte.  Stops at the end of the
+	// log or at a header that is damaged (see isMisframed()).
+	bool nextChunk()
+	{
+		if(this->_position.chunkRemaining == 0) {
+			if(this->_position.offset + 2 > this->_size) return false;
+			if(!isFramed(this->_position.offset, TRUSTED_CHAIN)) return false;
+			const uint8_t *p = this->_data + this->_position.offset;
+			this->_position.chunkRemaining = p[0] | (p[1] << 8);
+			this->_position.offset += 2;
+		}
+		return this->_position.offset < this->_size;
+	}
+
+	// Whether nextChunk() stopped at a damaged header rather than at the end of the log
+	bool isMisframed() const
+	{
+		return this->_position.chunkRemaining == 0 && this->_position.offset + 2 <= this->_size;
+	}
+
+	// BAD_HEADER at start, for a packet that runs into a damaged chunk header
+	Status misframed(Packet &packet, StreamPosition start, uint64_t streamBytes)
+	{
+		size_t n = this->_size - start.offset;
+		if(n > HEADER_SIZE) n = HEADER_SIZE;
+		std::memmove(&this->_scratch[0], this->_data + start.offset, n);
+		packet.data = &this->_scratch[0];
+		packet.size = n;
+		packet.type = (n > 3)?packet.data[3]:0;
+		packet.position = start;
+		seek(start);
+		this->_streamBytes = streamBytes;
+		return BAD_HEADER;
+	}
+
+	// Points out at the next n bytes of serial data, copying only if they straddle chunks
+	bool read(size_t n, const uint8_t *&out)
+	{
+		if(!nextChunk()) return false;
+		if(this->_position.chunkRemaining >= n && this->_position.offset + n <= this->_size) {
+			out = this->_data + this->_position.offset;
+			this->_position.offset += n;
+			this->_position.chunkRemaining -= n;
+			this->_streamBytes += n;
+			return true;
+		}
+		size_t got = 0;
+		while(got < n)
+		{
+			if(!nextChunk()) return false;
+			size_t k = n - got;
+			if(k > this->_position.chunkRemaining) k = this->_position.chunkRemaining;
+			if(this->_position.offset + k > this->_size) return false;
+			std::memcpy(&this->_scratch[got], this->_data + this->_position.offset, k);
+			this->_position.offset += k;
+			this->_position.chunkRemaining -= k;
+			got += k;
+		}
+		this->_streamBytes += n;
+		out = &this->_scratch[0];
+		return true;
+	}
+
+	const uint8_t *_data;
+	size_t _size;
+	size_t _rawLength;
+	StreamPosition _position;
+	uint64_t _streamBytes;
+	std::vector<uint8_t> _scratch;
+};
+
+#endif
@@ -0,0 +1,314 @@
+/*
+Typed views of boot and data packets
+
+A view wraps the bytes of a whole packet, three start bytes and type
+included, where a PacketReader found them, and decodes fields on access
+without copying the packet into a struct.  Field offsets follow the AVR's
+packed BootPacket and DataPacket structs in mcu/packet.h, which are checked
+here at compile time against a packed host build of the same header.  The raw
+sample buffer is the one variable length part, so a data packet view takes
+CIRCULAR_BUFFER_LENGTH at run time.
+
+Byte order is that of node/logger.js: the AVR stores its own fields little
+endian, while the GPS fields copied from Trimble TSIP reports stay big
+endian: the position, UTC offset and time of a boot packet, and the alarms
+and clock offset of a data packet.  The GPS timing fields at the start of a
+data packet (gpsAlarms to timeOfWeek) are never filled by the firmware, so
+they are always zero and logger.js skips them; they are read little endian,
+as the AVR would store them.
+*/
+
+#ifndef PACKETVIEWS_H
+#define PACKETVIEWS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+
+// Compile the firmware's structs on the host with the AVR's 1 byte packing,
+// and drop the header's macros, which clash with names here
+#pragma pack(push, 1)
+#ifndef CIRCULAR_BUFFER_LENGTH
+#define CIRCULAR_BUFFER_LENGTH 1
+#define PACKETVIEWS_BUFFER_LENGTH
+#endif
+#include "../mcu/packet.h"
+#ifdef PACKETVIEWS_BUFFER_LENGTH
+#undef CIRCULAR_BUFFER_LENGTH
+#undef PACKETVIEWS_BUFFER_LENGTH
+#endif
+#pragma pack(pop)
+#undef START_BYTE
+#undef BOOT_PACKET
+#undef DATA_PACKET
+#undef TSIP_START_BYTE
+#undef TSIP_STOP_BYTE1
+#undef TSIP_STOP_BYTE2
+
+#if __cplusplus >= 202002L
+typedef std::span<const uint8_t> ByteSpan;
+#else
+// The part of std::span used here
+class ByteSpan
+{
+public:
+	ByteSpan(const uint8_t *data, size_t size)
+	{
+		this->_data = data;
+		this->_size = size;
+	}
+
+	const uint8_t *data() const
+	{
+		return this->_data;
+	}
+
+	size_t size() const
+	{
+		return this->_size;
+	}
+
+	const uint8_t &operator[](size_t i) const
+	{
+		return this->_data[i];
+	}
+
+	const uint8_t *begin() const
+	{
+		return this->_data;
+	}
+
+	const uint8_t *end() const
+	{
+		return this->_data + this->_size;
+	}
+
+private:
+	const uint8_t *_data;
+	size_t _size;
+};
+#endif
+
+// Field access shared by both views
+class PacketView
+{
+public:
+	static const uint8_t START_BYTE = 0xFE;
+	static const uint8_t BOOT_PACKET = 0x00;
+	static const uint8_t DATA_PACKET = 0x01;
+	static const size_t TYPE = 3;
+	static const size_t HEADER_SIZE = 4;
+
+	explicit PacketView(const uint8_t *data)
+	{
+		this->_data = data;
+	}
+
+	const uint8_t *getData() const
+	{
+		return this->_data;
+	}
+
+	uint8_t getType() const
+	{
+		return this->_data[TYPE];
+	}
+
+protected:
+	uint64_t getLE(size_t offset, int n) const
+	{
+		uint64_t value = 0;
+		for (int i = n - 1; i >= 0; --i) value = (value << 8) | this->_data[offset + i];
+		return value;
+	}
+
+	uint64_t getBE(size_t offset, int n) const
+	{
+		uint64_t value = 0;
+		for (int i = 0; i < n; ++i) value = (value << 8) | this->_data[offset + i];
+		return value;
+	}
+
+	float getFloatBE(size_t offset) const
+	{
+		uint32_t bits = (uint32_t)getBE(offset, 4);
+		float value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	double getDoubleBE(size_t offset) const
+	{
+		uint64_t bits = getBE(offset, 8);
+		double value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	const uint8_t *_data;
+};
+
+class BootPacketView : public PacketView
+{
+public:
+	enum Field
+	{
+		SERIAL_NUMBER = 4,
+		BMP_SENSOR_STATUS = 8,
+		GPS_SERIAL_OK = 9,
+		SENSOR_BLOCK_OK = 10,
+		COMMIT_TIMESTAMP = 11,
+		COMMIT_ID = 15,
+		COMMIT_STATUS = 35,
+		LATITUDE = 36,
+		LONGITUDE = 44,
+		ALTITUDE = 52,
+		UTC_OFFSET = 60,
+		WEEK_NUMBER = 64,
+		TIME_OF_WEEK = 66,
+		SIZE = 70
+	};
+	static const size_t COMMIT_ID_SIZE = 20;
+
+	explicit BootPacketView(const uint8_t *data) : PacketView(data)
+	{
+	}
+
+	uint32_t getSerialNumber() const { return (uint32_t)getLE(SERIAL_NUMBER, 4); }
+	uint8_t getBmpSensorStatus() const { return this->_data[BMP_SENSOR_STATUS]; }
+	uint8_t getGpsSerialOk() const { return this->_data[GPS_SERIAL_OK]; }
+	uint8_t getSensorBlockOk() const { return this->_data[SENSOR_BLOCK_OK]; }
+	// Unix seconds
+	uint32_t getCommitTimestamp() const { return (uint32_t)getLE(COMMIT_TIMESTAMP, 4); }
+	ByteSpan getCommitId() const { return ByteSpan(this->_data + COMMIT_ID, COMMIT_ID_SIZE); }
+	uint8_t getCommitStatus() const { return this->_data[COMMIT_STATUS]; }
+	// Radians
+	double getLatitude() const { return getDoubleBE(LATITUDE); }
+	double getLongitude() const { return getDoubleBE(LONGITUDE); }
+	// Meters
+	double getAltitude() const { return getDoubleBE(ALTITUDE); }
+	// GPS - UTC, in seconds
+	float getUtcOffset() const { return getFloatBE(UTC_OFFSET); }
+	uint16_t getWeekNumber() const { return (uint16_t)getBE(WEEK_NUMBER, 2); }
+	float getTimeOfWeek() const { return getFloatBE(TIME_OF_WEEK); }
+};
+
+class DataPacketView : public PacketView
+{
+public:
+	enum Field
+	{
+		SEQUENCE_NUMBER = 4,
+		GPS_ALARMS = 8,
+		GPS_STATUS = 10,
+		UTC_OFFSET = 12,
+		WEEK_NUMBER = 14,
+		TIME_OF_WEEK = 16,
+		TIME_SINCE_LAST_BOOT_PACKET = 20,
+		HUMIDITY = 28,
+		PRESSURE = 32,
+		THERMISTOR = 36,
+		TEMPERATURE = 38,
+		IR_LEVEL = 40,
+		RAW_PHASE = 42,
+		RECIEVER_MODE = 44,
+		DISCIPLINING_MODE = 45,
+		CRITICAL_ALARMS = 46,
+		MINOR_ALARMS = 48,
+		GPS_DECODING_STATUS = 50,
+		DISCIPLINING_ACTIVITY = 51,
+		CLOCK_OFFSET = 52,
+		RAW = 56
+	};
+
+	DataPacketView(const uint8_t *data, size_t rawLength) : PacketView(data)
+	{
+		this->_rawLength = rawLength;
+	}
+
+	// Whole packet size for a CIRCULAR_BUFFER_LENGTH
+	static size_t getSize(size_t rawLength)
+	{
+		return RAW + rawLength;
+	}
+
+	uint32_t getSequenceNumber() const { return (uint32_t)getLE(SEQUENCE_NUMBER, 4); }
+	// Never filled by the firmware, so zero
+	uint16_t getGpsAlarms() const { return (uint16_t)getLE(GPS_ALARMS, 2); }
+	uint16_t getGpsStatus() const { return (uint16_t)getLE(GPS_STATUS, 2); }
+	int16_t getUtcOffset() const { return (int16_t)getLE(UTC_OFFSET, 2); }
+	uint16_t getWeekNumber() const { return (uint16_t)getLE(WEEK_NUMBER, 2); }
+	uint32_t getTimeOfWeek() const { return (uint32_t)getLE(TIME_OF_WEEK, 4); }
+	// ADC conversions (64*13/10MHz = 8.32e-5 s) since the last boot packet
+	uint64_t getTimeSinceLastBootPacket() const { return getLE(TIME_SINCE_LAST_BOOT_PACKET, 8); }
+	// /1024 for percent
+	uint32_t getHumidity() const { return (uint32_t)getLE(HUMIDITY, 4); }
+	// Pascals
+	uint32_t getPressure() const { return (uint32_t)getLE(PRESSURE, 4); }
+	uint16_t getThermistor() const { return (uint16_t)getLE(THERMISTOR, 2); }
+	// /500 + 24 for degrees C
+	int16_t getTemperature() const { return (int16_t)getLE(TEMPERATURE, 2); }
+	uint16_t getIrLevel() const { return (uint16_t)getLE(IR_LEVEL, 2); }
+	// Index in raw of the oldest sample
+	uint16_t getRawPhase() const { return (uint16_t)getLE(RAW_PHASE, 2); }
+	uint8_t getRecieverMode() const { return this->_data[RECIEVER_MODE]; }
+	uint8_t getDiscipliningMode() const { return this->_data[DISCIPLINING_MODE]; }
+	uint16_t getCriticalAlarms() const { return (uint16_t)getBE(CRITICAL_ALARMS, 2); }
+	uint16_t getMinorAlarms() const { return (uint16_t)getBE(MINOR_ALARMS, 2); }
+	uint8_t getGpsDecodingStatus() const { return this->_data[GPS_DECODING_STATUS]; }
+	uint8_t getDiscipliningActivity() const { return this->_data[DISCIPLINING_ACTIVITY]; }
+	float getClockOffset() const { return getFloatBE(CLOCK_OFFSET); }
+	// Low 8 bits of each ADC reading, as a circular buffer starting at getRawPhase()
+	ByteSpan getRaw() const { return ByteSpan(this->_data + RAW, this->_rawLength); }
+
+private:
+	size_t _rawLength;
+};
+
+static_assert(sizeof(BootPacket) == BootPacketView::SIZE, "BootPacket size");
+static_assert(offsetof(BootPacket, type) == PacketView::TYPE, "BootPacket.type");
+static_assert(offsetof(BootPacket, serialNumber) == BootPacketView::SERIAL_NUMBER, "BootPacket.serialNumber");
+static_assert(offsetof(BootPacket, bmpSensorStatus) == BootPacketView::BMP_SENSOR_STATUS, "BootPacket.bmpSensorStatus");
+static_assert(offsetof(BootPacket, gpsSerialOk) == BootPacketView::GPS_SERIAL_OK, "BootPacket.gpsSerialOk");
+static_assert(offsetof(BootPacket, sensorBlockOK) == BootPacketView::SENSOR_BLOCK_OK, "BootPacket.sensorBlockOK");
+static_assert(offsetof(BootPacket, commitTimestamp) == BootPacketView::COMMIT_TIMESTAMP, "BootPacket.commitTimestamp");
+static_assert(offsetof(BootPacket, commitID) == BootPacketView::COMMIT_ID, "BootPacket.commitID");
+static_assert(sizeof(((BootPacket *)0)->commitID) == BootPacketView::COMMIT_ID_SIZE, "BootPacket.commitID size");
+static_assert(offsetof(BootPacket, commitStatus) == BootPacketView::COMMIT_STATUS, "BootPacket.commitStatus");
+static_assert(offsetof(BootPacket, latitude) == BootPacketView::LATITUDE, "BootPacket.latitude");
+static_assert(offsetof(BootPacket, longitude) == BootPacketView::LONGITUDE, "BootPacket.longitude");
+static_assert(offsetof(BootPacket, altitude) == BootPacketView::ALTITUDE, "BootPacket.altitude");
+static_assert(offsetof(BootPacket, utcOffset) == BootPacketView::UTC_OFFSET, "BootPacket.utcOffset");
+static_assert(offsetof(BootPacket, weekNumber) == BootPacketView::WEEK_NUMBER, "BootPacket.weekNumber");
+static_assert(offsetof(BootPacket, timeOfWeek) == BootPacketView::TIME_OF_WEEK, "BootPacket.timeOfWeek");
+
+static_assert(offsetof(DataPacket, type) == PacketView::TYPE, "DataPacket.type");
+static_assert(offsetof(DataPacket, sequenceNumber) == DataPacketView::SEQUENCE_NUMBER, "DataPacket.sequenceNumber");
+static_assert(offsetof(DataPacket, gpsAlarms) == DataPacketView::GPS_ALARMS, "DataPacket.gpsAlarms");
+static_assert(offsetof(DataPacket, gpsStatus) == DataPacketView::GPS_STATUS, "DataPacket.gpsStatus");
+static_assert(offsetof(DataPacket, utcOffset) == DataPacketView::UTC_OFFSET, "DataPacket.utcOffset");
+static_assert(offsetof(DataPacket, weekNumber) == DataPacketView::WEEK_NUMBER, "DataPacket.weekNumber");
+static_assert(offsetof(DataPacket, timeOfWeek) == DataPacketView::TIME_OF_WEEK, "DataPacket.timeOfWeek");
+static_assert(offsetof(DataPacket, timeSinceLastBootPacket) == DataPacketView::TIME_SINCE_LAST_BOOT_PACKET,
+	"DataPacket.timeSinceLastBootPacket");
+static_assert(offsetof(DataPacket, humidity) == DataPacketView::HUMIDITY, "DataPacket.humidity");
+static_assert(offsetof(DataPacket, pressure) == DataPacketView::PRESSURE, "DataPacket.pressure");
+static_assert(offsetof(DataPacket, thermistor) == DataPacketView::THERMISTOR, "DataPacket.thermistor");
+static_assert(offsetof(DataPacket, temperature) == DataPacketView::TEMPERATURE, "DataPacket.temperature");
+static_assert(offsetof(DataPacket, irLevel) == DataPacketView::IR_LEVEL, "DataPacket.irLevel");
+static_assert(offsetof(DataPacket, rawPhase) == DataPacketView::RAW_PHASE, "DataPacket.rawPhase");
+static_assert(offsetof(DataPacket, recieverMode) == DataPacketView::RECIEVER_MODE, "DataPacket.recieverMode");
+static_assert(offsetof(DataPacket, discipliningMode) == DataPacketView::DISCIPLINING_MODE, "DataPacket.discipliningMode");
+static_assert(offsetof(DataPacket, criticalAlarms) == DataPacketView::CRITICAL_ALARMS, "DataPacket.criticalAlarms");
+static_assert(offsetof(DataPacket, minorAlarms) == DataPacketView::MINOR_ALARMS, "DataPacket.minorAlarms");
+static_assert(offsetof(DataPacket, gpsDecodingStatus) == DataPacketView::GPS_DECODING_STATUS, "DataPacket.gpsDecodingStatus");
+static_assert(offsetof(DataPacket, discipliningActivity) == DataPacketView::DISCIPLINING_ACTIVITY,
+	"DataPacket.discipliningActivity");
+static_assert(offsetof(DataPacket, clockOffset) == DataPacketView::CLOCK_OFFSET, "DataPacket.clockOffset");
+static_assert(offsetof(DataPacket, raw) == DataPacketView::RAW, "DataPacket.raw");
+
+#endif
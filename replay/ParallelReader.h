@@ -0,0 +1,178 @@
+/*
+Parallel decoding of a binaryPackets log
+
+The log is cut into byte ranges that start on chunk length headers, found by
+one walk along the chain of headers (a few bytes read per chunk).  Where a header
+is damaged the walk picks the framing up again as PacketReader::resync() does,
+so the ranges after it still start on headers.  Each range is
+then read on a thread pool by its own PacketReader: it aligns on the first
+plausible packet (see PacketReader::align()) and reads every packet that starts
+before the next range, finishing the last one across the boundary.
+
+A range that aligned on the wrong bytes, e.g. a start sequence inside the raw
+samples of a packet straddling the boundary, is caught when the ranges are
+joined: the previous range ends on the packet it would have read next, which
+must be where this range started.  If not, the range is read again from there,
+so the packets and skipped regions handed out are exactly those of a single
+sequential pass.
+
+Callbacks for one range are made from one thread in log order, so per range
+results need no locking and are merged back in order by concatenating them.
+*/
+
+#ifndef PARALLELREADER_H
+#define PARALLELREADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "PacketReader.h"
+#include "ThreadPool.h"
+
+class ParallelReader
+{
+public:
+	typedef std::function<void(size_t, const Packet &)> Visit;
+	typedef std::function<void(size_t, const SkippedRegion &)> Skip;
+	// Throws away what a range handed out before it is read again
+	typedef std::function<void(size_t)> Reset;
+
+	static const uint64_t NONE = UINT64_MAX;
+
+	// Splits the log after start (a position from a PacketReader, e.g. past the
+	// leading zeroes) into at most the given number of ranges
+	ParallelReader(const uint8_t *data, size_t size, size_t rawLength, StreamPosition start, size_t ranges)
+	{
+		this->_data = data;
+		this->_size = size;
+		this->_rawLength = rawLength;
+		if(ranges == 0) ranges = 1;
+
+		Range range;
+		range.begin = start;
+		this->_ranges.push_back(range);
+		PacketReader framing(data, size, rawLength);
+		uint64_t header = start.offset + start.chunkRemaining;
+		for (size_t k = 1; k < ranges; ++k)
+		{
+			uint64_t target = start.offset + (size - start.offset)*k/ranges;
+			while(header < target && header + 2 <= size)
+			{
+				if(!framing.isFramed(header, PacketReader::TRUSTED_CHAIN)) {
+					header = framing.findFraming(header);
+					continue;
+				}
+				header += 2 + (data[header] | (data[header + 1] << 8));
+			}
+			if(header + 2 > size) break;
+			if(header == this->_ranges.back().begin.offset) continue;
+			range.begin.offset = header;
+			range.begin.chunkRemaining = 0;
+			this->_ranges.back().end = header;
+			this->_ranges.push_back(range);
+		}
+		this->_ranges.back().end = NONE;
+	}
+
+	size_t size() const
+	{
+		return this->_ranges.size();
+	}
+
+	// Bytes from the start of range k to the start of the next, an upper bound
+	// on the bytes taken by the packets that start in it
+	uint64_t getRangeBytes(size_t k) const
+	{
+		uint64_t end = (this->_ranges[k].end == NONE)?this->_size:this->_ranges[k].end;
+		return end - this->_ranges[k].begin.offset;
+	}
+
+	// Reads the log, calling visit for every packet and skip for every damaged
+	// region, both with the index of the range they belong to.  Returns END, or
+	// TRUNCATED if the log ends in the middle of a packet.
+	PacketReader::Status run(ThreadPool &pool, Visit visit, Skip skip, Reset reset)
+	{
+		pool.run(this->_ranges.size(), [&](size_t k, unsigned) {
+			decode(k, this->_ranges[k].begin, k == 0, visit, skip);
+		});
+		for (size_t k = 1; k < this->_ranges.size(); ++k)
+		{
+			const Range &previous = this->_ranges[k - 1];
+			if(previous.next == this->_ranges[k].first) continue;
+			reset(k);
+			decode(k, previous.stop, true, visit, skip);
+		}
+		return this->_ranges.back().status;
+	}
+
+	// Where reading stopped
+	StreamPosition getPosition() const
+	{
+		return this->_ranges.back().stop;
+	}
+
+private:
+	struct Range
+	{
+		StreamPosition begin;
+		// File offset of the next range's chunk header, NONE for the last range
+		uint64_t end;
+		// Offsets of the range's first packet (or bad header) and of the one after
+		// its last, NONE if there is none before the end of the log
+		uint64_t first;
+		uint64_t next;
+		StreamPosition stop;
+		PacketReader::Status status;
+	};
+
+	// Reads range k starting at from, which is a packet boundary if aligned
+	void decode(size_t k, StreamPosition from, bool aligned, Visit &visit, Skip &skip)
+	{
+		Range &range = this->_ranges[k];
+		PacketReader reader(this->_data, this->_size, this->_rawLength);
+		reader.seek(from);
+		range.first = NONE;
+		range.next = NONE;
+		range.status = PacketReader::END;
+		if(!aligned && !reader.align()) {
+			range.stop = reader.getPosition();
+			return;
+		}
+		Packet packet;
+		for (;;)
+		{
+			PacketReader::Status status = reader.next(packet);
+			if(status == PacketReader::END || status == PacketReader::TRUNCATED) {
+				range.stop = reader.getPosition();
+				range.status = status;
+				return;
+			}
+			if(range.first == NONE) range.first = packet.position.offset;
+			if(packet.position.offset >= range.end) {
+				range.next = packet.position.offset;
+				range.stop = packet.position;
+				return;
+			}
+			if(status == PacketReader::BAD_HEADER) {
+				SkippedRegion skipped;
+				bool found = reader.resync(skipped);
+				skip(k, skipped);
+				if(!found) {
+					range.stop = reader.getPosition();
+					return;
+				}
+				continue;
+			}
+			visit(k, packet);
+		}
+	}
+
+	const uint8_t *_data;
+	size_t _size;
+	size_t _rawLength;
+	std::vector<Range> _ranges;
+};
+
+#endif
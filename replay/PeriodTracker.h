@@ -0,0 +1,121 @@
+/*
+Pendulum periods from fitted frames
+
+A port of the bookkeeping of FrameProcessor.process() in fit/frameProcessor.py.
+Frames alternate in direction, and the period of a frame is the time since the
+fiducial crossing of the frame before last, which went the same way: the
+difference of the samplesSinceBoot of the two frames plus that of their
+fitted crossings, in ADC ticks.  The amplitude of a swing comes from the
+duration of a template fit (see TemplateFit.h), converted with the width of
+the fiducial and the length of the pendulum, and the swing is the sum of the
+amplitudes of two consecutive frames.
+
+A period is kept as fit.py keeps it: within 0.1 seconds of 2 and with a
+positive swing.  Without a template there is no swing to check, and the
+period is kept on its own, while a frame whose template fit failed has no
+amplitude and its period and the next are dropped.  Frames that were not quick fitted, which make the
+Python raise, are not added.
+*/
+
+#ifndef PERIODTRACKER_H
+#define PERIODTRACKER_H
+
+#include <cmath>
+#include <cstdint>
+
+#include "QuickFit.h"
+#include "TemplateFit.h"
+
+struct PeriodResult
+{
+	// Seconds, 0 before two frames are seen and -1 if the direction did not
+	// alternate
+	double period;
+	// Degrees peak to peak, 0 if unknown and -1 with the period
+	double swing;
+	// Degrees, NAN without a template fit
+	double amplitude;
+	// Within 0.1 seconds of NOMINAL_PERIOD, with a positive swing if template
+	// fitted
+	bool kept;
+};
+
+class PeriodTracker
+{
+public:
+	// fit.py --adc-tick, --width and --length
+	static constexpr double DEFAULT_ADC_TICK = 832e-7;
+	static constexpr double DEFAULT_WIDTH = 54;
+	static constexpr double DEFAULT_LENGTH = 1020;
+	// Seconds, from one crossing to the next in the same direction
+	static constexpr double NOMINAL_PERIOD = 2;
+
+	PeriodTracker(double adcTick = DEFAULT_ADC_TICK, double width = DEFAULT_WIDTH, double length = DEFAULT_LENGTH)
+	{
+		this->_adcTick = adcTick;
+		this->_width = width;
+		this->_length = length;
+		this->_lastPeriod = NOMINAL_PERIOD;
+		this->_frames = 0;
+		this->_lastDirection = 0;
+		this->_lastOffset = this->_nextLastOffset = 0;
+		this->_lastSamplesSinceBoot = this->_nextLastSamplesSinceBoot = 0;
+		this->_lastAmplitude = NAN;
+	}
+
+	// Adds a quick fitted frame, with its template fit if there is one.  The
+	// crossing is the template fit's if it converged.
+	PeriodResult add(uint64_t samplesSinceBoot, const QuickFitResult &quick, const TemplateFitResult *fit = NULL)
+	{
+		PeriodResult result;
+		double offset = quick.t0;
+		result.amplitude = NAN;
+		if(fit && fit->status == TemplateFitter::FIT) {
+			offset = fit->t0;
+			// mm/sec
+			double velocity = 0.5*this->_width/(fit->duration*this->_adcTick);
+			double cosTheta = 1 - 0.5*std::pow(velocity*this->_lastPeriod/(2*M_PI*this->_length), 2);
+			result.amplitude = std::acos(cosTheta)*180/M_PI;
+		}
+		if(this->_frames == 0 || quick.direction != this->_lastDirection) {
+			// Python's truth values of the samplesSinceBoot and offset two frames back
+			if(this->_nextLastSamplesSinceBoot != 0 && this->_lastOffset != 0) {
+				result.period = ((double)samplesSinceBoot - (double)this->_nextLastSamplesSinceBoot -
+					this->_lastOffset + offset)*this->_adcTick;
+			} else {
+				result.period = 0;
+			}
+			result.swing = (std::isnan(result.amplitude) || std::isnan(this->_lastAmplitude))?0:
+				result.amplitude + this->_lastAmplitude;
+		} else {
+			result.period = -1;
+			result.swing = -1;
+		}
+		this->_lastDirection = quick.direction;
+		this->_lastOffset = this->_nextLastOffset;
+		this->_nextLastOffset = offset;
+		this->_nextLastSamplesSinceBoot = this->_lastSamplesSinceBoot;
+		this->_lastSamplesSinceBoot = samplesSinceBoot;
+		this->_lastAmplitude = result.amplitude;
+		++this->_frames;
+		result.kept = std::fabs(result.period - NOMINAL_PERIOD) < 0.1 && (!fit || result.swing > 0);
+		if(result.kept) this->_lastPeriod = result.period;
+		return result;
+	}
+
+private:
+	double _adcTick;
+	double _width;
+	double _length;
+	// The last period kept, for the amplitude
+	double _lastPeriod;
+	uint64_t _frames;
+	double _lastDirection;
+	double _lastOffset;
+	double _nextLastOffset;
+	uint64_t _lastSamplesSinceBoot;
+	uint64_t _nextLastSamplesSinceBoot;
+	double _lastAmplitude;
+};
+
+#endif
@@ -0,0 +1,391 @@
+/*
+Quick fit of reconstituted frames
+
+A port of Frame.quickFit() in fit/frame.py, step for step, so that it gives
+the same direction, levels and edge times: a running average over
+1 + 2*smoothing samples, the lo, mid and hi levels from the peaks of a 1023
+bin histogram of the smoothed frame, the edges where it crosses halfway
+between lo and hi, and a straight line fit to 1 + 2*fitsize samples around
+each edge for its subsample time.  Quirks of the Python are kept, e.g. the
+peak search compares the first histogram slope with the last one, fewer than
+three peaks leave zero levels, and the rising edge mask is written one sample
+off.  Where the Python raises, the fit returns a Status instead.
+
+The running average is a difference of integer prefix sums, so it is exact
+(as numpy's is for integer samples).  Only the line fits can differ from
+scipy's linregress, in the last bits.
+
+A QuickFitter keeps its scratch buffers between frames: use one per thread.
+fitAll() fits whole frame arenas on a thread pool, a batch of frames at a time.
+*/
+
+#ifndef QUICKFIT_H
+#define QUICKFIT_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Reconstituter.h"
+#include "ThreadPool.h"
+
+struct QuickFitResult
+{
+	static const int MAX_FINGERS = 8;
+
+	// A QuickFitter::Status
+	int32_t status;
+	// Edges found, which must be nfingers each
+	int32_t rising;
+	int32_t falling;
+	// +1 or -1
+	double direction;
+	// ADC levels
+	double lo;
+	double hi;
+	double height;
+	// Fiducial crossing, in samples from the start of the frame
+	double t0;
+	// Edge times relative to t0, corrected for the direction of travel
+	double rise[MAX_FINGERS];
+	double fall[MAX_FINGERS];
+};
+
+class QuickFitter
+{
+public:
+	enum Status
+	{
+		FIT,
+		// Weights sum to zero around a histogram peak (ZeroDivisionError)
+		NO_LEVEL,
+		// Not nfingers rising or falling edges (RuntimeError)
+		RISING_EDGES,
+		FALLING_EDGES,
+		// An edge too close to either end of the frame for its line fit (ValueError)
+		EDGE_AT_END
+	};
+
+	static const int BINS = 1023;
+	static const int PEAKS = 3;
+	static const int PEAK_WINDOW = 10;
+	static const int MAX_HEIGHT_THRESHOLD = 40;
+	static const int MIN_HEIGHT_THRESHOLD = 1;
+	static const int EDGE_THRESHOLD = 2;
+	// fit.py --nfingers
+	static const int DEFAULT_FINGERS = 5;
+	static const size_t HISTOGRAMS = 4;
+	// Frames per task in fitAll()
+	static const size_t BATCH_FRAMES = 64;
+
+	// nfingers is between 3 (the third edges give t0) and MAX_FINGERS
+	QuickFitter(size_t nsamples, int nfingers = DEFAULT_FINGERS, int smoothing = 15, int fitsize = 5)
+	{
+		this->_nsamples = nsamples;
+		this->_nfingers = std::max(3, std::min(nfingers, (int)QuickFitResult::MAX_FINGERS));
+		this->_smoothing = smoothing;
+		this->_fitsize = fitsize;
+		this->_prefix.resize(nsamples + 2*smoothing + 1);
+		this->_smooth.resize(nsamples);
+		this->_above.resize(nsamples);
+		this->_near.resize(nsamples);
+		this->_riseMask.resize(nsamples);
+		this->_counts.resize(HISTOGRAMS*BINS);
+	}
+
+	int getFingers() const
+	{
+		return this->_nfingers;
+	}
+
+	Status fit(const uint16_t *samples, QuickFitResult &result)
+	{
+		size_t n = this->_nsamples;
+		int nfingers = this->_nfingers;
+		result.rising = result.falling = 0;
+		std::fill(result.rise, result.rise + QuickFitResult::MAX_FINGERS, NAN);
+		std::fill(result.fall, result.fall + QuickFitResult::MAX_FINGERS, NAN);
+		smooth(samples);
+
+		// Levels
+		double levels[PEAKS];
+		if(!findPeakValues(levels)) return finish(result, NO_LEVEL);
+		double lo = levels[0], height = levels[1], hi = levels[2];
+		result.lo = lo;
+		result.hi = hi;
+		result.height = height;
+		double mid = 0.5*(lo + hi);
+		double *s = &this->_smooth[0];
+		for (size_t i = 0; i < n; ++i) s[i] -= mid;
+
+		// Edges, where the smoothed frame crosses mid.  The masks only change at
+		// samples within EDGE_THRESHOLD of mid (set) or -mid (cleared), which are
+		// flagged first.
+		size_t m = n - 1;
+		uint8_t *above = &this->_above[0];
+		uint8_t *near = &this->_near[0];
+		uint8_t *riseMask = &this->_riseMask[0];
+		for (size_t i = 0; i < n; ++i)
+		{
+			above[i] = (s[i] > 0);
+			near[i] = (std::fabs(s[i] - mid) < EDGE_THRESHOLD) | ((std::fabs(s[i] + mid) < EDGE_THRESHOLD) << 1);
+		}
+		int state = 1;
+		for (size_t k = 0; k < m; ++k)
+		{
+			state = nextMask(state, near[m - k]);
+			riseMask[(k == 0)?0:(m - k)] = (uint8_t)state;
+		}
+		long risePos[QuickFitResult::MAX_FINGERS];
+		long fallPos[QuickFitResult::MAX_FINGERS];
+		int rising = 0, falling = 0;
+		state = 1;
+		for (size_t i = 0; i < m; ++i)
+		{
+			state = nextMask(state, near[i + 1]);
+			int rise = (above[i] ^ 1) & above[i + 1] & riseMask[i];
+			int fall = above[i] & (above[i + 1] ^ 1) & state;
+			if(rise | fall) {
+				if(rise && rising < nfingers) risePos[rising] = (long)i;
+				if(fall && falling < nfingers) fallPos[falling] = (long)i;
+				rising += rise;
+				falling += fall;
+			}
+		}
+		result.rising = rising;
+		result.falling = falling;
+		if(rising != nfingers) return finish(result, RISING_EDGES);
+		if(falling != nfingers) return finish(result, FALLING_EDGES);
+
+		// Subsample edge times
+		double riseFit[QuickFitResult::MAX_FINGERS];
+		double fallFit[QuickFitResult::MAX_FINGERS];
+		for (int i = 0; i < nfingers; ++i)
+		{
+			if(!lineFit(risePos[i], riseFit[i]) || !lineFit(fallPos[i], fallFit[i])) return finish(result, EDGE_AT_END);
+		}
+		double t0 = (fallFit[2] + riseFit[2])/2;
+		double direction = (risePos[0] - fallPos[0] > n/(2.0*nfingers))?+1.:-1.;
+		result.t0 = t0;
+		result.direction = direction;
+		for (int i = 0; i < nfingers; ++i)
+		{
+			if(direction == +1) {
+				result.rise[i] = riseFit[i] - t0;
+				result.fall[i] = fallFit[i] - t0;
+			} else {
+				result.rise[i] = t0 - fallFit[nfingers - 1 - i];
+				result.fall[i] = t0 - riseFit[nfingers - 1 - i];
+			}
+		}
+		return finish(result, FIT);
+	}
+
+	// Fits frame i of arena k into fits[k][i] for every frame, on all the
+	// pool's threads
+	static void fitAll(ThreadPool &pool, const std::vector<FrameArena> &frames,
+		std::vector<std::vector<QuickFitResult> > &fits, int nfingers = DEFAULT_FINGERS)
+	{
+		fits.resize(frames.size());
+		std::vector<size_t> firstBatch(frames.size() + 1, 0);
+		for (size_t k = 0; k < frames.size(); ++k)
+		{
+			fits[k].resize(frames[k].size());
+			firstBatch[k + 1] = firstBatch[k] + (frames[k].size() + BATCH_FRAMES - 1)/BATCH_FRAMES;
+		}
+		if(frames.empty()) return;
+		std::vector<QuickFitter> fitters(pool.size(), QuickFitter(frames[0].getFrameLength(), nfingers));
+		pool.run(firstBatch.back(), [&](size_t b, unsigned worker) {
+			size_t k = std::upper_bound(firstBatch.begin(), firstBatch.end(), b) - firstBatch.begin() - 1;
+			size_t begin = (b - firstBatch[k])*BATCH_FRAMES;
+			size_t end = std::min(begin + BATCH_FRAMES, frames[k].size());
+			for (size_t i = begin; i < end; ++i)
+			{
+				fitters[worker].fit(frames[k].getFrame(i), fits[k][i]);
+			}
+		});
+	}
+
+private:
+	static Status finish(QuickFitResult &result, Status status)
+	{
+		result.status = status;
+		if(status != FIT) {
+			result.direction = result.t0 = NAN;
+			if(status == NO_LEVEL) result.lo = result.hi = result.height = NAN;
+		}
+		return status;
+	}
+
+	// Frame.runningAvg(): the frame padded with copies of its end samples.  Sums
+	// of 10 bit samples fit 32 bits, which converts to double in packed SIMD.
+	void smooth(const uint16_t *samples)
+	{
+		size_t n = this->_nsamples;
+		size_t half = this->_smoothing;
+		size_t wlen = 2*half + 1;
+		int32_t *prefix = &this->_prefix[0];
+		int32_t sum = 0;
+		prefix[0] = 0;
+		size_t k = 1;
+		for (size_t i = 0; i < half; ++i) prefix[k++] = (sum += samples[0]);
+		for (size_t i = 0; i < n; ++i) prefix[k++] = (sum += samples[i]);
+		for (size_t i = 0; i < half; ++i) prefix[k++] = (sum += samples[n - 1]);
+		double *s = &this->_smooth[0];
+		double divisor = (double)wlen;
+		for (size_t i = 0; i < n; ++i) s[i] = (prefix[i + wlen] - prefix[i])/divisor;
+	}
+
+	// Frame.findPeakValues(): sorted levels, zero for peaks not found
+	bool findPeakValues(double levels[PEAKS])
+	{
+		// numpy.histogram(smooth, bins=1023, range=(0,1023)), counted in
+		// HISTOGRAMS interleaved copies, as neighbouring samples mostly share a bin
+		uint32_t *counts = &this->_counts[0];
+		std::fill(counts, counts + HISTOGRAMS*BINS, 0);
+		const double *s = &this->_smooth[0];
+		for (size_t i = 0; i < this->_nsamples; ++i)
+		{
+			if(s[i] >= 0 && s[i] <= BINS) ++counts[(i % HISTOGRAMS)*BINS + std::min((int)s[i], BINS - 1)];
+		}
+		int32_t hist[BINS];
+		for (int k = 0; k < BINS; ++k)
+		{
+			hist[k] = 0;
+			for (size_t h = 0; h < HISTOGRAMS; ++h) hist[k] += counts[h*BINS + k];
+		}
+		int peaks[BINS];
+		int npeaks = findNMaxes(hist, peaks);
+		for (int i = 0; i < PEAKS; ++i) levels[i] = 0;
+		for (int i = 0; i < npeaks; ++i)
+		{
+			int lower = std::max(peaks[i] - PEAK_WINDOW, 0);
+			int upper = std::min(peaks[i] + PEAK_WINDOW, (int)BINS);
+			int64_t weights = 0, moment = 0;
+			for (int k = lower; k < upper; ++k)
+			{
+				weights += hist[k];
+				moment += k*hist[k];
+			}
+			if(weights == 0) return false;
+			levels[i] = (double)moment/(double)weights;
+		}
+		std::sort(levels, levels + PEAKS);
+		return true;
+	}
+
+	// Frame.findNMaxes(): sorted peaks, at most PEAKS of them
+	static int findNMaxes(const int32_t *hist, int *peaks)
+	{
+		static const int thresholdReduction[] = { 10, 10, 5, 5, 3, 3, 1, 1, 1, 1 };
+		int sign[BINS - 1];
+		for (int i = 0; i < BINS - 1; ++i)
+		{
+			int32_t d = hist[i + 1] - hist[i];
+			sign[i] = (d > 0) - (d < 0);
+		}
+		// Only where the slope changes sign can be a peak, whatever the threshold
+		int candidates[BINS];
+		int ncandidates = 0;
+		for (int i = 0; i < BINS - 1; ++i)
+		{
+			// diffs[-1] is the last slope
+			int previous = sign[(i == 0)?(BINS - 2):(i - 1)];
+			if(previous != sign[i]) candidates[ncandidates++] = i;
+		}
+		bool found[BINS] = {false};
+		int npeaks = 0;
+		int threshold = MAX_HEIGHT_THRESHOLD;
+		for (int iteration = 0; npeaks < PEAKS && threshold >= MIN_HEIGHT_THRESHOLD; ++iteration)
+		{
+			for (int c = 0; c < ncandidates; ++c)
+			{
+				int i = candidates[c];
+				if(hist[i] > threshold && !found[i]) {
+					found[i] = true;
+					++npeaks;
+				}
+			}
+			threshold -= thresholdReduction[iteration];
+		}
+		npeaks = 0;
+		for (int c = 0; c < ncandidates; ++c)
+		{
+			if(found[candidates[c]]) peaks[npeaks++] = candidates[c];
+		}
+		// Too many: merge the closest two until there are PEAKS
+		while(npeaks > PEAKS)
+		{
+			int closest = -1;
+			int closestDistance = 1000;
+			for (int i = 0; i + 1 < npeaks; ++i)
+			{
+				if(peaks[i + 1] - peaks[i] < closestDistance) {
+					closestDistance = peaks[i + 1] - peaks[i];
+					closest = i;
+				}
+			}
+			if(closest < 0) {
+				// peaks[-1] and peaks[0]
+				peaks[npeaks - 1] = (int)(0.5*(peaks[npeaks - 1] + peaks[0]));
+				for (int i = 0; i + 1 < npeaks; ++i) peaks[i] = peaks[i + 1];
+			} else {
+				peaks[closest] = (int)(0.5*(peaks[closest] + peaks[closest + 1]));
+				for (int i = closest + 1; i + 1 < npeaks; ++i) peaks[i] = peaks[i + 1];
+			}
+			--npeaks;
+		}
+		return npeaks;
+	}
+
+	// One step of the edge masks in Frame.findRiseAndFallPositions(): a clear
+	// mask is set near mid (bit 0 of near), a set one cleared near -mid (bit 1)
+	static inline int nextMask(int state, int near)
+	{
+		return state?!(near & 2):(near & 1);
+	}
+
+	// Frame.lineFit(): where the line through the smoothed samples around an
+	// edge crosses zero, as scipy.stats.linregress fits it
+	bool lineFit(long position, double &crossing) const
+	{
+		long t1 = position - this->_fitsize;
+		long t2 = position + this->_fitsize + 1;
+		if(t1 < 0 || t2 > (long)this->_nsamples) return false;
+		const double *y = &this->_smooth[0];
+		double count = (double)(t2 - t1);
+		double tMean = 0, yMean = 0;
+		for (long t = t1; t < t2; ++t)
+		{
+			tMean += t;
+			yMean += y[t];
+		}
+		tMean /= count;
+		yMean /= count;
+		double tt = 0, ty = 0;
+		for (long t = t1; t < t2; ++t)
+		{
+			tt += (t - tMean)*(t - tMean);
+			ty += (t - tMean)*(y[t] - yMean);
+		}
+		double slope = (ty/count)/(tt/count);
+		double intercept = yMean - slope*tMean;
+		crossing = -intercept/slope;
+		return true;
+	}
+
+	size_t _nsamples;
+	int _nfingers;
+	int _smoothing;
+	int _fitsize;
+	std::vector<int32_t> _prefix;
+	std::vector<double> _smooth;
+	std::vector<uint8_t> _above;
+	std::vector<uint8_t> _near;
+	std::vector<uint8_t> _riseMask;
+	std::vector<uint32_t> _counts;
+};
+
+#endif
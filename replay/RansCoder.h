@@ -0,0 +1,223 @@
+/*
+Static range asymmetric numeral system (rANS) coder for byte streams
+
+A stream is coded with one table of symbol frequencies, scaled to a total of
+2^PROB_BITS, that is stored in front of the coded bytes.  Symbols are encoded
+last to first into 32 bit states that are renormalized 16 bits at a time, so
+decoding runs forwards with a table lookup, a multiply and at most one
+(branch free) word read per symbol, and spends well under a bit on very likely symbols.
+Symbol i goes through state i % STATES, so consecutive symbols do not wait on
+each other, and all states share the one byte stream.
+
+Coded stream layout (little endian):
+
+	uint32 symbols, uint32 bytes, uint16 frequencies[256],
+	uint8 coded[bytes] starting with the STATES final states
+*/
+
+#ifndef RANSCODER_H
+#define RANSCODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+class RansCoder
+{
+public:
+	static const unsigned PROB_BITS = 12;
+	static const uint32_t PROB_SCALE = 1 << PROB_BITS;
+	// Lower bound of the normalized state
+	static const uint32_t RANS_L = 1 << 16;
+	static const size_t TABLE_SIZE = 4 + 4 + 256*2;
+	static const size_t STATES = 4;
+
+	// Appends the coded stream of n symbols to out
+	static void encode(const uint8_t *in, size_t n, std::vector<uint8_t> &out)
+	{
+		uint32_t frequency[256];
+		uint32_t start[257];
+		normalize(in, n, frequency);
+		start[0] = 0;
+		for (int s = 0; s < 256; ++s) start[s + 1] = start[s] + frequency[s];
+
+		// At most one word per symbol
+		std::vector<uint8_t> coded(2*n + 4*STATES + 16);
+		uint8_t *end = &coded[0] + coded.size();
+		uint8_t *p = end;
+		uint32_t state[STATES];
+		for (size_t j = 0; j < STATES; ++j) state[j] = RANS_L;
+		for (size_t i = n; i-- > 0;)
+		{
+			uint32_t &x = state[i % STATES];
+			uint32_t f = frequency[in[i]];
+			uint32_t xMax = ((RANS_L >> PROB_BITS) << 16)*f;
+			if(x >= xMax) {
+				p -= 2;
+				putLE(p, x & 0xFFFF, 2);
+				x >>= 16;
+			}
+			x = ((x/f) << PROB_BITS) + (x % f) + start[in[i]];
+		}
+		for (size_t j = STATES; j-- > 0;)
+		{
+			p -= 4;
+			putLE(p, state[j], 4);
+		}
+
+		size_t at = out.size();
+		uint32_t bytes = (uint32_t)(end - p);
+		out.resize(at + TABLE_SIZE + bytes);
+		uint8_t *q = &out[at];
+		putLE(q, (uint32_t)n, 4);
+		putLE(q + 4, bytes, 4);
+		for (int s = 0; s < 256; ++s) putLE(q + 8 + 2*s, frequency[s], 2);
+		std::memcpy(q + TABLE_SIZE, p, bytes);
+	}
+
+	// Symbols in the coded stream at in, or zero if it is cut short
+	static size_t getSymbols(const uint8_t *in, size_t size)
+	{
+		return (size < TABLE_SIZE)?0:getLE(in, 4);
+	}
+
+	// Bytes taken by the coded stream at in, or zero if it is cut short
+	static size_t getStreamSize(const uint8_t *in, size_t size)
+	{
+		if(size < TABLE_SIZE) return 0;
+		size_t total = TABLE_SIZE + getLE(in + 4, 4);
+		return (total <= size)?total:0;
+	}
+
+	// Decodes the coded stream at in into getSymbols() bytes at out.  Returns
+	// false if the stream is damaged.
+	static bool decode(const uint8_t *in, size_t size, uint8_t *out)
+	{
+		size_t total = getStreamSize(in, size);
+		if(total == 0) return false;
+		size_t n = getLE(in, 4);
+
+		// What each slot of the state decodes to
+		uint32_t slots[PROB_SCALE];
+		uint32_t sum = 0;
+		for (int s = 0; s < 256; ++s)
+		{
+			uint32_t f = getLE(in + 8 + 2*s, 2);
+			if(sum + f > PROB_SCALE || f == PROB_SCALE) return false;
+			for (uint32_t k = 0; k < f; ++k)
+			{
+				slots[sum + k] = (f << 20) | (k << 8) | s;
+			}
+			sum += f;
+		}
+		if(n > 0 && sum != PROB_SCALE) return false;
+
+		const uint8_t *p = in + TABLE_SIZE;
+		const uint8_t *end = in + total;
+		if((size_t)(end - p) < 4*STATES) return false;
+		uint32_t x0 = getLE(p, 4);
+		uint32_t x1 = getLE(p + 4, 4);
+		uint32_t x2 = getLE(p + 8, 4);
+		uint32_t x3 = getLE(p + 12, 4);
+		p += 4*STATES;
+		size_t i = 0;
+		for (; i + STATES <= n && end - p >= (ptrdiff_t)(2*STATES); i += STATES)
+		{
+			out[i] = step(slots, x0, p);
+			out[i + 1] = step(slots, x1, p);
+			out[i + 2] = step(slots, x2, p);
+			out[i + 3] = step(slots, x3, p);
+		}
+		// The last few symbols, checking every word read
+		uint32_t state[STATES] = { x0, x1, x2, x3 };
+		for (; i < n; ++i)
+		{
+			uint32_t &x = state[i % STATES];
+			uint32_t slot = slots[x & (PROB_SCALE - 1)];
+			out[i] = (uint8_t)slot;
+			x = (slot >> 20)*(x >> PROB_BITS) + ((slot >> 8) & (PROB_SCALE - 1));
+			if(x < RANS_L) {
+				if(end - p < 2) return false;
+				x = (x << 16) | p[0] | (p[1] << 8);
+				p += 2;
+			}
+		}
+		return true;
+	}
+
+private:
+	// Decodes one symbol from state x and renormalizes it.  A slot packs the
+	// symbol's frequency, the slot's offset from the symbol's start and the symbol.
+	static inline uint8_t step(const uint32_t *slots, uint32_t &x, const uint8_t *&p)
+	{
+		uint32_t slot = slots[x & (PROB_SCALE - 1)];
+		x = (slot >> 20)*(x >> PROB_BITS) + ((slot >> 8) & (PROB_SCALE - 1));
+		uint32_t renormalize = (x < RANS_L);
+		uint32_t word = p[0] | (p[1] << 8);
+		x = renormalize?((x << 16) | word):x;
+		p += 2*renormalize;
+		return (uint8_t)slot;
+	}
+
+	// Frequencies summing to PROB_SCALE, at least one for every symbol present
+	// and less than PROB_SCALE for each, so that they fit in 12 bits
+	static void normalize(const uint8_t *in, size_t n, uint32_t frequency[256])
+	{
+		uint64_t count[256] = {0};
+		for (size_t i = 0; i < n; ++i) ++count[in[i]];
+		if(n == 0) {
+			// Anything valid will do
+			for (int s = 0; s < 256; ++s) frequency[s] = PROB_SCALE/256;
+			return;
+		}
+		uint32_t sum = 0;
+		for (int s = 0; s < 256; ++s)
+		{
+			frequency[s] = (uint32_t)(count[s]*PROB_SCALE/n);
+			if(count[s] > 0 && frequency[s] == 0) frequency[s] = 1;
+			sum += frequency[s];
+		}
+		// Take from (or give to) the most frequent symbols, which it costs least
+		while(sum != PROB_SCALE)
+		{
+			int largest = -1;
+			for (int s = 0; s < 256; ++s)
+			{
+				if((sum < PROB_SCALE || frequency[s] > 1) && (largest < 0 || frequency[s] > frequency[largest])) largest = s;
+			}
+			if(sum > PROB_SCALE) {
+				uint32_t k = sum - PROB_SCALE;
+				if(k > frequency[largest] - 1) k = frequency[largest] - 1;
+				if(k > frequency[largest]/2 && frequency[largest] > 2) k = frequency[largest]/2;
+				if(k == 0) k = 1;
+				frequency[largest] -= k;
+				sum -= k;
+			} else {
+				frequency[largest] += PROB_SCALE - sum;
+				sum = PROB_SCALE;
+			}
+		}
+		for (int s = 0; s < 256; ++s)
+		{
+			if(frequency[s] == PROB_SCALE) {
+				--frequency[s];
+				++frequency[s ^ 1];
+			}
+		}
+	}
+
+	static void putLE(uint8_t *p, uint32_t value, int n)
+	{
+		for (int i = 0; i < n; ++i) p[i] = (uint8_t)(value >> (8*i));
+	}
+
+	static uint32_t getLE(const uint8_t *p, int n)
+	{
+		uint32_t value = 0;
+		for (int i = n - 1; i >= 0; --i) value = (value << 8) | p[i];
+		return value;
+	}
+};
+
+#endif
@@ -0,0 +1,263 @@
+/*
+Reconstitution of 10 bit IR frames from data packets
+
+The firmware only keeps the low 8 bits of each ADC reading in the circular
+buffer, starting at rawPhase.  As in node/logger.js, the buffer is read from
+rawPhase round to rawPhase - 1, the first reading is assumed to be in the top
+quadrant (plus 3*QUADRANT), and a jump between consecutive readings of more
+than RECONSTITUTION_THRESH moves every following reading down (or up) a
+quadrant.  Frames with readings still outside 10 bits then go through the
+logger's errorCorrection(): up to four times, everything after the largest
+discontinuity is shifted back a quadrant.
+
+The quadrant count is a running sum of the jumps, computed with SSE2 eight
+readings at a time (an in register prefix sum plus the carry from the previous
+eight) where available.  The rare frames that need correcting are redone one
+reading at a time.
+*/
+
+#ifndef RECONSTITUTER_H
+#define RECONSTITUTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "PacketReader.h"
+
+// Frames stored back to back in memory allocated (but not touched) up front
+class FrameArena
+{
+public:
+	FrameArena(size_t frameLength, size_t capacity)
+	{
+		this->_frameLength = frameLength;
+		this->_capacity = capacity;
+		this->_count = 0;
+		this->_samples.reset(new uint16_t[frameLength*capacity]);
+	}
+
+	// Space for one more frame, or null when the arena is full
+	uint16_t *append()
+	{
+		if(this->_count == this->_capacity) return 0;
+		return &this->_samples[this->_frameLength*this->_count++];
+	}
+
+	// Gives back the last frame handed out by append()
+	void pop()
+	{
+		if(this->_count > 0) --this->_count;
+	}
+
+	void clear()
+	{
+		this->_count = 0;
+	}
+
+	size_t size() const
+	{
+		return this->_count;
+	}
+
+	size_t getFrameLength() const
+	{
+		return this->_frameLength;
+	}
+
+	const uint16_t *getFrame(size_t i) const
+	{
+		return &this->_samples[this->_frameLength*i];
+	}
+
+private:
+	size_t _frameLength;
+	size_t _capacity;
+	size_t _count;
+	std::unique_ptr<uint16_t[]> _samples;
+};
+
+class Reconstituter
+{
+public:
+	static const int QUADRANT = 0xFF;
+	static const int RECONSTITUTION_THRESH = 130;
+	static const int MAX_READING = (1 << 10) - 1;
+	static const int ERROR_CORRECTIONS = 4;
+
+	enum Result { FRAME, OUT_OF_RANGE, BAD_PHASE };
+
+	Reconstituter(size_t rawLength)
+	{
+		this->_rawLength = rawLength;
+		this->_scratch.resize(rawLength);
+	}
+
+	// Writes the rawLength readings of a data packet to frame.  OUT_OF_RANGE
+	// means some were still outside 10 bits after error correction and have been
+	// clamped.  A packet with a bad rawPhase, which the logger drops, is BAD_PHASE
+	// and leaves frame alone.
+	Result reconstitute(const uint8_t *packet, uint16_t *frame)
+	{
+		DataPacketView view(packet, this->_rawLength);
+		const uint8_t *raw = view.getRaw().data();
+		size_t rawPhase = view.getRawPhase();
+		if(rawPhase >= this->_rawLength) return BAD_PHASE;
+
+		State state;
+		state.last = raw[rawPhase];
+		state.quadrants = 0;
+		state.inRange = true;
+		scan(raw + rawPhase, this->_rawLength - rawPhase, frame, state);
+		scan(raw, rawPhase, frame + this->_rawLength - rawPhase, state);
+		if(state.inRange) return FRAME;
+		return correct(raw, rawPhase, frame)?FRAME:OUT_OF_RANGE;
+	}
+
+private:
+	// Carried from one stretch of readings to the next
+	struct State
+	{
+		int last;
+		int quadrants;
+		bool inRange;
+	};
+
+	// Quadrants are only counted exactly in 16 bits while they stay this small
+	static const int MAX_QUADRANTS = 100;
+
+	static void scan(const uint8_t *raw, size_t n, uint16_t *out, State &state)
+	{
+		size_t i = 0;
+#ifdef __SSE2__
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i up = _mm_set1_epi16(RECONSTITUTION_THRESH);
+		const __m128i down = _mm_set1_epi16(-RECONSTITUTION_THRESH);
+		const __m128i quadrant = _mm_set1_epi16(QUADRANT);
+		const __m128i base = _mm_set1_epi16(3*QUADRANT);
+		const __m128i highest = _mm_set1_epi16(MAX_READING);
+		__m128i carry = _mm_set1_epi16((short)state.quadrants);
+		__m128i minQuadrants = carry;
+		__m128i maxQuadrants = carry;
+		__m128i outside = zero;
+		int last = state.last;
+		for (; i + 8 <= n; i += 8)
+		{
+			__m128i x = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(raw + i)), zero);
+			__m128i previous = _mm_insert_epi16(_mm_slli_si128(x, 2), last, 0);
+			__m128i d = _mm_sub_epi16(x, previous);
+			// -1 for a jump up (down a quadrant), +1 for a jump down
+			__m128i step = _mm_sub_epi16(_mm_cmpgt_epi16(d, up), _mm_cmplt_epi16(d, down));
+			step = _mm_add_epi16(step, _mm_slli_si128(step, 2));
+			step = _mm_add_epi16(step, _mm_slli_si128(step, 4));
+			step = _mm_add_epi16(step, _mm_slli_si128(step, 8));
+			__m128i quadrants = _mm_add_epi16(step, carry);
+			__m128i y = _mm_add_epi16(_mm_add_epi16(x, base), _mm_mullo_epi16(quadrants, quadrant));
+			_mm_storeu_si128((__m128i *)(out + i), y);
+			minQuadrants = _mm_min_epi16(minQuadrants, quadrants);
+			maxQuadrants = _mm_max_epi16(maxQuadrants, quadrants);
+			outside = _mm_or_si128(outside, _mm_or_si128(_mm_cmplt_epi16(y, zero), _mm_cmpgt_epi16(y, highest)));
+			carry = _mm_shuffle_epi32(_mm_shufflehi_epi16(quadrants, 0xFF), 0xFF);
+			last = raw[i + 7];
+		}
+		if(i > 0) {
+			int16_t lanes[8];
+			_mm_storeu_si128((__m128i *)lanes, minQuadrants);
+			int lo = lanes[0];
+			for (int k = 1; k < 8; ++k) if(lanes[k] < lo) lo = lanes[k];
+			_mm_storeu_si128((__m128i *)lanes, maxQuadrants);
+			int hi = lanes[0];
+			for (int k = 1; k < 8; ++k) if(lanes[k] > hi) hi = lanes[k];
+			if(_mm_movemask_epi8(outside) != 0 || lo < -MAX_QUADRANTS || hi > MAX_QUADRANTS) state.inRange = false;
+			state.quadrants = (int16_t)_mm_extract_epi16(carry, 0);
+			state.last = last;
+		}
+#endif
+		for (; i < n; ++i)
+		{
+			int x = raw[i];
+			int d = x - state.last;
+			if(d > RECONSTITUTION_THRESH) {
+				--state.quadrants;
+			} else if(d < -RECONSTITUTION_THRESH) {
+				++state.quadrants;
+			}
+			state.last = x;
+			int y = x + QUADRANT*(3 + state.quadrants);
+			if(y < 0 || y > MAX_READING || state.quadrants < -MAX_QUADRANTS || state.quadrants > MAX_QUADRANTS) {
+				state.inRange = false;
+			}
+			out[i] = (uint16_t)y;
+		}
+	}
+
+	// One reading at a time in full precision, with node/logger.js's errorCorrection()
+	bool correct(const uint8_t *raw, size_t rawPhase, uint16_t *frame)
+	{
+		int *value = &this->_scratch[0];
+		size_t n = this->_rawLength;
+		int last = raw[rawPhase];
+		int add = 3*QUADRANT;
+		for (size_t i = 0; i < n; ++i)
+		{
+			int x = raw[(rawPhase + i < n)?(rawPhase + i):(rawPhase + i - n)];
+			if(x - last > RECONSTITUTION_THRESH) {
+				add -= QUADRANT;
+			} else if(x - last < -RECONSTITUTION_THRESH) {
+				add += QUADRANT;
+			}
+			last = x;
+			value[i] = x + add;
+		}
+
+		bool inRange = isInRange(value, n);
+		for (int corrections = 0; corrections < ERROR_CORRECTIONS && !inRange; ++corrections)
+		{
+			// Shift everything after the largest discontinuity back a quadrant
+			int largest = 0;
+			int sign = 0;
+			size_t at = 0;
+			for (size_t i = 1; i < n; ++i)
+			{
+				int diff = value[i] - value[i - 1];
+				if(std::abs(diff) > largest) {
+					largest = std::abs(diff);
+					sign = (diff > 0)?1:-1;
+					at = i;
+				}
+			}
+			for (size_t i = at; i < n; ++i)
+			{
+				value[i] -= sign*QUADRANT;
+			}
+			inRange = isInRange(value, n);
+		}
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			int y = value[i];
+			frame[i] = (uint16_t)((y < 0)?0:((y > MAX_READING)?MAX_READING:y));
+		}
+		return inRange;
+	}
+
+	static bool isInRange(const int *value, size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			if(value[i] < 0 || value[i] > MAX_READING) return false;
+		}
+		return true;
+	}
+
+	size_t _rawLength;
+	std::vector<int> _scratch;
+};
+
+#endif
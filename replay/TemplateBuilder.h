@@ -0,0 +1,197 @@
+/*
+Streaming construction of fit.py templates
+
+buildSplineTemplate() in fit/frameProcessor.py stacks quick fitted frames: each
+frame is mapped to s = direction*(tick - t0)/stretch, stretch being half the
+time between its outer edges, normalized to (samples - lo)/(hi - lo) with the
+mean lo and hi of all the frames, interpolated by a cubic spline and
+resampled on a grid of nspline points over +-(1 + pad).  The template is the
+mean of the resampled frames.
+
+Interpolation is linear in the samples and reproduces constants, so the
+normalization can wait until the end: a builder keeps the sums of the
+resampled raw frames and of lo and hi, which is O(nspline) however many
+frames it sees, and builders of separate threads merge by adding their sums.
+Frames whose quick fit failed, which make the Python raise, are left out, as
+are frames that do not reach both ends of the grid: the Python extrapolates
+their cubic, and one such frame can swamp the ends of the template.
+*/
+
+#ifndef TEMPLATEBUILDER_H
+#define TEMPLATEBUILDER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "QuickFit.h"
+#include "Reconstituter.h"
+#include "TemplateFit.h"
+#include "ThreadPool.h"
+
+// A frame interpolated on its s scale and resampled on a grid
+class FrameResampler
+{
+public:
+	FrameResampler(size_t nsamples)
+	{
+		this->_s.resize(nsamples);
+		this->_y.resize(nsamples);
+	}
+
+	// Resamples the frame at s = direction*(tick - t0)/stretch onto the grid,
+	// adding weight times the values to sums.  Returns false, adding nothing,
+	// if the frame does not span the grid.
+	bool add(const uint16_t *samples, double direction, double t0, double stretch,
+		const std::vector<double> &grid, double weight, std::vector<double> &sums)
+	{
+		if(!(stretch > 0)) return false;
+		// s increasing, reversed for frames of the other direction
+		size_t n = this->_s.size();
+		for (size_t i = 0; i < n; ++i)
+		{
+			size_t k = (direction < 0)?(n - 1 - i):i;
+			this->_s[i] = direction*(k - t0)/stretch;
+			this->_y[i] = samples[k];
+		}
+		if(this->_s[0] > grid.front() || this->_s[n - 1] < grid.back()) return false;
+		if(!this->_spline.set(this->_s, this->_y, this->_scratch)) return false;
+		for (size_t i = 0; i < grid.size(); ++i)
+		{
+			double value, derivative;
+			this->_spline.evaluate(grid[i], value, derivative);
+			sums[i] += weight*value;
+		}
+		return true;
+	}
+
+private:
+	std::vector<double> _s;
+	std::vector<double> _y;
+	SplineTemplate _spline;
+	SplineScratch _scratch;
+};
+
+class TemplateBuilder
+{
+public:
+	// fit.py --nspline and --spline-pad
+	static const size_t DEFAULT_SPLINE = 1024;
+	static constexpr double DEFAULT_PAD = 0.03;
+
+	TemplateBuilder(size_t nsamples, int nfingers = QuickFitter::DEFAULT_FINGERS,
+		size_t nspline = DEFAULT_SPLINE, double pad = DEFAULT_PAD) : _resampler(nsamples)
+	{
+		this->_nfingers = nfingers;
+		this->_frames = 0;
+		this->_loSum = this->_hiSum = 0;
+		// numpy.linspace(-smax, +smax, nspline)
+		double smax = 1 + pad;
+		double step = 2*smax/(nspline - 1);
+		this->_grid.resize(nspline);
+		for (size_t i = 0; i < nspline; ++i) this->_grid[i] = -smax + i*step;
+		this->_grid[nspline - 1] = smax;
+		this->_sums.assign(nspline, 0);
+	}
+
+	// Stacks a frame with its quick fit.  Returns false if the fit failed or the
+	// frame does not span the grid.
+	bool add(const uint16_t *samples, const QuickFitResult &fit)
+	{
+		if(fit.status != QuickFitter::FIT) return false;
+		double stretch = (fit.rise[this->_nfingers - 1] - fit.fall[0])/2;
+		if(!this->_resampler.add(samples, fit.direction, fit.t0, stretch, this->_grid, 1, this->_sums)) return false;
+		this->_loSum += fit.lo;
+		this->_hiSum += fit.hi;
+		++this->_frames;
+		return true;
+	}
+
+	// Adds the frames stacked by a builder with the same grid
+	void merge(const TemplateBuilder &other)
+	{
+		for (size_t i = 0; i < this->_sums.size(); ++i) this->_sums[i] += other._sums[i];
+		this->_loSum += other._loSum;
+		this->_hiSum += other._hiSum;
+		this->_frames += other._frames;
+	}
+
+	uint64_t getFrames() const
+	{
+		return this->_frames;
+	}
+
+	// The grid and the mean normalized frame on it.  Returns false before any
+	// frame is stacked.
+	bool build(std::vector<double> &s, std::vector<double> &t) const
+	{
+		if(this->_frames == 0) return false;
+		double lo = this->_loSum/this->_frames;
+		double hi = this->_hiSum/this->_frames;
+		s = this->_grid;
+		t.resize(this->_sums.size());
+		for (size_t i = 0; i < t.size(); ++i) t[i] = (this->_sums[i]/this->_frames - lo)/(hi - lo);
+		return true;
+	}
+
+	bool build(SplineTemplate &spline) const
+	{
+		std::vector<double> s, t;
+		return build(s, t) && spline.set(s, t);
+	}
+
+	// Writes the template as fit.py --save-template does (see
+	// SplineTemplate::save()).  Returns false with errno set on error, or
+	// before any frame is stacked.
+	bool save(const char *filename) const
+	{
+		SplineTemplate spline;
+		return build(spline) && spline.save(filename);
+	}
+
+	// Stacks every frame of the arenas with its quick fit quick[k][i] into
+	// builder, on all the pool's threads
+	static void addAll(ThreadPool &pool, const std::vector<FrameArena> &frames,
+		const std::vector<std::vector<QuickFitResult> > &quick, TemplateBuilder &builder)
+	{
+		std::vector<size_t> firstBatch(frames.size() + 1, 0);
+		for (size_t k = 0; k < frames.size(); ++k)
+		{
+			firstBatch[k + 1] = firstBatch[k] + (frames[k].size() + QuickFitter::BATCH_FRAMES - 1)/QuickFitter::BATCH_FRAMES;
+		}
+		std::vector<TemplateBuilder> partial(pool.size(), builder.empty());
+		pool.run(firstBatch.back(), [&](size_t b, unsigned worker) {
+			size_t k = std::upper_bound(firstBatch.begin(), firstBatch.end(), b) - firstBatch.begin() - 1;
+			size_t begin = (b - firstBatch[k])*QuickFitter::BATCH_FRAMES;
+			size_t end = std::min(begin + QuickFitter::BATCH_FRAMES, frames[k].size());
+			for (size_t i = begin; i < end; ++i)
+			{
+				partial[worker].add(frames[k].getFrame(i), quick[k][i]);
+			}
+		});
+		for (size_t w = 0; w < partial.size(); ++w) builder.merge(partial[w]);
+	}
+
+	// A builder with the same grid and no frames
+	TemplateBuilder empty() const
+	{
+		TemplateBuilder other(*this);
+		std::fill(other._sums.begin(), other._sums.end(), 0);
+		other._loSum = other._hiSum = 0;
+		other._frames = 0;
+		return other;
+	}
+
+private:
+	int _nfingers;
+	uint64_t _frames;
+	double _loSum;
+	double _hiSum;
+	std::vector<double> _grid;
+	// Of the resampled frames before normalization
+	std::vector<double> _sums;
+	FrameResampler _resampler;
+};
+
+#endif
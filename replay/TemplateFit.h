@@ -0,0 +1,479 @@
+/*
+Template fit of reconstituted frames
+
+The model of Template.fitTemplateModel() in fit/template.py: a frame is the
+template transmission t(s), scaled to lo + rng*t(s), at s = direction*(tick -
+t0)/duration, and 1 outside the template.  Frames are fitted for t0,
+duration, lo and rng by least squares over the samples more than
+EXCLUDED samples from the quick fit t0, starting from the quick fit, as the
+Python does with MIGRAD.
+
+Here the template is a cubic spline through its points with not-a-knot ends,
+which is the spline scipy's UnivariateSpline(k=3, s=0) interpolates, held as
+polynomial coefficients per interval.  The fit is Levenberg-Marquardt on the
+analytic derivatives of the model, and stops when the expected decrease of
+the chi-square is below EDM_TOLERANCE, MIGRAD's own criterion for tol = 1.
+
+A TemplateFitter keeps no scratch state, so one can be shared by threads.
+fitAll() fits whole frame arenas on a thread pool, a batch of frames at a
+time.
+*/
+
+#ifndef TEMPLATEFIT_H
+#define TEMPLATEFIT_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "QuickFit.h"
+#include "Reconstituter.h"
+#include "ThreadPool.h"
+
+struct TemplateFitResult
+{
+	// A TemplateFitter::Status
+	int32_t status;
+	int32_t iterations;
+	// Fiducial crossing, in samples from the start of the frame
+	double t0;
+	// Samples for the template's s to go from 0 to 1
+	double duration;
+	// ADC levels
+	double lo;
+	double rng;
+	double chiSquare;
+};
+
+// Working storage for SplineTemplate::set(), kept by callers that set a
+// spline for every frame so that it is allocated once
+struct SplineScratch
+{
+	std::vector<double> h, slope;
+	std::vector<double> lower, diagonal, upper, rhs, second;
+};
+
+// A cubic spline through the points of a fit.py template, s increasing
+class SplineTemplate
+{
+public:
+	SplineTemplate()
+	{
+		this->_uniform = false;
+		this->_inverseStep = 0;
+	}
+
+	// Reads a file written by fit.py --save-template: s and the transmission,
+	// one point per line.  Returns false if it cannot be read or is not a
+	// template.
+	bool load(const char *filename)
+	{
+		FILE *in = std::fopen(filename, "r");
+		if(!in) return false;
+		std::vector<double> s, t;
+		double x, y;
+		while(std::fscanf(in, "%lf %lf", &x, &y) == 2)
+		{
+			s.push_back(x);
+			t.push_back(y);
+		}
+		std::fclose(in);
+		return set(s, t);
+	}
+
+	// Writes the points as fit.py --save-template does, to a temporary file
+	// renamed over filename, so that a reader never sees part of a template.
+	// Returns false with errno set on error.
+	bool save(const char *filename) const
+	{
+		std::string temporary = std::string(filename) + ".tmp";
+		FILE *out = std::fopen(temporary.c_str(), "w");
+		if(!out) return false;
+		for (size_t i = 0; i < this->_knots.size(); ++i) std::fprintf(out, "%.18e %.18e\n", this->_knots[i], this->_values[i]);
+		bool ok = !std::ferror(out);
+		ok = (std::fclose(out) == 0) && ok;
+		if(ok && std::rename(temporary.c_str(), filename) == 0) return true;
+		std::remove(temporary.c_str());
+		return false;
+	}
+
+	// Interpolates the points, at least four with s increasing
+	bool set(const std::vector<double> &s, const std::vector<double> &t)
+	{
+		SplineScratch scratch;
+		return set(s, t, scratch);
+	}
+
+	bool set(const std::vector<double> &s, const std::vector<double> &t, SplineScratch &scratch)
+	{
+		size_t n = s.size();
+		if(n < 4 || t.size() != n) return false;
+		for (size_t i = 0; i + 1 < n; ++i)
+		{
+			if(!(s[i + 1] > s[i])) return false;
+		}
+		this->_knots = s;
+		this->_values = t;
+		this->_coefficients.assign(4*(n - 1), 0);
+
+		// Second derivatives at the interior points, with the third derivative
+		// continuous across the second and second last points.  Those two
+		// conditions are folded into the first and last rows, which leaves a
+		// tridiagonal system for the Thomas algorithm.
+		std::vector<double> &h = scratch.h, &slope = scratch.slope;
+		h.resize(n - 1);
+		slope.resize(n - 1);
+		for (size_t i = 0; i + 1 < n; ++i)
+		{
+			h[i] = s[i + 1] - s[i];
+			slope[i] = (t[i + 1] - t[i])/h[i];
+		}
+		size_t m = n - 2;
+		std::vector<double> &lower = scratch.lower, &diagonal = scratch.diagonal, &upper = scratch.upper;
+		std::vector<double> &rhs = scratch.rhs, &second = scratch.second;
+		lower.resize(m);
+		diagonal.resize(m);
+		upper.resize(m);
+		rhs.resize(m);
+		second.resize(n);
+		for (size_t k = 0; k < m; ++k)
+		{
+			lower[k] = h[k];
+			diagonal[k] = 2*(h[k] + h[k + 1]);
+			upper[k] = h[k + 1];
+			rhs[k] = 6*(slope[k + 1] - slope[k]);
+		}
+		diagonal[0] += h[0]*(h[0] + h[1])/h[1];
+		upper[0] -= h[0]*h[0]/h[1];
+		diagonal[m - 1] += h[n - 2]*(h[n - 2] + h[n - 3])/h[n - 3];
+		lower[m - 1] -= h[n - 2]*h[n - 2]/h[n - 3];
+		for (size_t k = 1; k < m; ++k)
+		{
+			double w = lower[k]/diagonal[k - 1];
+			diagonal[k] -= w*upper[k - 1];
+			rhs[k] -= w*rhs[k - 1];
+		}
+		second[m] = rhs[m - 1]/diagonal[m - 1];
+		for (size_t k = m - 1; k > 0; --k)
+		{
+			second[k] = (rhs[k - 1] - upper[k - 1]*second[k + 1])/diagonal[k - 1];
+		}
+		second[0] = ((h[0] + h[1])*second[1] - h[0]*second[2])/h[1];
+		second[n - 1] = ((h[n - 2] + h[n - 3])*second[n - 2] - h[n - 2]*second[n - 3])/h[n - 3];
+
+		for (size_t i = 0; i + 1 < n; ++i)
+		{
+			double *c = &this->_coefficients[4*i];
+			c[0] = t[i];
+			c[1] = slope[i] - h[i]*(2*second[i] + second[i + 1])/6;
+			c[2] = second[i]/2;
+			c[3] = (second[i + 1] - second[i])/(6*h[i]);
+		}
+
+		// fit.py templates are on a linspace grid, where the interval of an s
+		// needs no search
+		double step = (s[n - 1] - s[0])/(n - 1);
+		this->_inverseStep = 1/step;
+		this->_uniform = true;
+		for (size_t i = 0; i + 1 < n; ++i)
+		{
+			if(std::fabs(h[i] - step) > 1e-9*step) this->_uniform = false;
+		}
+		return true;
+	}
+
+	bool empty() const
+	{
+		return this->_knots.empty();
+	}
+
+	const std::vector<double> &getKnots() const
+	{
+		return this->_knots;
+	}
+
+	const std::vector<double> &getValues() const
+	{
+		return this->_values;
+	}
+
+	// The model is the template for |s| below this, and 1 beyond (fit.py
+	// --spline-pad is its excess over 1)
+	double getReach() const
+	{
+		return std::min(-this->_knots.front(), this->_knots.back());
+	}
+
+	// The transmission at s and its derivative
+	inline void evaluate(double s, double &value, double &derivative) const
+	{
+		long i;
+		if(this->_uniform) {
+			// A signed conversion is a single instruction, an unsigned one is not
+			long last = (long)this->_knots.size() - 2;
+			i = std::max(0L, std::min((long)((s - this->_knots[0])*this->_inverseStep), last));
+		} else {
+			i = std::upper_bound(this->_knots.begin() + 1, this->_knots.end() - 1, s) - this->_knots.begin() - 1;
+		}
+		const double *c = &this->_coefficients[4*i];
+		double u = s - this->_knots[i];
+		value = c[0] + u*(c[1] + u*(c[2] + u*c[3]));
+		derivative = c[1] + u*(2*c[2] + u*3*c[3]);
+	}
+
+private:
+	std::vector<double> _knots;
+	std::vector<double> _values;
+	// Per interval, the cubic in s - knot
+	std::vector<double> _coefficients;
+	bool _uniform;
+	double _inverseStep;
+};
+
+class TemplateFitter
+{
+public:
+	enum Status
+	{
+		FIT,
+		// No quick fit to start from
+		NO_QUICK_FIT,
+		// No step lowers the chi-square before it converges (RuntimeError)
+		NO_CONVERGENCE
+	};
+
+	// Samples either side of the quick fit t0 left out of the chi-square
+	static const long EXCLUDED = 200;
+	static const int MAX_ITERATIONS = 100;
+	static const size_t BATCH_FRAMES = 64;
+	static constexpr double EDM_TOLERANCE = 0.002;
+	static constexpr double MIN_DAMPING = 1e-9;
+	static constexpr double MAX_DAMPING = 1e9;
+
+	// The template must outlive the fitter
+	TemplateFitter(size_t nsamples, const SplineTemplate &spline) : _spline(spline)
+	{
+		this->_nsamples = nsamples;
+		this->_reach = spline.getReach();
+	}
+
+	// Fits a frame from its quick fit, with nfingers edges
+	Status fit(const uint16_t *samples, const QuickFitResult &quick, int nfingers, TemplateFitResult &result) const
+	{
+		result.iterations = 0;
+		result.chiSquare = NAN;
+		if(quick.status != QuickFitter::FIT) {
+			result.t0 = result.duration = result.lo = result.rng = NAN;
+			result.status = NO_QUICK_FIT;
+			return NO_QUICK_FIT;
+		}
+		double direction = quick.direction;
+		double p[4] = { quick.t0, (quick.rise[nfingers - 1] - quick.fall[0])/2, quick.lo, quick.hi - quick.lo };
+
+		// residuals[:offset-200] and residuals[offset+200:], as Python slices
+		long n = (long)this->_nsamples;
+		long offset = (long)quick.t0;
+		long end = pythonIndex(offset - EXCLUDED, n);
+		long begin = pythonIndex(offset + EXCLUDED, n);
+
+		double alpha[10], beta[4];
+		double chiSquare = accumulate(samples, direction, p, end, begin, alpha, beta);
+		double damping = 1e-3;
+		Status status = NO_CONVERGENCE;
+		while(result.iterations < MAX_ITERATIONS)
+		{
+			++result.iterations;
+			double step[4];
+			if(!solve(alpha, beta, damping, step) || !(p[1] + step[1] > 0)) {
+				damping *= 10;
+				if(damping > MAX_DAMPING) break;
+				continue;
+			}
+			double trial[4] = { p[0] + step[0], p[1] + step[1], p[2] + step[2], p[3] + step[3] };
+			double trialAlpha[10], trialBeta[4];
+			double trialChiSquare = accumulate(samples, direction, trial, end, begin, trialAlpha, trialBeta);
+			if(!(trialChiSquare <= chiSquare)) {
+				damping *= 10;
+				if(damping > MAX_DAMPING) break;
+				continue;
+			}
+			// The decrease the quadratic model expects, 0.5*beta.step for a
+			// Gauss-Newton step
+			double edm = 0;
+			for (int k = 0; k < 4; ++k) edm += 0.5*beta[k]*step[k];
+			std::copy(trial, trial + 4, p);
+			std::copy(trialAlpha, trialAlpha + 10, alpha);
+			std::copy(trialBeta, trialBeta + 4, beta);
+			chiSquare = trialChiSquare;
+			damping = (damping/10 > MIN_DAMPING)?damping/10:MIN_DAMPING;
+			if(edm < EDM_TOLERANCE) {
+				status = FIT;
+				break;
+			}
+		}
+		result.t0 = p[0];
+		result.duration = p[1];
+		result.lo = p[2];
+		result.rng = p[3];
+		result.chiSquare = chiSquare;
+		result.status = status;
+		return status;
+	}
+
+	// The model of a fit at every sample, as fitTemplateModel() returns it
+	void predict(const TemplateFitResult &result, double direction, double *prediction) const
+	{
+		for (size_t i = 0; i < this->_nsamples; ++i)
+		{
+			double s = direction*(i - result.t0)/result.duration;
+			double t = 1, derivative;
+			if(std::fabs(s) < this->_reach) this->_spline.evaluate(s, t, derivative);
+			prediction[i] = result.lo + result.rng*t;
+		}
+	}
+
+	// Fits frame i of arena k from quick fit quick[k][i] into fits[k][i] for
+	// every frame, on all the pool's threads
+	static void fitAll(ThreadPool &pool, const std::vector<FrameArena> &frames,
+		const std::vector<std::vector<QuickFitResult> > &quick, const SplineTemplate &spline,
+		std::vector<std::vector<TemplateFitResult> > &fits, int nfingers = QuickFitter::DEFAULT_FINGERS)
+	{
+		fits.resize(frames.size());
+		std::vector<size_t> firstBatch(frames.size() + 1, 0);
+		for (size_t k = 0; k < frames.size(); ++k)
+		{
+			fits[k].resize(frames[k].size());
+			firstBatch[k + 1] = firstBatch[k] + (frames[k].size() + BATCH_FRAMES - 1)/BATCH_FRAMES;
+		}
+		if(frames.empty()) return;
+		TemplateFitter fitter(frames[0].getFrameLength(), spline);
+		pool.run(firstBatch.back(), [&](size_t b, unsigned) {
+			size_t k = std::upper_bound(firstBatch.begin(), firstBatch.end(), b) - firstBatch.begin() - 1;
+			size_t begin = (b - firstBatch[k])*BATCH_FRAMES;
+			size_t end = std::min(begin + BATCH_FRAMES, frames[k].size());
+			for (size_t i = begin; i < end; ++i)
+			{
+				fitter.fit(frames[k].getFrame(i), quick[k][i], nfingers, fits[k][i]);
+			}
+		});
+	}
+
+private:
+	// The chi-square at p over [0,end) and [begin,n), with the upper triangle
+	// of J^T J in alpha and J^T r in beta, J the derivatives of the model.
+	// With k = -rng*direction/duration, a sample at s where the template is t
+	// with derivative t' has J = (k*t', k*direction*s*t', 1, t): the sums are
+	// taken over t', s and t and scaled afterwards.
+	double accumulate(const uint16_t *samples, double direction, const double p[4],
+		long end, long begin, double alpha[10], double beta[4]) const
+	{
+		double t0 = p[0], duration = p[1], lo = p[2], rng = p[3];
+		double scale = direction/duration;
+		double reach = this->_reach;
+		double count = 0, sumR = 0, sumRR = 0, sumT = 0, sumTT = 0, sumTR = 0;
+		double sumD = 0, sumDD = 0, sumDS = 0, sumDDS = 0, sumDDSS = 0;
+		double sumDT = 0, sumDST = 0, sumDR = 0, sumDSR = 0;
+		for (int range = 0; range < 2; ++range)
+		{
+			long from = (range == 0)?0:begin;
+			long to = (range == 0)?end:(long)this->_nsamples;
+			count += to - from;
+			for (long i = from; i < to; ++i)
+			{
+				double s = (i - t0)*scale;
+				// Beyond the template the model is lo + rng, with t' = 0.  The spline
+				// is evaluated either way, which keeps the loop free of branches.
+				double t, derivative;
+				this->_spline.evaluate(s, t, derivative);
+				bool inside = std::fabs(s) < reach;
+				t = inside?t:1;
+				derivative = inside?derivative:0;
+				double r = samples[i] - (lo + rng*t);
+				double ds = derivative*s;
+				sumR += r;
+				sumRR += r*r;
+				sumT += t;
+				sumTT += t*t;
+				sumTR += t*r;
+				sumD += derivative;
+				sumDD += derivative*derivative;
+				sumDS += ds;
+				sumDDS += derivative*ds;
+				sumDDSS += ds*ds;
+				sumDT += derivative*t;
+				sumDST += ds*t;
+				sumDR += derivative*r;
+				sumDSR += ds*r;
+			}
+		}
+		double k = -rng*scale;
+		double kd = k*direction;
+		alpha[0] = k*k*sumDD;
+		alpha[1] = k*kd*sumDDS;
+		alpha[2] = k*sumD;
+		alpha[3] = k*sumDT;
+		alpha[4] = kd*kd*sumDDSS;
+		alpha[5] = kd*sumDS;
+		alpha[6] = kd*sumDST;
+		alpha[7] = count;
+		alpha[8] = sumT;
+		alpha[9] = sumTT;
+		beta[0] = k*sumDR;
+		beta[1] = kd*sumDSR;
+		beta[2] = sumR;
+		beta[3] = sumTR;
+		return sumRR;
+	}
+
+	// A slice bound as Python takes it, from the end if negative
+	static long pythonIndex(long index, long n)
+	{
+		if(index < 0) index = std::max(index + n, 0L);
+		return std::min(index, n);
+	}
+
+	// Solves (alpha + damping*diag(alpha)) step = beta by Cholesky
+	static bool solve(const double alpha[10], const double beta[4], double damping, double step[4])
+	{
+		static const int at[4][4] = { { 0, 1, 2, 3 }, { 1, 4, 5, 6 }, { 2, 5, 7, 8 }, { 3, 6, 8, 9 } };
+		double l[4][4] = {{0}};
+		for (int u = 0; u < 4; ++u)
+		{
+			for (int v = 0; v <= u; ++v)
+			{
+				double sum = alpha[at[u][v]]*((u == v)?(1 + damping):1);
+				for (int k = 0; k < v; ++k) sum -= l[u][k]*l[v][k];
+				if(u == v) {
+					if(!(sum > 0)) return false;
+					l[u][u] = std::sqrt(sum);
+				} else {
+					l[u][v] = sum/l[v][v];
+				}
+			}
+		}
+		double y[4];
+		for (int u = 0; u < 4; ++u)
+		{
+			y[u] = beta[u];
+			for (int k = 0; k < u; ++k) y[u] -= l[u][k]*y[k];
+			y[u] /= l[u][u];
+		}
+		for (int u = 3; u >= 0; --u)
+		{
+			step[u] = y[u];
+			for (int k = u + 1; k < 4; ++k) step[u] -= l[k][u]*step[k];
+			step[u] /= l[u][u];
+		}
+		return true;
+	}
+
+	size_t _nsamples;
+	const SplineTemplate &_spline;
+	double _reach;
+};
+
+#endif
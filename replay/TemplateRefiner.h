@@ -0,0 +1,102 @@
+/*
+Online refinement of a template
+
+Starts from a template (see TemplateFit.h) and folds in every frame whose
+template fit converged: the frame is mapped to the template's s with the
+fitted t0 and duration, resampled on the template's grid (see
+TemplateBuilder.h) and normalized with the fitted lo and rng.  The template
+is the weighted mean of the frames, each weight scaled by forgetting for
+every frame after it, so with forgetting below 1 it follows slow drifts of
+the fiducial and sensor with a memory of about 1/(1 - forgetting) frames.
+The starting template counts as interval frames.
+
+Every interval frames a new template is published: a fresh SplineTemplate
+swapped in atomically, which readers on any thread take with getTemplate()
+and keep for as long as they use it.  Frames are added from one thread.
+*/
+
+#ifndef TEMPLATEREFINER_H
+#define TEMPLATEREFINER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "TemplateBuilder.h"
+#include "TemplateFit.h"
+
+class TemplateRefiner
+{
+public:
+	static const uint64_t DEFAULT_INTERVAL = 1000;
+
+	TemplateRefiner(const SplineTemplate &initial, size_t nsamples, uint64_t interval = DEFAULT_INTERVAL,
+		double forgetting = 1) : _resampler(nsamples), _version(0)
+	{
+		this->_interval = interval?interval:1;
+		this->_forgetting = forgetting;
+		this->_grid = initial.getKnots();
+		this->_mean = initial.getValues();
+		this->_frame.resize(this->_grid.size());
+		this->_weight = (double)this->_interval;
+		this->_added = 0;
+		std::atomic_store(&this->_published, std::make_shared<const SplineTemplate>(initial));
+	}
+
+	// Folds in a frame with its template fit.  Returns true if that published
+	// a new template.
+	bool add(const uint16_t *samples, double direction, const TemplateFitResult &fit)
+	{
+		if(fit.status != TemplateFitter::FIT || !(fit.rng != 0)) return false;
+		std::fill(this->_frame.begin(), this->_frame.end(), 0);
+		if(!this->_resampler.add(samples, direction, fit.t0, fit.duration, this->_grid, 1, this->_frame)) return false;
+		this->_weight = this->_forgetting*this->_weight + 1;
+		double gain = 1/this->_weight;
+		for (size_t i = 0; i < this->_mean.size(); ++i)
+		{
+			double value = (this->_frame[i] - fit.lo)/fit.rng;
+			this->_mean[i] += gain*(value - this->_mean[i]);
+		}
+		if(++this->_added % this->_interval != 0) return false;
+		std::shared_ptr<SplineTemplate> spline = std::make_shared<SplineTemplate>();
+		if(!spline->set(this->_grid, this->_mean)) return false;
+		std::atomic_store(&this->_published, std::shared_ptr<const SplineTemplate>(spline));
+		++this->_version;
+		return true;
+	}
+
+	// The latest published template
+	std::shared_ptr<const SplineTemplate> getTemplate() const
+	{
+		return std::atomic_load(&this->_published);
+	}
+
+	// Templates published since the starting one
+	uint64_t getVersion() const
+	{
+		return this->_version;
+	}
+
+	// Frames folded in
+	uint64_t getFrames() const
+	{
+		return this->_added;
+	}
+
+private:
+	FrameResampler _resampler;
+	std::atomic<uint64_t> _version;
+	uint64_t _interval;
+	double _forgetting;
+	std::vector<double> _grid;
+	std::vector<double> _mean;
+	// Scratch for one resampled frame
+	std::vector<double> _frame;
+	double _weight;
+	uint64_t _added;
+	std::shared_ptr<const SplineTemplate> _published;
+};
+
+#endif
@@ -0,0 +1,194 @@
+/*
+Streaming Welch spectra
+
+learn/learn.py finds the periodicities of the gear train in a periodogram of
+a whole dump.  A WelchSpectrum instead averages the periodograms of segments
+of the series as they fill up, as scipy.signal.welch(values, fs, nperseg=
+segment, detrend='linear') does: segments of a power of 2 samples overlapping
+by half, each detrended by a least squares line, multiplied by a periodic
+Hann window and transformed by a radix 2 FFT into a one-sided power spectral
+density.  Only the last segment of samples and the mean density are kept,
+so memory is O(segment) however long the run, and the spectrum and its
+dominant frequencies can be had between any two samples.
+*/
+
+#ifndef WELCHSPECTRUM_H
+#define WELCHSPECTRUM_H
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct SpectralPeak
+{
+	double frequency;
+	double psd;
+};
+
+class WelchSpectrum
+{
+public:
+	// Samples per segment, a little over 2 hours of swings
+	static const size_t DEFAULT_SEGMENT = 8192;
+
+	// segment is rounded up to a power of 2
+	WelchSpectrum(double sampleRate, size_t segment = DEFAULT_SEGMENT)
+	{
+		size_t n = 2;
+		while(n < segment) n <<= 1;
+		this->_sampleRate = sampleRate;
+		this->_samples = 0;
+		this->_segments = 0;
+		this->_buffer.assign(n, 0);
+		this->_psd.assign(n/2 + 1, 0);
+		this->_transform.resize(n);
+		this->_window.resize(n);
+		double squares = 0;
+		for (size_t i = 0; i < n; ++i)
+		{
+			this->_window[i] = 0.5 - 0.5*std::cos(2*M_PI*i/n);
+			squares += this->_window[i]*this->_window[i];
+		}
+		this->_scale = 1/(sampleRate*squares);
+		this->_twiddles.resize(n/2);
+		for (size_t i = 0; i < n/2; ++i)
+		{
+			this->_twiddles[i] = std::polar(1., -2*M_PI*i/n);
+		}
+		this->_reversed.resize(n);
+		int bits = 0;
+		while(((size_t)1 << bits) < n) ++bits;
+		for (size_t i = 0; i < n; ++i)
+		{
+			size_t r = 0;
+			for (int b = 0; b < bits; ++b) r |= ((i >> b) & 1) << (bits - 1 - b);
+			this->_reversed[i] = r;
+		}
+	}
+
+	void add(double value)
+	{
+		size_t n = this->_buffer.size();
+		this->_buffer[this->_samples % n] = value;
+		++this->_samples;
+		if(this->_samples >= n && this->_samples % (n/2) == 0) addSegment();
+	}
+
+	// Samples added
+	uint64_t size() const
+	{
+		return this->_samples;
+	}
+
+	// Segments averaged
+	uint64_t getSegments() const
+	{
+		return this->_segments;
+	}
+
+	size_t getSegmentLength() const
+	{
+		return this->_buffer.size();
+	}
+
+	// The mean density at frequencies k*sampleRate/segment for k = 0 to
+	// segment/2, in units of the values squared per unit of sampleRate.
+	// Returns false before a segment is complete.
+	bool getSpectrum(std::vector<double> &frequencies, std::vector<double> &psd) const
+	{
+		if(this->_segments == 0) return false;
+		frequencies.resize(this->_psd.size());
+		for (size_t k = 0; k < frequencies.size(); ++k)
+		{
+			frequencies[k] = k*this->_sampleRate/this->_buffer.size();
+		}
+		psd = this->_psd;
+		return true;
+	}
+
+	// Up to count local maxima of the mean density above zero frequency,
+	// strongest first
+	void getDominant(size_t count, std::vector<SpectralPeak> &peaks) const
+	{
+		peaks.clear();
+		if(this->_segments == 0) return;
+		const std::vector<double> &psd = this->_psd;
+		for (size_t k = 1; k < psd.size(); ++k)
+		{
+			if(psd[k] < psd[k - 1] || (k + 1 < psd.size() && psd[k] <= psd[k + 1])) continue;
+			SpectralPeak peak;
+			peak.frequency = k*this->_sampleRate/this->_buffer.size();
+			peak.psd = psd[k];
+			peaks.push_back(peak);
+		}
+		std::sort(peaks.begin(), peaks.end(), [](const SpectralPeak &a, const SpectralPeak &b) {
+			return a.psd > b.psd;
+		});
+		if(peaks.size() > count) peaks.resize(count);
+	}
+
+private:
+	// Folds the periodogram of the last segment samples into the mean
+	void addSegment()
+	{
+		size_t n = this->_buffer.size();
+		// Oldest first, less the least squares line through them
+		size_t first = this->_samples % n;
+		double sum = 0, weighted = 0;
+		for (size_t i = 0; i < n; ++i)
+		{
+			double value = this->_buffer[(first + i) % n];
+			sum += value;
+			weighted += (i - 0.5*(n - 1))*value;
+		}
+		double mean = sum/n;
+		double slope = weighted/(n*((double)n*n - 1)/12);
+		for (size_t i = 0; i < n; ++i)
+		{
+			double value = this->_buffer[(first + i) % n] - mean - slope*(i - 0.5*(n - 1));
+			this->_transform[this->_reversed[i]] = this->_window[i]*value;
+		}
+		// In place, from the bit reversed order
+		for (size_t length = 2; length <= n; length <<= 1)
+		{
+			size_t half = length/2;
+			size_t step = n/length;
+			for (size_t start = 0; start < n; start += length)
+			{
+				for (size_t j = 0; j < half; ++j)
+				{
+					std::complex<double> odd = this->_twiddles[j*step]*this->_transform[start + j + half];
+					this->_transform[start + j + half] = this->_transform[start + j] - odd;
+					this->_transform[start + j] += odd;
+				}
+			}
+		}
+		++this->_segments;
+		double gain = 1./this->_segments;
+		for (size_t k = 0; k < this->_psd.size(); ++k)
+		{
+			double density = std::norm(this->_transform[k])*this->_scale;
+			// One-sided, but for zero and the Nyquist frequency
+			if(k != 0 && k != n/2) density *= 2;
+			this->_psd[k] += gain*(density - this->_psd[k]);
+		}
+	}
+
+	double _sampleRate;
+	uint64_t _samples;
+	uint64_t _segments;
+	// Ring of the last segment samples
+	std::vector<double> _buffer;
+	std::vector<double> _psd;
+	std::vector<std::complex<double> > _transform;
+	std::vector<double> _window;
+	// 1/(sampleRate*sum of the window squared)
+	double _scale;
+	std::vector<std::complex<double> > _twiddles;
+	std::vector<size_t> _reversed;
+};
+
+#endif
@@ -0,0 +1,203 @@
+// Compressed archives of binaryPackets logs (see Archive.h)
+//
+//	./archive.out c [log=binaryPackets] [archive=binaryPackets.gar] [CIRCULAR_BUFFER_LENGTH]
+//	./archive.out x [archive=binaryPackets.gar] [log=binaryPackets.log]
+//	./archive.out t [archive=binaryPackets.gar] [template]
+//
+// c compresses the packets of a log, skipping damaged regions.  x writes them
+// back out as a log framed like node/logger.js writes it, one packet per
+// chunk after the leading zeroes.  t decodes every block on all cores and
+// reconstitutes and quick fits the frames (see QuickFit.h), to check an
+// archive and time replaying it.  Given a template filename, t also stacks the
+// fitted frames into a template and saves it (see TemplateBuilder.h), one
+// block at a time, so that archives of any length fit in memory.
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "Archive.h"
+#include "MappedFile.h"
+#include "PacketReader.h"
+#include "QuickFit.h"
+#include "Reconstituter.h"
+#include "TemplateBuilder.h"
+#include "ThreadPool.h"
+
+int compress(const char *logFilename, const char *archiveFilename, size_t rawLength);
+int extract(const char *archiveFilename, const char *logFilename);
+int test(const char *archiveFilename, const char *templateFilename);
+
+int main(int argc, char *argv[])
+{
+	const char *mode = (argc > 1)?argv[1]:"";
+	switch(*mode) {
+		case 'c':
+			return compress((argc > 2)?argv[2]:"binaryPackets", (argc > 3)?argv[3]:"binaryPackets.gar",
+				(argc > 4)?std::strtoul(argv[4],NULL,10):2042);
+		case 'x':
+			return extract((argc > 2)?argv[2]:"binaryPackets.gar", (argc > 3)?argv[3]:"binaryPackets.log");
+		case 't':
+			return test((argc > 2)?argv[2]:"binaryPackets.gar", (argc > 3)?argv[3]:NULL);
+	}
+	std::fprintf(stderr, "Usage: %s c|x|t [files]\n", argv[0]);
+	return 1;
+}
+
+double seconds(std::chrono::steady_clock::time_point begin)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+int compress(const char *logFilename, const char *archiveFilename, size_t rawLength)
+{
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	MappedFile log;
+	if(!log.open(logFilename)) {
+		std::perror(logFilename);
+		return 1;
+	}
+	ArchiveWriter writer;
+	if(!writer.open(archiveFilename, rawLength)) {
+		std::perror(archiveFilename);
+		return 1;
+	}
+
+	PacketReader reader(log.getData(), log.getSize(), rawLength);
+	reader.skip(100);
+	Packet packet;
+	uint64_t packets = 0;
+	uint64_t skippedBytes = 0;
+	for (;;)
+	{
+		PacketReader::Status status = reader.next(packet);
+		if(status == PacketReader::BAD_HEADER) {
+			SkippedRegion skipped;
+			bool found = reader.resync(skipped);
+			skippedBytes += skipped.streamBytes;
+			if(found) continue;
+		}
+		if(status != PacketReader::PACKET) break;
+		writer.add(packet);
+		++packets;
+	}
+	if(!writer.close()) {
+		std::perror(archiveFilename);
+		return 1;
+	}
+
+	double time = seconds(begin);
+	std::printf("Compressed %" PRIu64 " packets (%" PRIu64 " bytes skipped) from %zu to %" PRIu64 " bytes (%.2fx) in %f seconds (%f MB/s)\n",
+		packets, skippedBytes, log.getSize(), writer.getSize(), (double)log.getSize()/writer.getSize(), time,
+		log.getSize()/1048576./time);
+	return 0;
+}
+
+int extract(const char *archiveFilename, const char *logFilename)
+{
+	ArchiveReader archive;
+	if(!archive.open(archiveFilename)) {
+		std::fprintf(stderr, "%s: not a readable archive\n", archiveFilename);
+		return 1;
+	}
+	FILE *out = std::fopen(logFilename, "wb");
+	if(!out) {
+		std::perror(logFilename);
+		return 1;
+	}
+
+	// Leading zeroes, as the logger writes them
+	uint8_t zeroes[2 + 100] = { 100, 0 };
+	std::fwrite(zeroes, 1, sizeof(zeroes), out);
+	ArchiveBlockData block;
+	for (uint64_t b = 0; b < archive.getBlockCount(); ++b)
+	{
+		if(!archive.decode(b, block)) {
+			std::fprintf(stderr, "%s: block %" PRIu64 " is damaged\n", archiveFilename, b);
+			std::fclose(out);
+			return 1;
+		}
+		for (size_t k = 0; k < block.packets.size(); ++k)
+		{
+			const Packet &packet = block.packets[k];
+			uint8_t length[2] = { (uint8_t)(packet.size & 0xFF), (uint8_t)(packet.size >> 8) };
+			std::fwrite(length, 1, 2, out);
+			std::fwrite(packet.data, 1, packet.size, out);
+		}
+	}
+	bool ok = !std::ferror(out);
+	ok = (std::fclose(out) == 0) && ok;
+	if(!ok) {
+		std::perror(logFilename);
+		return 1;
+	}
+	std::printf("Extracted %" PRIu64 " packets to %s\n", archive.getPacketCount(), logFilename);
+	return 0;
+}
+
+int test(const char *archiveFilename, const char *templateFilename)
+{
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	ArchiveReader archive;
+	if(!archive.open(archiveFilename)) {
+		std::fprintf(stderr, "%s: not a readable archive\n", archiveFilename);
+		return 1;
+	}
+	size_t rawLength = archive.getRawLength();
+
+	ThreadPool pool(std::thread::hardware_concurrency());
+	std::vector<ArchiveBlockData> blocks(pool.size());
+	std::vector<Reconstituter> reconstituters(pool.size(), Reconstituter(rawLength));
+	std::vector<QuickFitter> fitters(pool.size(), QuickFitter(rawLength));
+	std::vector<TemplateBuilder> builders(templateFilename?pool.size():0, TemplateBuilder(rawLength));
+	std::vector<uint16_t> frames(pool.size()*rawLength);
+	std::atomic<uint64_t> packetBytes(0);
+	std::atomic<uint64_t> dataPackets(0);
+	std::atomic<uint64_t> fitted(0);
+	std::atomic<uint64_t> damaged(0);
+	pool.run(archive.getBlockCount(), [&](size_t b, unsigned worker) {
+		ArchiveBlockData &block = blocks[worker];
+		if(!archive.decode(b, block)) {
+			++damaged;
+			return;
+		}
+		uint64_t bytes = 0;
+		uint64_t data = 0;
+		uint64_t fits = 0;
+		QuickFitResult fit;
+		for (size_t k = 0; k < block.packets.size(); ++k)
+		{
+			const Packet &packet = block.packets[k];
+			bytes += packet.size;
+			if(packet.type != PacketReader::DATA_PACKET) continue;
+			++data;
+			uint16_t *frame = &frames[worker*rawLength];
+			if(reconstituters[worker].reconstitute(packet.data, frame) == Reconstituter::BAD_PHASE) continue;
+			if(fitters[worker].fit(frame, fit) != QuickFitter::FIT) continue;
+			++fits;
+			if(templateFilename) builders[worker].add(frame, fit);
+		}
+		packetBytes += bytes;
+		dataPackets += data;
+		fitted += fits;
+	});
+
+	double time = seconds(begin);
+	std::printf("Decoded %" PRIu64 " packets (%" PRIu64 " data, %" PRIu64 " quick fitted, %" PRIu64 " damaged blocks) in %f seconds (%f MB/s of packets)\n",
+		archive.getPacketCount(), (uint64_t)dataPackets, (uint64_t)fitted, (uint64_t)damaged, time, packetBytes/1048576./time);
+	if(templateFilename) {
+		for (size_t w = 1; w < builders.size(); ++w) builders[0].merge(builders[w]);
+		if(!builders[0].save(templateFilename)) {
+			std::fprintf(stderr, "%s: no template saved\n", templateFilename);
+			return 1;
+		}
+		std::printf("Template: %" PRIu64 " frames stacked into %s\n", builders[0].getFrames(), templateFilename);
+	}
+	return damaged?1:0;
+}
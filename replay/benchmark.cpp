@@ -0,0 +1,483 @@
+// Throughput of the replay path on recorded and synthetic logs
+//
+//	./benchmark.out [-j] [-q] [-r repeats] [-d frames.dat] [log[:CIRCULAR_BUFFER_LENGTH] ...]
+//
+// Every stage is timed on every fixture and the best of the repeats is
+// reported as one line per (fixture, stage), tab separated with a header line,
+// or with -j as one JSON object per line:
+//
+//	read			PacketReader over the whole log, resyncing after damage
+//	resync			PacketReader::align() from every chunk header, the scan
+//					ParallelReader starts its ranges with and resync() runs
+//	parallel		ParallelReader on all cores, as readBinaryPackets.out does
+//	reconstitute	read, plus every data packet reconstituted into a frame
+//	quickfit		reconstitute, plus a quick fit of every frame (see QuickFit.h)
+//	template		quickfit, plus every fitted frame stacked into a template
+//					(see TemplateBuilder.h)
+//	templatefit		quickfit, plus a template fit of every fitted frame (see
+//					TemplateFit.h), with the template of the fixture built first
+//	export			reconstitute into frame arenas, plus the fields of each
+//					packet, written out as numpy columns (see ColumnStore.h)
+//
+// MB/s counts log bytes (scanned bytes for resync) and packets/s the packets
+// handed out (alignments for resync).  Allocations are calls to operator new
+// during the run, per packet.
+//
+// The fixtures are built in memory (see LogFixture.h): the frames of
+// fit/NotchedFingersData.dat (or -d) and synthetic frames, at a few sizes and
+// rates of damaged packets, -q for the small ones only.  Logs named on the
+// command line are benchmarked as they are, with a corruption of -1 (unknown).
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include "ColumnStore.h"
+#include "LogFixture.h"
+#include "MappedFile.h"
+#include "PacketReader.h"
+#include "ParallelReader.h"
+#include "QuickFit.h"
+#include "Reconstituter.h"
+#include "TemplateBuilder.h"
+#include "TemplateFit.h"
+#include "ThreadPool.h"
+
+// As in readBinaryPackets.cpp
+#define RANGES_PER_THREAD 4
+// CIRCULAR_BUFFER_LENGTH of fit/NotchedFingersData.dat
+#define RECORDED_LENGTH 3072
+#define SYNTHETIC_LENGTH 2042
+#define SYNTHETIC_FRAMES 64
+
+std::atomic<uint64_t> allocations(0);
+
+// Not inlined, so that the compiler does not pair the malloc() and free()
+// inside with the operator new and delete calls of the library
+__attribute__((noinline)) void *operator new(size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	void *p = std::malloc(size ? size : 1);
+	if(!p) throw std::bad_alloc();
+	return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+struct Fixture
+{
+	std::string name;
+	size_t rawLength;
+	double corruption;
+	const uint8_t *data;
+	size_t size;
+};
+
+struct Measurement
+{
+	double seconds;
+	uint64_t bytes;
+	uint64_t packets;
+	uint64_t allocations;
+};
+
+typedef Measurement (*Stage)(const Fixture &fixture);
+
+Measurement readStage(const Fixture &fixture);
+Measurement resyncStage(const Fixture &fixture);
+Measurement parallelStage(const Fixture &fixture);
+Measurement reconstituteStage(const Fixture &fixture);
+Measurement quickFitStage(const Fixture &fixture);
+Measurement templateStage(const Fixture &fixture);
+Measurement templateFitStage(const Fixture &fixture);
+Measurement exportStage(const Fixture &fixture);
+void report(const Fixture &fixture, const char *stage, const Measurement &best, bool json);
+
+const struct
+{
+	const char *name;
+	Stage run;
+} stages[] = {
+	{ "read", readStage },
+	{ "resync", resyncStage },
+	{ "parallel", parallelStage },
+	{ "reconstitute", reconstituteStage },
+	{ "quickfit", quickFitStage },
+	{ "template", templateStage },
+	{ "templatefit", templateFitStage },
+	{ "export", exportStage }
+};
+
+std::string exportDirectory;
+
+int main(int argc, char *argv[])
+{
+	bool json = false;
+	bool quick = false;
+	int repeats = 3;
+	const char *framesFilename = "../fit/NotchedFingersData.dat";
+	int option;
+	while((option = getopt(argc, argv, "jqr:d:")) != -1)
+	{
+		if(option == 'j') {
+			json = true;
+		} else if(option == 'q') {
+			quick = true;
+		} else if(option == 'r') {
+			repeats = std::atoi(optarg);
+		} else if(option == 'd') {
+			framesFilename = optarg;
+		} else {
+			std::fprintf(stderr, "Usage: %s [-j] [-q] [-r repeats] [-d frames.dat] [log[:CIRCULAR_BUFFER_LENGTH] ...]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(repeats < 1) repeats = 1;
+
+	const char *tmp = std::getenv("TMPDIR");
+	std::string pattern = std::string((tmp && *tmp)?tmp:"/tmp") + "/replayBenchmark.XXXXXX";
+	std::vector<char> directory(pattern.begin(), pattern.end());
+	directory.push_back(0);
+	if(!mkdtemp(&directory[0])) {
+		std::perror(&directory[0]);
+		return 1;
+	}
+	exportDirectory = &directory[0];
+
+	// Fixtures are built one at a time, to keep the memory down
+	struct Spec
+	{
+		const char *name;
+		LogFixture *builder;
+		size_t megabytes;
+		double corruption;
+	};
+	std::vector<Spec> specs;
+	LogFixture recorded(RECORDED_LENGTH, 1);
+	if(recorded.loadFrames(framesFilename)) {
+		specs.push_back(Spec{ "recorded", &recorded, 16, 0 });
+		specs.push_back(Spec{ "recorded", &recorded, 16, 0.01 });
+	} else {
+		std::fprintf(stderr, "%s: no frames, skipping the recorded fixtures\n", framesFilename);
+	}
+	LogFixture synthetic(SYNTHETIC_LENGTH, 2);
+	synthetic.addSyntheticFrames(SYNTHETIC_FRAMES);
+	const size_t sizes[] = { 4, 64 };
+	const double corruptions[] = { 0, 0.01, 0.1 };
+	for (size_t s = 0; s < (quick?1:2); ++s)
+	{
+		for (size_t c = 0; c < sizeof(corruptions)/sizeof(corruptions[0]); ++c)
+		{
+			specs.push_back(Spec{ "synthetic", &synthetic, sizes[s], corruptions[c] });
+		}
+	}
+	if(quick) {
+		for (size_t i = 0; i < specs.size(); ++i)
+		{
+			if(specs[i].megabytes > 4) specs[i].megabytes = 4;
+		}
+	}
+
+	if(!json) {
+		std::printf("fixture\traw_length\tmegabytes\tcorruption\tstage\tseconds\tmb_per_s\tpackets\tpackets_per_s\tallocs_per_packet\n");
+	}
+	std::vector<uint8_t> log;
+	size_t count = specs.size() + argc - optind;
+	for (size_t i = 0; i < count; ++i)
+	{
+		Fixture fixture;
+		MappedFile file;
+		if(i < specs.size()) {
+			const Spec &spec = specs[i];
+			spec.builder->setCorruption(spec.corruption);
+			spec.builder->build(spec.megabytes << 20, log);
+			fixture.name = spec.name;
+			fixture.rawLength = spec.builder->getRawLength();
+			fixture.corruption = spec.corruption;
+			fixture.data = &log[0];
+			fixture.size = log.size();
+		} else {
+			// A log from the command line
+			std::string name = argv[optind + i - specs.size()];
+			size_t colon = name.rfind(':');
+			fixture.rawLength = SYNTHETIC_LENGTH;
+			if(colon != std::string::npos) {
+				fixture.rawLength = std::strtoul(name.c_str() + colon + 1, NULL, 10);
+				name.erase(colon);
+			}
+			if(!file.open(name.c_str())) {
+				std::perror(name.c_str());
+				continue;
+			}
+			fixture.name = name;
+			fixture.corruption = -1;
+			fixture.data = file.getData();
+			fixture.size = file.getSize();
+		}
+
+		for (size_t s = 0; s < sizeof(stages)/sizeof(stages[0]); ++s)
+		{
+			Measurement best = stages[s].run(fixture);
+			for (int r = 1; r < repeats; ++r)
+			{
+				Measurement measurement = stages[s].run(fixture);
+				if(measurement.seconds < best.seconds) best = measurement;
+			}
+			report(fixture, stages[s].name, best, json);
+		}
+	}
+
+	rmdir(exportDirectory.c_str());
+	return 0;
+}
+
+double seconds(std::chrono::steady_clock::time_point begin)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+void report(const Fixture &fixture, const char *stage, const Measurement &best, bool json)
+{
+	double megabytes = best.bytes/1048576.;
+	double mbPerSecond = (best.seconds > 0)?megabytes/best.seconds:0;
+	double packetsPerSecond = (best.seconds > 0)?best.packets/best.seconds:0;
+	double allocsPerPacket = best.packets?(double)best.allocations/best.packets:0;
+	if(json) {
+		std::printf("{\"fixture\": \"%s\", \"raw_length\": %zu, \"megabytes\": %.3f, \"corruption\": %g, \"stage\": \"%s\", "
+			"\"seconds\": %.6f, \"mb_per_s\": %.3f, \"packets\": %" PRIu64 ", \"packets_per_s\": %.1f, \"allocs_per_packet\": %.6f}\n",
+			fixture.name.c_str(), fixture.rawLength, fixture.size/1048576., fixture.corruption, stage, best.seconds,
+			mbPerSecond, best.packets, packetsPerSecond, allocsPerPacket);
+	} else {
+		std::printf("%s\t%zu\t%.3f\t%g\t%s\t%.6f\t%.3f\t%" PRIu64 "\t%.1f\t%.6f\n", fixture.name.c_str(), fixture.rawLength,
+			fixture.size/1048576., fixture.corruption, stage, best.seconds, mbPerSecond, best.packets, packetsPerSecond,
+			allocsPerPacket);
+	}
+	std::fflush(stdout);
+}
+
+Measurement readStage(const Fixture &fixture)
+{
+	uint64_t allocated = allocations;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	PacketReader reader(fixture.data, fixture.size, fixture.rawLength);
+	reader.skip(LogFixture::ZEROES);
+	Packet packet;
+	uint64_t packets = 0;
+	for (;;)
+	{
+		PacketReader::Status status = reader.next(packet);
+		if(status == PacketReader::BAD_HEADER) {
+			SkippedRegion skipped;
+			if(reader.resync(skipped)) continue;
+		}
+		if(status != PacketReader::PACKET) break;
+		++packets;
+	}
+	Measurement measurement = { seconds(begin), fixture.size, packets, allocations - allocated };
+	return measurement;
+}
+
+Measurement resyncStage(const Fixture &fixture)
+{
+	uint64_t allocated = allocations;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	PacketReader reader(fixture.data, fixture.size, fixture.rawLength);
+	uint64_t scanned = 0;
+	uint64_t alignments = 0;
+	// The first chunk is the leading zeroes
+	uint64_t header = 2 + (fixture.data[0] | (fixture.data[1] << 8));
+	while(header + 2 <= fixture.size)
+	{
+		StreamPosition start = { header, 0 };
+		reader.seek(start);
+		if(reader.align()) {
+			scanned += reader.getPosition().offset - header;
+			++alignments;
+		}
+		header += 2 + (fixture.data[header] | (fixture.data[header + 1] << 8));
+	}
+	Measurement measurement = { seconds(begin), scanned, alignments, allocations - allocated };
+	return measurement;
+}
+
+Measurement parallelStage(const Fixture &fixture)
+{
+	uint64_t allocated = allocations;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	ThreadPool pool(std::thread::hardware_concurrency());
+	PacketReader reader(fixture.data, fixture.size, fixture.rawLength);
+	reader.skip(LogFixture::ZEROES);
+	ParallelReader ranges(fixture.data, fixture.size, fixture.rawLength, reader.getPosition(), pool.size()*RANGES_PER_THREAD);
+	std::vector<uint64_t> packets(ranges.size(), 0);
+	ranges.run(pool,
+		[&](size_t k, const Packet &) { ++packets[k]; },
+		[&](size_t, const SkippedRegion &) {},
+		[&](size_t k) { packets[k] = 0; });
+	uint64_t total = 0;
+	for (size_t k = 0; k < packets.size(); ++k) total += packets[k];
+	Measurement measurement = { seconds(begin), fixture.size, total, allocations - allocated };
+	return measurement;
+}
+
+Measurement reconstituteStage(const Fixture &fixture)
+{
+	uint64_t allocated = allocations;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	PacketReader reader(fixture.data, fixture.size, fixture.rawLength);
+	reader.skip(LogFixture::ZEROES);
+	Reconstituter reconstituter(fixture.rawLength);
+	std::vector<uint16_t> frame(fixture.rawLength);
+	Packet packet;
+	uint64_t packets = 0;
+	for (;;)
+	{
+		PacketReader::Status status = reader.next(packet);
+		if(status == PacketReader::BAD_HEADER) {
+			SkippedRegion skipped;
+			if(reader.resync(skipped)) continue;
+		}
+		if(status != PacketReader::PACKET) break;
+		if(packet.type == PacketReader::DATA_PACKET) reconstituter.reconstitute(packet.data, &frame[0]);
+		++packets;
+	}
+	Measurement measurement = { seconds(begin), fixture.size, packets, allocations - allocated };
+	return measurement;
+}
+
+// Reads the fixture, calling visit(frame, fit) with the quick fit of every
+// data packet that reconstitutes.  Returns the packets read.
+template <class Visit>
+uint64_t quickFitFrames(const Fixture &fixture, Visit visit)
+{
+	PacketReader reader(fixture.data, fixture.size, fixture.rawLength);
+	reader.skip(LogFixture::ZEROES);
+	Reconstituter reconstituter(fixture.rawLength);
+	QuickFitter fitter(fixture.rawLength);
+	QuickFitResult fit;
+	std::vector<uint16_t> frame(fixture.rawLength);
+	Packet packet;
+	uint64_t packets = 0;
+	for (;;)
+	{
+		PacketReader::Status status = reader.next(packet);
+		if(status == PacketReader::BAD_HEADER) {
+			SkippedRegion skipped;
+			if(reader.resync(skipped)) continue;
+		}
+		if(status != PacketReader::PACKET) break;
+		++packets;
+		if(packet.type != PacketReader::DATA_PACKET) continue;
+		if(reconstituter.reconstitute(packet.data, &frame[0]) == Reconstituter::BAD_PHASE) continue;
+		fitter.fit(&frame[0], fit);
+		visit(&frame[0], fit);
+	}
+	return packets;
+}
+
+Measurement quickFitStage(const Fixture &fixture)
+{
+	uint64_t allocated = allocations;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	uint64_t packets = quickFitFrames(fixture, [](const uint16_t *, const QuickFitResult &) {});
+	Measurement measurement = { seconds(begin), fixture.size, packets, allocations - allocated };
+	return measurement;
+}
+
+Measurement templateStage(const Fixture &fixture)
+{
+	uint64_t allocated = allocations;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	TemplateBuilder builder(fixture.rawLength);
+	uint64_t packets = quickFitFrames(fixture, [&](const uint16_t *frame, const QuickFitResult &fit) {
+		builder.add(frame, fit);
+	});
+	SplineTemplate spline;
+	builder.build(spline);
+	Measurement measurement = { seconds(begin), fixture.size, packets, allocations - allocated };
+	return measurement;
+}
+
+Measurement templateFitStage(const Fixture &fixture)
+{
+	TemplateBuilder builder(fixture.rawLength);
+	quickFitFrames(fixture, [&](const uint16_t *frame, const QuickFitResult &fit) {
+		builder.add(frame, fit);
+	});
+	SplineTemplate spline;
+	builder.build(spline);
+
+	uint64_t allocated = allocations;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	TemplateFitter fitter(fixture.rawLength, spline);
+	TemplateFitResult result;
+	uint64_t packets = quickFitFrames(fixture, [&](const uint16_t *frame, const QuickFitResult &fit) {
+		if(!spline.empty()) fitter.fit(frame, fit, QuickFitter::DEFAULT_FINGERS, result);
+	});
+	Measurement measurement = { seconds(begin), fixture.size, packets, allocations - allocated };
+	return measurement;
+}
+
+Measurement exportStage(const Fixture &fixture)
+{
+	uint64_t allocated = allocations;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	PacketReader reader(fixture.data, fixture.size, fixture.rawLength);
+	reader.skip(LogFixture::ZEROES);
+	Reconstituter reconstituter(fixture.rawLength);
+	FrameArena frames(fixture.rawLength, fixture.size/reader.getPacketSize(PacketReader::DATA_PACKET) + 1);
+	std::vector<Telemetry> telemetry;
+	std::vector<double> bootTimes;
+	Packet packet;
+	uint64_t packets = 0;
+	for (;;)
+	{
+		PacketReader::Status status = reader.next(packet);
+		if(status == PacketReader::BAD_HEADER) {
+			SkippedRegion skipped;
+			if(reader.resync(skipped)) continue;
+		}
+		if(status != PacketReader::PACKET) break;
+		++packets;
+		if(packet.type == PacketReader::BOOT_PACKET) {
+			bootTimes.push_back(PacketIndex::getBootTime(packet.data, 0));
+			continue;
+		}
+		uint16_t *frame = frames.append();
+		if(reconstituter.reconstitute(packet.data, frame) == Reconstituter::BAD_PHASE) {
+			frames.pop();
+			continue;
+		}
+		telemetry.push_back(Telemetry());
+		telemetry.back().parse(DataPacketView(packet.data, fixture.rawLength), (uint32_t)bootTimes.size());
+	}
+	ColumnStore store(exportDirectory);
+	store.addSegment(telemetry, frames, bootTimes);
+	if(!store.write()) std::perror(exportDirectory.c_str());
+	Measurement measurement = { seconds(begin), fixture.size, packets, allocations - allocated };
+
+	// Not timed
+	DIR *directory = opendir(exportDirectory.c_str());
+	if(directory) {
+		struct dirent *entry;
+		while((entry = readdir(directory)) != NULL)
+		{
+			if(*entry->d_name != '.') unlink((exportDirectory + "/" + entry->d_name).c_str());
+		}
+		closedir(directory);
+	}
+	return measurement;
+}
@@ -0,0 +1,62 @@
+// Quick fits frames stored as fit.py reads them, to check QuickFit.h against fit/frame.py
+//
+//	./quickFitFrames.out [frames=-] [samples per frame=3072] [nfingers=5]
+//
+// Frames are whitespace separated values, a samplesSinceBoot value followed by
+// the samples of the frame, as readBinaryPackets.out -f writes them and
+// fit/NotchedFingersData.dat holds them; - reads them from stdin.  Each frame
+// gives one line: the status of its fit (see QuickFitter::Status) and, for a
+// fit, its direction, lo, hi, height, t0 and then the rise and fall times of
+// each finger, in full precision.  fit/test_QuickFit.py compares these with
+// Frame.quickFit().
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "QuickFit.h"
+
+int main(int argc, char *argv[])
+{
+	const char *filename = (argc > 1)?argv[1]:"-";
+	size_t samplesPerFrame = (argc > 2)?std::strtoul(argv[2],NULL,10):3072;
+	int nfingers = (argc > 3)?std::atoi(argv[3]):QuickFitter::DEFAULT_FINGERS;
+	if(samplesPerFrame == 0) {
+		std::fprintf(stderr, "Usage: %s [frames] [samples per frame] [nfingers]\n", argv[0]);
+		return 1;
+	}
+	FILE *in = std::strcmp(filename, "-")?std::fopen(filename, "r"):stdin;
+	if(!in) {
+		std::perror(filename);
+		return 1;
+	}
+
+	QuickFitter fitter(samplesPerFrame, nfingers);
+	QuickFitResult result;
+	std::vector<uint16_t> frame;
+	double value;
+	bool header = true;
+	while(std::fscanf(in, "%lf", &value) == 1)
+	{
+		if(header) {
+			header = false;
+			continue;
+		}
+		frame.push_back((uint16_t)value);
+		if(frame.size() < samplesPerFrame) continue;
+		QuickFitter::Status status = fitter.fit(&frame[0], result);
+		std::printf("%d", (int)status);
+		if(status == QuickFitter::FIT) {
+			std::printf(" %.17g %.17g %.17g %.17g %.17g", result.direction, result.lo, result.hi, result.height, result.t0);
+			for (int i = 0; i < fitter.getFingers(); ++i) std::printf(" %.17g", result.rise[i]);
+			for (int i = 0; i < fitter.getFingers(); ++i) std::printf(" %.17g", result.fall[i]);
+		}
+		std::printf("\n");
+		frame.clear();
+		header = true;
+	}
+	if(in != stdin) std::fclose(in);
+	return 0;
+}
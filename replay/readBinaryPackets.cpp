@@ -0,0 +1,617 @@
+// Replays a binaryPackets log written by node/logger.js
+//
+//	./readBinaryPackets.out [-q | -t template] [-s template] [-u interval[:forgetting]] [-a] [-w] [-e forgetting] [-o directory | -f] [file] [CIRCULAR_BUFFER_LENGTH] [from [to]]
+//
+// The log is memory mapped and packets are read in place (see PacketReader.h).
+// Damaged regions are skipped and reported as byte ranges of the file.  The
+// whole log is read in byte ranges on all cores (see ParallelReader.h) and
+// its data packets are reconstituted into 10 bit frames (see Reconstituter.h).
+// With -o, the frames and the fields of the data packets are exported to the
+// directory as numpy arrays (see ColumnStore.h).  With -q, every frame is
+// also quick fitted as fit/frame.py does (see QuickFit.h), on all cores, and
+// the fits are exported with the frames.  With -t, the quick fits are then
+// refined by a template fit as fit.py --load-template does (see TemplateFit.h).
+// With -s, a template is built from the quick fitted frames on all cores and
+// saved as fit.py --save-template does (see TemplateBuilder.h).  With -a, the
+// periods of the pendulum are found from the fits as fit.py finds them (see
+// PeriodTracker.h) and their Allan deviations are reported (see
+// AllanDeviation.h).  With -w, the Welch spectra of the periods and swings are
+// averaged and their dominant periodicities reported (see WelchSpectrum.h).
+// With -e, the periods are corrected for the environment of their packets by
+// recursive least squares with a forgetting factor (see
+// EnvironmentCorrector.h), and the coefficients reported and exported.
+//
+// With -f, the log is followed as node/logger.js appends to it, from its end
+// or from the from bound, and every data packet is written to stdout as soon
+// as it is complete, as the logger feeds fit.py: samplesSinceBoot and then the
+// reconstituted frame, one value per line.  Messages go to stderr.  With -t
+// and -s, the frames are also fitted and refine the -t template online (see
+// TemplateRefiner.h), which is saved to the -s file every interval frames
+// (-u, 1000 by default, with a forgetting factor of 1 unless given).  With -a,
+// -w or -e, the frames are fitted, with the -t template if given, and what is
+// made of the periods so far is reported to stderr every hour of periods.
+//
+// With from (and to), only the packets in [from, to) are read, found through
+// the sidecar index (see PacketIndex.h), which is built or extended first.
+// They are read in one range and go through the same steps as the whole log.
+// Bounds are o<ordinal>, e<boot epoch>, s<boot epoch>:<sequenceNumber> or
+// t<GPS seconds since the Unix epoch>.
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "AllanDeviation.h"
+#include "ColumnStore.h"
+#include "EnvironmentCorrector.h"
+#include "FileFollower.h"
+#include "MappedFile.h"
+#include "PacketIndex.h"
+#include "PacketReader.h"
+#include "ParallelReader.h"
+#include "QuickFit.h"
+#include "PeriodTracker.h"
+#include "Reconstituter.h"
+#include "TemplateBuilder.h"
+#include "TemplateFit.h"
+#include "TemplateRefiner.h"
+#include "WelchSpectrum.h"
+
+// Ranges per thread, so that a slow range does not hold up the others
+#define RANGES_PER_THREAD 4
+// Periods kept between reports when following, about an hour
+#define REPORT_PERIODS 3600
+// Periodicities reported from each spectrum
+#define DOMINANT_PERIODICITIES 5
+
+struct RangeResult
+{
+	uint64_t bootPackets;
+	uint64_t dataPackets;
+	uint64_t outOfRange;
+	uint64_t badPhase;
+	std::vector<SkippedRegion> skipped;
+	// Only kept for an export or the periods
+	std::vector<Telemetry> telemetry;
+	std::vector<double> bootTimes;
+};
+
+// What is made of the periods of the fitted frames
+struct PeriodAnalysis
+{
+	PeriodTracker tracker;
+	uint64_t kept;
+	// Of the kept periods, and of the amplitudes of their frames if template fitted
+	double periodSum;
+	double amplitudeSum;
+	uint64_t amplitudes;
+	std::unique_ptr<AllanDeviation> allan;
+	// Of the periods in ppm and the swings in arcmin, a value per swing
+	std::unique_ptr<WelchSpectrum> periodSpectrum;
+	std::unique_ptr<WelchSpectrum> swingSpectrum;
+	std::unique_ptr<EnvironmentCorrector> corrector;
+
+	PeriodAnalysis() : kept(0), periodSum(0), amplitudeSum(0), amplitudes(0) {}
+};
+
+int follow(const char *filename, size_t rawLength, StreamPosition position, const SplineTemplate &spline,
+	TemplateRefiner *refiner, const char *templateFilename, PeriodAnalysis *analysis);
+bool addPeriod(PeriodAnalysis &analysis, uint64_t samplesSinceBoot, const Environment &environment,
+	const QuickFitResult &quick, const TemplateFitResult *fit, EnvironmentCorrector::Result *correction);
+void printPeriods(FILE *out, const PeriodAnalysis &analysis);
+void printSpectrum(FILE *out, const char *name, const WelchSpectrum &spectrum);
+uint64_t findBound(const PacketIndex &index, const char *bound);
+void catch_function(int signo);
+
+std::atomic<uint64_t> bytesRead(0);
+
+int main(int argc, char *argv[])
+{
+	// Handle Signal
+	std::signal(SIGTSTP, catch_function);
+
+	// Timing
+	std::chrono::steady_clock::time_point begin, end;
+	double time_spent;
+	begin = std::chrono::steady_clock::now();
+
+	const char *exportDirectory = NULL;
+	bool following = false;
+	bool quickFit = false;
+	PeriodAnalysis analysis;
+	bool periods = false;
+	SplineTemplate spline;
+	const char *templateFilename = NULL;
+	uint64_t interval = TemplateRefiner::DEFAULT_INTERVAL;
+	double forgetting = 1;
+	int option;
+	while((option = getopt(argc, argv, "qt:s:u:awe:o:f")) != -1)
+	{
+		if(option == 'q') {
+			quickFit = true;
+		} else if(option == 't') {
+			if(!spline.load(optarg)) {
+				std::fprintf(stderr, "%s: not a template\n", optarg);
+				return 1;
+			}
+			quickFit = true;
+		} else if(option == 's') {
+			templateFilename = optarg;
+			quickFit = true;
+		} else if(option == 'u') {
+			char *end;
+			interval = std::strtoull(optarg, &end, 10);
+			if(*end == ':') forgetting = std::strtod(end + 1, NULL);
+		} else if(option == 'a') {
+			analysis.allan.reset(new AllanDeviation(PeriodTracker::NOMINAL_PERIOD));
+			periods = true;
+			quickFit = true;
+		} else if(option == 'w') {
+			// A period and swing every half period
+			analysis.periodSpectrum.reset(new WelchSpectrum(2/PeriodTracker::NOMINAL_PERIOD));
+			analysis.swingSpectrum.reset(new WelchSpectrum(2/PeriodTracker::NOMINAL_PERIOD));
+			periods = true;
+			quickFit = true;
+		} else if(option == 'e') {
+			analysis.corrector.reset(new EnvironmentCorrector(PeriodTracker::NOMINAL_PERIOD, std::strtod(optarg, NULL)));
+			periods = true;
+			quickFit = true;
+		} else if(option == 'o') {
+			exportDirectory = optarg;
+		} else if(option == 'f') {
+			following = true;
+		} else {
+			std::fprintf(stderr, "Usage: %s [-q | -t template] [-s template] [-u interval[:forgetting]] [-a] [-w] [-e forgetting] [-o directory | -f] [file] [CIRCULAR_BUFFER_LENGTH] [from [to]]\n", argv[0]);
+			return 1;
+		}
+	}
+	argc -= optind - 1;
+	argv += optind - 1;
+
+	const char *filename = (argc > 1)?argv[1]:"binaryPackets";
+	size_t rawLength = (argc > 2)?std::strtoul(argv[2],NULL,10):2042;
+
+	if(following) {
+		// Start after the last complete packet, or at the from bound
+		PacketIndex index;
+		if(index.update(filename, rawLength) < 0) {
+			std::perror("index");
+			return 1;
+		}
+		StreamPosition start = index.getResumePosition();
+		if(argc > 3) {
+			uint64_t first = findBound(index, argv[3]);
+			if(first < index.size()) start = index.getPosition(first);
+		}
+		if(templateFilename && spline.empty()) {
+			std::fprintf(stderr, "-s refines the -t template when following\n");
+			return 1;
+		}
+		std::unique_ptr<TemplateRefiner> refiner;
+		if(templateFilename) refiner.reset(new TemplateRefiner(spline, rawLength, interval, forgetting));
+		return follow(filename, rawLength, start, spline, refiner.get(), templateFilename, periods?&analysis:NULL);
+	}
+
+	// Open
+	MappedFile file;
+	if(!file.open(filename)) {
+		std::perror(filename);
+		return 1;
+	}
+	PacketReader reader(file.getData(), file.getSize(), rawLength);
+
+	uint64_t bootPackets = 0;
+	uint64_t dataPackets = 0;
+	uint64_t skippedRegions = 0;
+	uint64_t skippedBytes = 0;
+	uint64_t frameCount = 0;
+	uint64_t outOfRange = 0;
+	uint64_t badPhase = 0;
+
+	unsigned threads = std::thread::hardware_concurrency();
+	ThreadPool pool(threads);
+	std::vector<RangeResult> results;
+	std::vector<FrameArena> frames;
+	std::vector<Reconstituter> reconstituters;
+	struct stat info;
+	double modified = (stat(filename, &info) == 0)?(double)info.st_mtime:0;
+	// Counts a packet of range k, reconstituting its frame
+	auto addPacket = [&](size_t k, const Packet &packet) {
+		RangeResult &result = results[k];
+		if(packet.type == PacketReader::BOOT_PACKET) {
+			++result.bootPackets;
+			if(exportDirectory) result.bootTimes.push_back(PacketIndex::getBootTime(packet.data, modified));
+		} else {
+			++result.dataPackets;
+			uint16_t *frame = frames[k].append();
+			Reconstituter::Result reconstituted = reconstituters[k].reconstitute(packet.data, frame);
+			if(reconstituted == Reconstituter::OUT_OF_RANGE) ++result.outOfRange;
+			if(reconstituted == Reconstituter::BAD_PHASE) {
+				++result.badPhase;
+				frames[k].pop();
+			} else if(exportDirectory || periods) {
+				result.telemetry.push_back(Telemetry());
+				result.telemetry.back().parse(DataPacketView(packet.data, rawLength), (uint32_t)result.bootTimes.size());
+			}
+		}
+		bytesRead += packet.size;
+	};
+	PacketReader::Status status = PacketReader::END;
+	size_t rangeCount = 0;
+
+	if(argc > 3) {
+		// Packets in a window, found through the index and read as a single range
+		PacketIndex index;
+		long added = index.update(filename, rawLength);
+		if(added < 0) {
+			std::perror("index");
+			return 1;
+		}
+		uint64_t first = findBound(index, argv[3]);
+		uint64_t last = (argc > 4)?findBound(index, argv[4]):index.size();
+		std::printf("Index: %" PRIu64 " packets (%ld new), reading %" PRIu64 "-%" PRIu64 "\n",
+			index.size(), added, first, last);
+		uint64_t remaining = (last > first)?(last - first):0;
+		uint64_t startOffset = 0;
+		results.resize(1);
+		frames.push_back(FrameArena(rawLength, remaining + 1));
+		reconstituters.assign(1, Reconstituter(rawLength));
+		if(first < index.size()) {
+			reader.seek(index.getPosition(first));
+			startOffset = index[first].offset;
+			// Epochs count on from the boot packets before the window
+			uint32_t epochs = index[first].epoch - ((index[first].type == PacketReader::BOOT_PACKET)?1:0);
+			for (uint32_t epoch = 1; exportDirectory && epoch <= epochs; ++epoch)
+			{
+				results[0].bootTimes.push_back(index[index.findEpoch(epoch)].timestamp);
+			}
+		}
+
+		Packet packet;
+		while(remaining > 0)
+		{
+			status = reader.next(packet);
+			if(status == PacketReader::END || status == PacketReader::TRUNCATED) break;
+			if(status == PacketReader::BAD_HEADER) {
+				// Skip to the next packet that makes sense and keep going
+				SkippedRegion skipped;
+				bool found = reader.resync(skipped);
+				results[0].skipped.push_back(skipped);
+				if(!found) break;
+				continue;
+			}
+			addPacket(0, packet);
+			--remaining;
+		}
+		bytesRead = reader.getPosition().offset - startOffset;
+	} else {
+		// Read Zeroes
+		int zeroSize = 100;
+		reader.skip(zeroSize);
+
+		// Whole log, in ranges on all cores
+		ParallelReader ranges(file.getData(), file.getSize(), rawLength, reader.getPosition(),
+			pool.size()*RANGES_PER_THREAD);
+		results.resize(ranges.size());
+		reconstituters.assign(ranges.size(), Reconstituter(rawLength));
+		size_t dataPacketSize = reader.getPacketSize(PacketReader::DATA_PACKET);
+		for (size_t k = 0; k < ranges.size(); ++k)
+		{
+			frames.push_back(FrameArena(rawLength, ranges.getRangeBytes(k)/dataPacketSize + 1));
+		}
+		status = ranges.run(pool, addPacket,
+			[&](size_t k, const SkippedRegion &skipped) {
+				results[k].skipped.push_back(skipped);
+			},
+			[&](size_t k) {
+				results[k] = RangeResult();
+				frames[k].clear();
+			});
+		bytesRead = ranges.getPosition().offset;
+		rangeCount = ranges.size();
+	}
+
+	// Merge in log order
+	for (size_t k = 0; k < results.size(); ++k)
+	{
+		for (size_t i = 0; i < results[k].skipped.size(); ++i)
+		{
+			const SkippedRegion &skipped = results[k].skipped[i];
+			std::printf("Skipped %" PRIu64 " bytes at %" PRIu64 "-%" PRIu64 "\n", skipped.streamBytes,
+				skipped.begin, skipped.end);
+			++skippedRegions;
+			skippedBytes += skipped.streamBytes;
+		}
+		bootPackets += results[k].bootPackets;
+		dataPackets += results[k].dataPackets;
+		frameCount += frames[k].size();
+		outOfRange += results[k].outOfRange;
+		badPhase += results[k].badPhase;
+	}
+	if(status == PacketReader::TRUNCATED) std::printf("End Of File Reached\n");
+
+	std::vector<std::vector<QuickFitResult> > fits;
+	if(quickFit) {
+		QuickFitter::fitAll(pool, frames, fits);
+		uint64_t fitted = 0;
+		for (size_t k = 0; k < fits.size(); ++k)
+		{
+			for (size_t i = 0; i < fits[k].size(); ++i)
+			{
+				if(fits[k][i].status == QuickFitter::FIT) ++fitted;
+			}
+		}
+		std::printf("Fitted: %" PRIu64 " of %" PRIu64 " frames\n", fitted, frameCount);
+	}
+	if(templateFilename) {
+		TemplateBuilder builder(rawLength);
+		TemplateBuilder::addAll(pool, frames, fits, builder);
+		if(!builder.save(templateFilename)) {
+			std::fprintf(stderr, "%s: no template saved\n", templateFilename);
+			return 1;
+		}
+		std::printf("Template: %" PRIu64 " frames stacked into %s\n", builder.getFrames(), templateFilename);
+	}
+	std::vector<std::vector<TemplateFitResult> > templateFits;
+	if(!spline.empty()) {
+		TemplateFitter::fitAll(pool, frames, fits, spline, templateFits);
+		uint64_t fitted = 0;
+		for (size_t k = 0; k < templateFits.size(); ++k)
+		{
+			for (size_t i = 0; i < templateFits[k].size(); ++i)
+			{
+				if(templateFits[k][i].status == TemplateFitter::FIT) ++fitted;
+			}
+		}
+		std::printf("Template fitted: %" PRIu64 " of %" PRIu64 " frames\n", fitted, frameCount);
+	}
+	std::vector<std::vector<EnvironmentCorrector::Result> > corrections;
+	if(periods) {
+		EnvironmentCorrector::Result none;
+		none.period = none.correctedPeriod = NAN;
+		for (int i = 0; i < EnvironmentCorrector::FEATURES; ++i) none.coefficients[i] = NAN;
+		if(analysis.corrector) corrections.resize(fits.size());
+		for (size_t k = 0; k < fits.size(); ++k)
+		{
+			if(analysis.corrector) corrections[k].assign(fits[k].size(), none);
+			for (size_t i = 0; i < fits[k].size(); ++i)
+			{
+				if(fits[k][i].status != QuickFitter::FIT) continue;
+				const Telemetry &row = results[k].telemetry[i];
+				Environment environment;
+				environment.set(row.thermistor, row.temperature, row.pressure, row.humidity);
+				addPeriod(analysis, row.timeSinceLastBootPacket, environment, fits[k][i],
+					spline.empty()?NULL:&templateFits[k][i], analysis.corrector?&corrections[k][i]:NULL);
+			}
+		}
+		printPeriods(stdout, analysis);
+	}
+
+	if(exportDirectory) {
+		ColumnStore store(exportDirectory);
+		for (size_t k = 0; k < results.size(); ++k)
+		{
+			store.addSegment(results[k].telemetry, frames[k], results[k].bootTimes);
+			if(quickFit) store.addFits(fits[k], QuickFitter::DEFAULT_FINGERS);
+			if(!spline.empty()) store.addTemplateFits(templateFits[k]);
+			if(analysis.corrector) store.addCorrections(corrections[k]);
+		}
+		if(!store.write()) {
+			std::perror(exportDirectory);
+			return 1;
+		}
+		std::printf("Exported: %" PRIu64 " rows to %s\n", store.size(), exportDirectory);
+	}
+	if(rangeCount) std::printf("Ranges: %zu on %u threads\n", rangeCount, pool.size());
+
+	// Cleanup
+	end = std::chrono::steady_clock::now();
+	time_spent = std::chrono::duration<double>(end - begin).count();
+	std::printf("Finished: %" PRIu64 " bytes read (%f MB) in %f seconds (%f MB/s)\n", (uint64_t)bytesRead,
+		((bytesRead/1024.)/1024.), time_spent, ((bytesRead/1024.)/1024.)/time_spent);
+	std::printf("Packets: %" PRIu64 " boot %" PRIu64 " data\n", bootPackets, dataPackets);
+	std::printf("Skipped: %" PRIu64 " regions %" PRIu64 " bytes\n", skippedRegions, skippedBytes);
+	std::printf("Frames: %" PRIu64 " (%" PRIu64 " out of range, %" PRIu64 " bad phase)\n", frameCount,
+		outOfRange, badPhase);
+	return 0;
+}
+
+// Writes the data packets from position on to stdout as the log grows, until
+// it can no longer be read.  With a refiner or analysis, every frame is fitted,
+// with spline or the refiner's template.  With a refiner, the frame is folded
+// into its template, which is saved to templateFilename when it changes.  With
+// analysis, its period is added.
+int follow(const char *filename, size_t rawLength, StreamPosition position, const SplineTemplate &spline,
+	TemplateRefiner *refiner, const char *templateFilename, PeriodAnalysis *analysis)
+{
+	FileFollower follower;
+	if(!follower.open(filename)) {
+		std::perror(filename);
+		return 1;
+	}
+	Reconstituter reconstituter(rawLength);
+	std::vector<uint16_t> frame(rawLength);
+	MappedFile file;
+	Packet packet;
+	QuickFitter quickFitter(rawLength);
+	QuickFitResult quickFit;
+	TemplateFitResult templateFit;
+	std::shared_ptr<const SplineTemplate> current;
+	std::unique_ptr<TemplateFitter> templateFitter;
+	if(refiner) {
+		current = refiner->getTemplate();
+	} else if(!spline.empty()) {
+		current = std::make_shared<const SplineTemplate>(spline);
+	}
+	if(current) templateFitter.reset(new TemplateFitter(rawLength, *current));
+	for (;;)
+	{
+		// Map what has been written so far and read every complete packet in it
+		if(!file.open(filename)) {
+			std::perror(filename);
+			return 1;
+		}
+		PacketReader reader(file.getData(), file.getSize(), rawLength);
+		reader.seek(position);
+		for (;;)
+		{
+			PacketReader::Status status = reader.next(packet);
+			if(status == PacketReader::BAD_HEADER) {
+				SkippedRegion skipped;
+				StreamPosition bad = reader.getPosition();
+				if(!reader.resync(skipped)) {
+					// The next good packet may not be complete yet
+					reader.seek(bad);
+					break;
+				}
+				std::fprintf(stderr, "Skipped %" PRIu64 " bytes at %" PRIu64 "-%" PRIu64 "\n", skipped.streamBytes,
+					skipped.begin, skipped.end);
+				continue;
+			}
+			// A packet or chunk still being written is read again once it is complete
+			if(status != PacketReader::PACKET) break;
+			if(packet.type != PacketReader::DATA_PACKET) continue;
+			if(reconstituter.reconstitute(packet.data, &frame[0]) == Reconstituter::BAD_PHASE) continue;
+
+			DataPacketView view(packet.data, rawLength);
+			uint64_t samplesSinceBoot = view.getTimeSinceLastBootPacket();
+			std::printf("%" PRIu64 "\n", samplesSinceBoot);
+			for (size_t i = 0; i < rawLength; ++i)
+			{
+				std::printf("%u\n", frame[i]);
+			}
+
+			if((!refiner && !analysis) || quickFitter.fit(&frame[0], quickFit) != QuickFitter::FIT) continue;
+			if(templateFitter) templateFitter->fit(&frame[0], quickFit, quickFitter.getFingers(), templateFit);
+			if(analysis) {
+				Environment environment;
+				environment.parse(view);
+				EnvironmentCorrector::Result correction;
+				if(addPeriod(*analysis, samplesSinceBoot, environment, quickFit, templateFitter?&templateFit:NULL,
+					&correction) && analysis->kept % REPORT_PERIODS == 0) {
+					printPeriods(stderr, *analysis);
+				}
+			}
+			if(!refiner || !refiner->add(&frame[0], quickFit.direction, templateFit)) continue;
+			current = refiner->getTemplate();
+			templateFitter.reset(new TemplateFitter(rawLength, *current));
+			if(!current->save(templateFilename)) {
+				std::perror(templateFilename);
+				return 1;
+			}
+			std::fprintf(stderr, "Template %" PRIu64 " from %" PRIu64 " frames saved to %s\n", refiner->getVersion(),
+				refiner->getFrames(), templateFilename);
+		}
+		std::fflush(stdout);
+		position = reader.getPosition();
+		bytesRead = position.offset;
+		if(!follower.wait(file.getSize())) {
+			std::perror(filename);
+			return 1;
+		}
+	}
+}
+
+// Adds the period of a quick fitted frame, and of its template fit if there is
+// one, to the analysis, corrected for the environment of its packet into
+// correction if the analysis has a corrector.  Returns true if it is kept.
+// Only the periods of frames going one way go into the Allan deviations, so
+// that they follow each other without overlapping.
+bool addPeriod(PeriodAnalysis &analysis, uint64_t samplesSinceBoot, const Environment &environment,
+	const QuickFitResult &quick, const TemplateFitResult *fit, EnvironmentCorrector::Result *correction)
+{
+	PeriodResult period = analysis.tracker.add(samplesSinceBoot, quick, fit);
+	if(!period.kept) return false;
+	if(analysis.corrector && correction) analysis.corrector->add(period.period, environment, *correction);
+	++analysis.kept;
+	analysis.periodSum += period.period;
+	if(!std::isnan(period.amplitude)) {
+		analysis.amplitudeSum += period.amplitude;
+		++analysis.amplitudes;
+	}
+	if(analysis.allan && quick.direction > 0) analysis.allan->add(period.period/PeriodTracker::NOMINAL_PERIOD - 1);
+	if(analysis.periodSpectrum) analysis.periodSpectrum->add(1e6*(period.period/PeriodTracker::NOMINAL_PERIOD - 1));
+	if(analysis.swingSpectrum && period.swing > 0) analysis.swingSpectrum->add(60*period.swing);
+	return true;
+}
+
+void printPeriods(FILE *out, const PeriodAnalysis &analysis)
+{
+	std::fprintf(out, "Periods: %" PRIu64 " kept", analysis.kept);
+	if(analysis.kept) std::fprintf(out, ", mean %.9f s", analysis.periodSum/analysis.kept);
+	if(analysis.amplitudes) std::fprintf(out, ", amplitude %.4f deg", analysis.amplitudeSum/analysis.amplitudes);
+	std::fprintf(out, "\n");
+	if(analysis.allan) {
+		std::vector<AllanPoint> points;
+		analysis.allan->snapshot(points);
+		std::fprintf(out, "Allan deviation of %" PRIu64 " periods:\n", analysis.allan->size());
+		for (size_t k = 0; k < points.size(); ++k)
+		{
+			std::fprintf(out, "  tau %10.0f s adev %.3e", points[k].tau, points[k].adev);
+			if(points[k].modTerms) std::fprintf(out, " mdev %.3e", points[k].mdev);
+			else std::fprintf(out, " mdev -");
+			std::fprintf(out, " (%" PRIu64 " terms)\n", points[k].terms);
+		}
+	}
+	if(analysis.periodSpectrum) printSpectrum(out, "periods (ppm)", *analysis.periodSpectrum);
+	if(analysis.swingSpectrum) printSpectrum(out, "swings (arcmin)", *analysis.swingSpectrum);
+	if(analysis.corrector) {
+		const std::vector<double> &coefficients = analysis.corrector->getCoefficients();
+		std::fprintf(out, "Environment of %" PRIu64 " periods: %+.3f ppm, block %+.5f ppm/C and %+.5f ppm/C^2, board %+.5f ppm/C, pressure %+.5f ppm/Pa, humidity %+.5f ppm/%%\n",
+			analysis.corrector->size(), coefficients[EnvironmentCorrector::INTERCEPT],
+			coefficients[EnvironmentCorrector::BLOCK_TEMPERATURE], coefficients[EnvironmentCorrector::BLOCK_TEMPERATURE_SQUARED],
+			coefficients[EnvironmentCorrector::BOARD_TEMPERATURE], coefficients[EnvironmentCorrector::PRESSURE],
+			coefficients[EnvironmentCorrector::HUMIDITY]);
+	}
+}
+
+// The dominant periodicities of a spectrum
+void printSpectrum(FILE *out, const char *name, const WelchSpectrum &spectrum)
+{
+	std::vector<SpectralPeak> peaks;
+	spectrum.getDominant(DOMINANT_PERIODICITIES, peaks);
+	std::fprintf(out, "Spectrum of %" PRIu64 " %s in %" PRIu64 " segments of %zu:\n", spectrum.size(), name,
+		spectrum.getSegments(), spectrum.getSegmentLength());
+	for (size_t k = 0; k < peaks.size(); ++k)
+	{
+		std::fprintf(out, "  every %10.1f s psd %.3e\n", 1/peaks[k].frequency, peaks[k].psd);
+	}
+}
+
+// Ordinal of the first packet at or after a window bound
+uint64_t findBound(const PacketIndex &index, const char *bound)
+{
+	const char *value = bound + 1;
+	switch(*bound) {
+		case 'o':
+			return std::min<uint64_t>(std::strtoull(value,NULL,10), index.size());
+		case 'e':
+			return index.findEpoch(std::strtoul(value,NULL,10));
+		case 's': {
+			char *sequence;
+			uint32_t epoch = std::strtoul(value,&sequence,10);
+			return index.findSequenceNumber(epoch, (*sequence == ':')?std::strtoul(sequence + 1,NULL,10):0);
+		}
+		case 't':
+			return index.findTime(std::strtod(value,NULL));
+	}
+	std::fprintf(stderr, "Unknown bound %s\n", bound);
+	return index.size();
+}
+
+void catch_function(int signo)
+{
+	std::fprintf(stderr, "Progress: %" PRIu64 " bytes read (%f MB)\n", (uint64_t)bytesRead, (bytesRead/1000000.));
+}